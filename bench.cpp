@@ -0,0 +1,433 @@
+#include "utils.h"
+#include "reactor.h"
+#include "protocol.h"
+#include "compress.h"
+#include <sys/socket.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+
+using namespace std;
+
+/**
+ * Microbenchmarks de las primitivas del protocolo. Cada caso se repite hasta
+ * ocupar un tiempo mínimo y se informa del coste por operación. La salida es
+ * CSV (por defecto) o JSON para poder comparar compilaciones:
+ *
+ *   ./bench --json > antes.json
+ */
+
+typedef struct bench_result_t
+{
+    string group; // encode, decode, roundtrip, broadcast, compress
+    string name;  // variante medida
+    long size;    // bytes de texto (o tamaño de la sala en broadcast)
+    long long iterations;
+    double nsPerOp;
+    double mbPerSec; // 0 si no aplica
+} bench_result_t;
+
+static vector<bench_result_t> results;
+static double minSeconds = 0.2;
+
+// Impide que el compilador elimine un resultado que no se usa
+template <typename T>
+static inline void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * @brief Ejecuta op en lotes crecientes hasta superar minSeconds
+ * @param bytesPerOp Para calcular el caudal (0 si no tiene sentido)
+ */
+static void run(const string &group, const string &name, long size, long bytesPerOp, const function<void(long long)> &op)
+{
+    long long iterations = 1;
+    while (true)
+    {
+        auto start = chrono::steady_clock::now();
+        op(iterations);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (seconds >= minSeconds || iterations > (1LL << 40))
+        {
+            double nsPerOp = seconds * 1e9 / iterations;
+            double mbPerSec = bytesPerOp > 0 ? bytesPerOp * iterations / seconds / 1e6 : 0;
+            results.push_back({group, name, size, iterations, nsPerOp, mbPerSec});
+            fprintf(stderr, "%-10s %-24s %8ld %12.1f ns/op %10.1f MB/s\n", group.c_str(), name.c_str(), size, nsPerOp, mbPerSec);
+            return;
+        }
+        iterations *= seconds > 0.01 ? (long long)(minSeconds / seconds * 1.2) + 1 : 10;
+    }
+}
+
+/**
+ * @brief Codificación de un mensaje público [tipo][usuario][texto]
+ */
+static void benchEncode(long size)
+{
+    string username = "usuario42";
+    string text(size, 'x');
+    long bytes = sizeof(int) * 3 + username.size() + size;
+
+    // pack/packv sobre un vector nuevo en cada mensaje (como sendMSG)
+    run("encode", "pack+packv", size, bytes, [&](long long n)
+        {
+        for (long long i = 0; i < n; i++)
+        {
+            vector<unsigned char> packet;
+            pack<int>(packet, MSG_TYPE_PUBLIC);
+            pack<int>(packet, username.length());
+            packv(packet, username.data(), username.length());
+            pack<int>(packet, text.length());
+            packv(packet, text.data(), text.length());
+            keep(packet.data());
+        } });
+
+    // frame_builder_t reutilizado (camino del servidor)
+    run("encode", "frame_builder", size, bytes, [&](long long n)
+        {
+        frame_builder_t &builder = threadFrameBuilder();
+        for (long long i = 0; i < n; i++)
+        {
+            builder.begin(sizeof(int) + stringFieldSize(username) + stringFieldSize(text));
+            builder.put<int>(MSG_TYPE_PUBLIC);
+            builder.putString(username);
+            builder.putString(text);
+            builder.finish();
+            keep(builder.bytes.data());
+        } });
+
+    // Codificador generado por el esquema (protocol.h): debe costar lo mismo
+    run("encode", "schema", size, bytes, [&](long long n)
+        {
+        frame_builder_t &builder = threadFrameBuilder();
+        for (long long i = 0; i < n; i++)
+        {
+            encodeMessage(builder, public_msg_t{{0, username}, text});
+            keep(builder.bytes.data());
+        } });
+
+    // Protocolo v2: cabecera de 4 bytes, varints y remitente por id
+    public_msg_t compact = {{42, username}, text};
+    long compactBytes = messagePayloadSize(compact, PROTOCOL_V2) + sizeof(int);
+    run("encode", "schema-v2", size, compactBytes, [&](long long n)
+        {
+        frame_builder_t &builder = threadFrameBuilder();
+        for (long long i = 0; i < n; i++)
+        {
+            encodeMessage(builder, compact, PROTOCOL_V2);
+            keep(builder.bytes.data());
+        } });
+}
+
+/**
+ * @brief Decodificación del mismo mensaje
+ */
+static void benchDecode(long size)
+{
+    string username = "usuario42";
+    string text(size, 'x');
+    frame_builder_t builder;
+    encodeMessage(builder, public_msg_t{{0, username}, text});
+    vector<unsigned char> encoded(builder.payload(), builder.payload() + builder.payloadSize());
+    long bytes = encoded.size();
+
+    // En v2 la vista del lector empieza en el byte del tipo de la cabecera
+    encodeMessage(builder, public_msg_t{{42, username}, text}, PROTOCOL_V2);
+    vector<unsigned char> compact(builder.bytes.begin() + 3, builder.bytes.end());
+
+    // unpack/unpackv sobre vector: cada campo desplaza el resto (memmove).
+    // Incluye la copia del mensaje, que el decodificador destruye.
+    run("decode", "unpack+unpackv", size, bytes, [&](long long n)
+        {
+        vector<unsigned char> packet;
+        string user, message;
+        for (long long i = 0; i < n; i++)
+        {
+            packet = encoded;
+            int type = unpack<int>(packet);
+            user.resize(unpack<int>(packet));
+            unpackv(packet, (char *)user.data(), user.size());
+            message.resize(unpack<int>(packet));
+            unpackv(packet, (char *)message.data(), message.size());
+            keep(type);
+            keep(message.data());
+        } });
+
+    // Cursor con vistas (camino del servidor): sin copias
+    run("decode", "cursor+view", size, bytes, [&](long long n)
+        {
+        for (long long i = 0; i < n; i++)
+        {
+            msg_cursor_t cursor = makeCursor(encoded);
+            int type = unpack<int>(cursor);
+            string_view user = unpackView(cursor);
+            string_view message = unpackView(cursor);
+            keep(type);
+            keep(user.data());
+            keep(message.data());
+        } });
+
+    // Despacho estático del esquema: tipo, decodificación y llamada al visitante
+    run("decode", "schema", size, bytes, [&](long long n)
+        {
+        for (long long i = 0; i < n; i++)
+        {
+            msg_cursor_t cursor = makeCursor(encoded);
+            dispatchMessage<server_messages_t>(cursor, [](const auto &message)
+                                               { keep(&message); });
+        } });
+
+    run("decode", "schema-v2", size, compact.size() + 3, [&](long long n)
+        {
+        for (long long i = 0; i < n; i++)
+        {
+            msg_cursor_t cursor = makeCursor(compact);
+            cursor.version = PROTOCOL_V2;
+            dispatchMessage<server_messages_t>(cursor, [](const auto &message)
+                                               { keep(&message); });
+        } });
+}
+
+/**
+ * @brief Registra un extremo de un socketpair como conexión del registro
+ */
+static int registerSocket(int socket)
+{
+    connection_t connection;
+    connection.id = reserveConnectionID();
+    connection.serverId = connection.id;
+    connection.socket = socket;
+    connection.queue = new msg_queue_t();
+    connection.reader = new frame_reader_t();
+    connection.alive = true;
+    publishConnection(connection.id, connection);
+    return connection.id;
+}
+
+/**
+ * @brief Ida y vuelta sendMSG → recvMSG → sendMSG → recvMSG sobre un socketpair
+ * con un hilo de eco
+ */
+static void benchRoundTrip(long size)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        printf("ERROR: socketpair\n");
+        return;
+    }
+    int local = registerSocket(fds[0]);
+    int remote = registerSocket(fds[1]);
+
+    thread echo([remote]()
+                {
+        vector<unsigned char> data;
+        while (true)
+        {
+            recvMSG(remote, data);
+            if (data.empty())
+                break;
+            sendMSG(remote, data);
+        } });
+
+    vector<unsigned char> request(size, 'x');
+    vector<unsigned char> reply;
+    run("roundtrip", "sendMSG/recvMSG", size, 2 * (size + sizeof(int)), [&](long long n)
+        {
+        for (long long i = 0; i < n; i++)
+        {
+            sendMSG(local, request);
+            recvMSG(local, reply);
+        } });
+
+    // Lo mismo recibiendo con recvMSGAsync: mensajes del pool y cola sin cerrojos
+    thread receiver(recvMSGAsync, local);
+    run("roundtrip", "sendMSG/recvMSGAsync", size, 2 * (size + sizeof(int)), [&](long long n)
+        {
+        for (long long i = 0; i < n; i++)
+        {
+            sendMSG(local, request);
+            msg_t *msg;
+            while ((msg = takeMSG(local)) == nullptr)
+                this_thread::yield();
+            releaseMSG(msg);
+        } });
+    msg_pool_stats_t pool = getMsgPoolStats();
+    fprintf(stderr, "%-10s %-24s %8ld aciertos %llu/%llu, en uso máx. %llu, cola máx. %llu\n", "roundtrip", "msgpool",
+            size, pool.hits, pool.acquires, pool.inUseHighWater, pool.queueHighWater);
+
+    // Mensaje vacío: fin del eco; al cerrar remote el receptor ve el cierre
+    vector<unsigned char> empty;
+    sendMSG(local, empty);
+    echo.join();
+    closeConnection(remote);
+    receiver.join();
+    closeConnection(local);
+}
+
+/**
+ * @brief Coste de preparar un broadcast público para una sala de roomSize
+ * usuarios: recodificar para cada destinatario frente a codificar una vez y
+ * compartir la trama (lo que hace el fan-out del reactor)
+ */
+static void benchBroadcast(long roomSize)
+{
+    string username = "usuario42";
+    string text(128, 'x');
+    vector<frame_ptr_t> queues(roomSize);
+
+    run("broadcast", "encode-per-recipient", roomSize, 0, [&](long long n)
+        {
+        for (long long i = 0; i < n; i++)
+            for (long r = 0; r < roomSize; r++)
+            {
+                vector<unsigned char> packet;
+                pack<int>(packet, MSG_TYPE_PUBLIC);
+                pack<int>(packet, username.length());
+                packv(packet, username.data(), username.length());
+                pack<int>(packet, text.length());
+                packv(packet, text.data(), text.length());
+                queues[r] = makeFrame(packet);
+            } });
+
+    run("broadcast", "encode-once-shared", roomSize, 0, [&](long long n)
+        {
+        for (long long i = 0; i < n; i++)
+        {
+            frame_builder_t builder;
+            builder.begin(sizeof(int) + stringFieldSize(username) + stringFieldSize(text));
+            builder.put<int>(MSG_TYPE_PUBLIC);
+            builder.putString(username);
+            builder.putString(text);
+            builder.finish();
+            frame_ptr_t frame = adoptFrame(move(builder.bytes));
+            for (long r = 0; r < roomSize; r++)
+                queues[r] = frame;
+        } });
+}
+
+/**
+ * @brief Compresión de una trama pública con texto de chat (se hace una vez
+ * por broadcast grande) y su descompresión en el cliente
+ */
+static void benchCompress(long size)
+{
+    const char *words[] = {"hola ", "que ", "tal ", "el ", "servidor ", "mensaje ", "canal ", "de ", "chat ", "historial "};
+    string username = "usuario42";
+    string text;
+    for (long i = 0; (long)text.size() < size; i++)
+        text += words[(i * 7 + i / 3) % 10];
+    text.resize(size);
+
+    vector<unsigned char> frame = encodeFrame(public_msg_t{{0, username}, text}, PROTOCOL_V2);
+    vector<unsigned char> packed;
+    if (!compressFrames(frame.data(), frame.size(), PROTOCOL_V2, packed))
+        return;
+    fprintf(stderr, "%-10s %-24s %8ld %12zu -> %zu bytes\n", "compress", "ratio", size, frame.size(), packed.size());
+
+    run("compress", "deflate", size, frame.size(), [&](long long n)
+        {
+        vector<unsigned char> out;
+        for (long long i = 0; i < n; i++)
+        {
+            compressFrames(frame.data(), frame.size(), PROTOCOL_V2, out);
+            keep(out.data());
+        } });
+
+    // La vista empieza en el byte del tipo, como la da frame_reader_t
+    msg_cursor_t cursor = makeCursor(packed.data() + 3, packed.size() - 3);
+    cursor.version = PROTOCOL_V2;
+    unpackMessageType(cursor);
+    compressed_msg_t message;
+    decodeMessage(cursor, message);
+    run("compress", "inflate", size, frame.size(), [&](long long n)
+        {
+        vector<unsigned char> out;
+        for (long long i = 0; i < n; i++)
+        {
+            inflateFrames(message, out);
+            keep(out.data());
+        } });
+}
+
+static void printCSV()
+{
+    printf("group,name,size,iterations,ns_per_op,mb_per_sec\n");
+    for (const bench_result_t &r : results)
+        printf("%s,%s,%ld,%lld,%.2f,%.2f\n", r.group.c_str(), r.name.c_str(), r.size, r.iterations, r.nsPerOp, r.mbPerSec);
+}
+
+static void printJSON()
+{
+    printf("[\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const bench_result_t &r = results[i];
+        printf("  {\"group\": \"%s\", \"name\": \"%s\", \"size\": %ld, \"iterations\": %lld, "
+               "\"ns_per_op\": %.2f, \"mb_per_sec\": %.2f}%s\n",
+               r.group.c_str(), r.name.c_str(), r.size, r.iterations, r.nsPerOp, r.mbPerSec,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("]\n");
+}
+
+void printUsage(const char *program)
+{
+    cout << "Uso: " << program << " [opciones]" << endl
+         << "  --json                 resultados en JSON (por defecto CSV)" << endl
+         << "  --min-time S           segundos mínimos por caso (0.2)" << endl
+         << "  --filter G             solo el grupo G (encode, decode, roundtrip, broadcast, compress)" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    string filter;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--json")
+            json = true;
+        else if (arg == "--min-time" && i + 1 < argc)
+            minSeconds = atof(argv[++i]);
+        else if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else
+        {
+            printUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    const long sizes[] = {16, 64, 256, 1024, 4096, 16384, 65536};
+    const long roomSizes[] = {10, 100, 1000, 10000};
+
+    if (filter.empty() || filter == "encode")
+        for (long size : sizes)
+            benchEncode(size);
+    if (filter.empty() || filter == "decode")
+        for (long size : sizes)
+            benchDecode(size);
+    if (filter.empty() || filter == "roundtrip")
+        for (long size : sizes)
+            benchRoundTrip(size);
+    if (filter.empty() || filter == "broadcast")
+        for (long roomSize : roomSizes)
+            benchBroadcast(roomSize);
+    if (filter.empty() || filter == "compress")
+        for (long size : sizes)
+            if (size >= (long)COMPRESS_MIN_BYTES)
+                benchCompress(size);
+
+    if (json)
+        printJSON();
+    else
+        printCSV();
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "channels.h"
+
+#include <map>
+#include <unordered_set>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <algorithm>
+
+const int CHANNEL_SHARDS = 16;
+
+typedef struct alignas(64) channel_shard_t
+{
+    std::shared_mutex mutex;
+    std::map<std::string, std::unordered_set<int>, std::less<>> channels;
+} channel_shard_t;
+
+static channel_shard_t shards[CHANNEL_SHARDS];
+
+static channel_shard_t &shardOf(std::string_view name)
+{
+    return shards[std::hash<std::string_view>()(name) & (CHANNEL_SHARDS - 1)];
+}
+
+bool channelNameValid(std::string_view name)
+{
+    if (name.empty() || name.size() > MAX_CHANNEL_NAME)
+        return false;
+    for (char c : name)
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+            return false;
+    return true;
+}
+
+size_t channelJoin(std::string_view name, int connID)
+{
+    channel_shard_t &shard = shardOf(name);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.channels.find(name);
+    if (it == shard.channels.end())
+        it = shard.channels.emplace(std::string(name), std::unordered_set<int>()).first;
+    if (!it->second.insert(connID).second)
+        return 0;
+    return it->second.size();
+}
+
+bool channelLeave(std::string_view name, int connID)
+{
+    channel_shard_t &shard = shardOf(name);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.channels.find(name);
+    if (it == shard.channels.end() || it->second.erase(connID) == 0)
+        return false;
+    if (it->second.empty())
+        shard.channels.erase(it);
+    return true;
+}
+
+bool channelIsMember(std::string_view name, int connID)
+{
+    channel_shard_t &shard = shardOf(name);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.channels.find(name);
+    return it != shard.channels.end() && it->second.count(connID) > 0;
+}
+
+bool channelMembers(std::string_view name, std::vector<int> &ids)
+{
+    ids.clear();
+    channel_shard_t &shard = shardOf(name);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.channels.find(name);
+    if (it == shard.channels.end())
+        return false;
+    ids.assign(it->second.begin(), it->second.end());
+    return true;
+}
+
+void channelList(std::vector<std::pair<std::string, size_t>> &channels)
+{
+    channels.clear();
+    for (channel_shard_t &shard : shards)
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (auto const &channel : shard.channels)
+            channels.emplace_back(channel.first, channel.second.size());
+    }
+    std::sort(channels.begin(), channels.end());
+}
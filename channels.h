@@ -0,0 +1,50 @@
+#ifndef _CHANNELS_H_
+#define _CHANNELS_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+/**
+ * Índice de suscripciones a canales (canal → conexiones). Igual que el
+ * directorio de usuarios, los canales se reparten por hash entre shards con su
+ * propio cerrojo de lectura/escritura. Un mensaje a un canal solo toca a sus
+ * miembros: el coste depende del tamaño del canal, no del número de usuarios
+ * del servidor.
+ */
+
+// Longitud máxima del nombre de un canal
+const size_t MAX_CHANNEL_NAME = 64;
+
+/**
+ * @brief Comprueba que el nombre sea válido (no vacío, sin espacios, acotado)
+ */
+bool channelNameValid(std::string_view name);
+
+/**
+ * @brief Suscribe la conexión al canal (lo crea si no existe)
+ * @return Número de miembros tras unirse, o 0 si ya era miembro
+ */
+size_t channelJoin(std::string_view name, int connID);
+
+/**
+ * @brief Da de baja la conexión (el canal desaparece al quedarse vacío)
+ * @return false si no era miembro
+ */
+bool channelLeave(std::string_view name, int connID);
+
+bool channelIsMember(std::string_view name, int connID);
+
+/**
+ * @brief Copia en ids los miembros del canal
+ * @return false si el canal no existe
+ */
+bool channelMembers(std::string_view name, std::vector<int> &ids);
+
+/**
+ * @brief Lista de canales con su número de miembros, ordenada por nombre
+ */
+void channelList(std::vector<std::pair<std::string, size_t>> &channels);
+
+#endif
@@ -1,9 +1,16 @@
 #include "utils.h"
+#include "protocol.h"
+#include "compress.h"
 #include <string>
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <sstream> // Necesario para parsear comandos
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
 
 using namespace std;
 
@@ -16,112 +23,335 @@ const string C_MAGENTA = "\033[35m";
 const string C_CYAN = "\033[36m";
 const string C_BOLD = "\033[1m";
 
-// --- Constantes del Protocolo ---
-const int MSG_TYPE_PUBLIC = 0;
-const int MSG_TYPE_PRIVATE = 1;
-const int MSG_TYPE_NOTIFICATION = 2; // Mensajes del servidor al cliente
+// --- Reanudación de sesión ---
+const int RECONNECT_ATTEMPTS = 10;
+const int RECONNECT_DELAY_MS = 100; // se multiplica por el número de intento
+
+// --- Versión del protocolo ---
+const int NEGOTIATE_TIMEOUT_MS = 1000; // un servidor que no contesta a la versión es v1
+
+atomic<int> protocolVersion(0);       // acordada en el saludo (0: aún no)
+map<unsigned int, string> senderNames; // ids de remitente de v2 (solo el hilo de recepción)
+
+atomic<int> serverID(-1);            // conexión actual (cambia al reconectar)
+string sessionToken;                 // vacío si el servidor no admite reanudar
+unsigned long long receivedBytes = 0; // secuencia: bytes de tramas recibidas en la sesión
+string unixPath;                     // socket local del servidor (vacío: TCP a 127.0.0.1:3000)
+
+// Mientras se reconecta, lo que escribe el usuario se guarda y se envía cuando
+// el servidor confirma la sesión (MSG_TYPE_SESSION)
+mutex linkMutex;
+bool linkDown = false;
+vector<unsigned char> pendingFrames;
+
+/**
+ * @brief Conecta con el servidor por el socket local si se indicó, si no por TCP
+ */
+connection_t connectServer()
+{
+    return unixPath.empty() ? initClient("127.0.0.1", 3000) : initUnixClient(unixPath);
+}
+
+/**
+ * @brief Envía el saludo [usuario][token][recibido][versión][compresión]. Con
+ * token vacío pide una sesión reanudable nueva; propone la versión del
+ * protocolo ya acordada (la última si aún no hay ninguna) y admite zlib. Un
+ * servidor sin reanudación solo lee el nombre.
+ */
+void sendHello(int id, const string &username, const string &token, unsigned long long received)
+{
+    int version = protocolVersion != 0 ? protocolVersion.load() : PROTOCOL_LATEST;
+    sendFrame(id, encodeMessage(threadFrameBuilder(),
+                                hello_msg_t{username, token, (long long)received, version, COMPRESSION_ZLIB}));
+}
+
+/**
+ * @brief Nombre del remitente: el que trae el mensaje o el anunciado para su id
+ */
+string senderName(const user_ref_t &sender)
+{
+    if (sender.id == 0)
+        return string(sender.name);
+    auto it = senderNames.find(sender.id);
+    return it != senderNames.end() ? it->second : "#" + to_string(sender.id);
+}
+
+/**
+ * @brief Abre un socket nuevo con el servidor y saluda en él
+ * @param resume Pedir reanudar la sesión actual (si no, una nueva)
+ * @return false si no se pudo conectar tras varios intentos
+ */
+bool reconnect(const string &username, bool resume)
+{
+    for (int attempt = 0; attempt < RECONNECT_ATTEMPTS; attempt++)
+    {
+        if (attempt > 0)
+            this_thread::sleep_for(chrono::milliseconds(RECONNECT_DELAY_MS * attempt));
+        connection_t connection = connectServer();
+        if (connection.socket == -1)
+            continue;
+        // El saludo tiene que ser lo primero que lea el servidor: la conexión
+        // nueva no se publica hasta haberlo enviado
+        sendHello(connection.serverId, username, resume ? sessionToken : "", resume ? receivedBytes : 0);
+        closeConnection(serverID.exchange(connection.serverId));
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Envía la trama, o la guarda si la conexión está caída
+ */
+void sendOrQueue(const frame_builder_t &builder)
+{
+    {
+        lock_guard<mutex> lock(linkMutex);
+        if (linkDown)
+        {
+            pendingFrames.insert(pendingFrames.end(), builder.bytes.begin(), builder.bytes.end());
+            cout << C_YELLOW << "Sin conexión: se enviará al recuperarla." << C_RESET << endl;
+            return;
+        }
+    }
+    sendFrame(serverID, builder);
+}
 
 /**
  * @brief Función para recibir en paralelo mensajes reenviados por el servidor
- * @param serverID ID del socket del servidor
+ * @param username Nombre con el que reconectar si se cae la conexión
  * @param exitChat Referencia a la variable bool para controlar la salida
  */
-void receiveMessages(int serverID, bool &exitChat)
+void receiveMessages(string username, bool &exitChat)
 {
-    vector<unsigned char> buffer;
-    string username;
-    string message;
+    msg_cursor_t cursor;
+    bool resuming = false; // se pidió reanudar y aún no ha llegado MSG_TYPE_SESSION
+    int failures = 0;      // reconexiones seguidas sin recibir nada
+    bool renegotiate = false; // el servidor acordó otra versión de la que ya se usa
+    vector<unsigned char> inflated; // tramas de un lote comprimido
 
     // bucle mientras no salir
     while (!exitChat)
     {
 
-        // Recibir mensaje del servidor
-        recvMSG(serverID, buffer);
-        if (buffer.size() == 0)
+        // Recibir mensaje del servidor: un read() puede traer varias tramas,
+        // que se van sacando del buffer de recepción sin volver al socket
+        if (!recvFrame(serverID, cursor))
         {
-            // conexión cerrada, salir
-            if (!exitChat)
+            if (exitChat)
+                continue;
+
+            // Con sesión reanudable se vuelve a conectar; si el servidor cerró
+            // sin aceptar la reanudación, se pide una sesión nueva
+            if (!sessionToken.empty() && failures++ < RECONNECT_ATTEMPTS)
             {
-                exitChat = true;
-                cout << C_RED << "\nEl servidor ha cerrado la conexión inesperadamente." << C_RESET << endl;
+                {
+                    lock_guard<mutex> lock(linkMutex);
+                    linkDown = true;
+                }
+                bool resume = !resuming;
+                cout << C_YELLOW << "\nConexión perdida, reconectando..." << C_RESET << endl;
+                if (reconnect(username, resume))
+                {
+                    resuming = resume;
+                    continue;
+                }
             }
+
+            // conexión cerrada, salir
+            exitChat = true;
+            cout << C_RED << "\nEl servidor ha cerrado la conexión inesperadamente." << C_RESET << endl;
             continue;
         }
 
-        // 1. Desempaquetar tipo de mensaje
-        int messageType = unpack<int>(buffer);
+        // Decodificación en una pasada: remitente y mensaje son vistas sobre el
+        // buffer. Las tramas de control no cuentan para la secuencia.
+        int messageType = peekMessageType(cursor);
+        if (messageType != MSG_TYPE_SESSION && messageType != MSG_TYPE_VERSION)
+            receivedBytes += frameWireSize(cursor);
 
-        // 2. Desempaquetar nombre de usuario (remitente)
-        int usernameLen = unpack<int>(buffer);
-        username.resize(usernameLen);
-        unpackv<char>(buffer, (char *)username.data(), usernameLen);
-
-        // 3. Desempaquetar mensaje
-        int messageLen = unpack<int>(buffer);
-        message.resize(messageLen);
-        unpackv<char>(buffer, (char *)message.data(), messageLen);
+        bool showPrompt = true;
+        auto handlers = message_visitor_t{
+            [&](const public_msg_t &m) // Mensaje Público
+            {
+                cout << "\n"
+                     << C_BOLD << senderName(m.sender) << C_RESET << ": " << m.text << endl;
+            },
+            [&](const private_msg_t &m) // Mensaje Privado
+            {
+                cout << "\n"
+                     << C_MAGENTA << "(Mensaje privado) " << C_BOLD << senderName(m.sender) << C_RESET << C_MAGENTA << ": " << m.text << C_RESET << endl;
+            },
+            [&](const channel_msg_t &m) // Mensaje a un canal
+            {
+                cout << "\n"
+                     << C_CYAN << "[" << m.channel << "] " << C_BOLD << senderName(m.sender) << C_RESET << ": " << m.text << endl;
+            },
+            [&](const notification_msg_t &m) // Notificación del Servidor
+            {
+                // Si es la notificación de 'exit()', solo salimos del bucle
+                if (m.text == "exit()")
+                {
+                    exitChat = true;
+                    showPrompt = false; // No imprimas "Notificación: exit()"
+                    return;
+                }
+                cout << "\n"
+                     << C_YELLOW << "Notificación: " << m.text << C_RESET << endl;
+            },
+            // Trama de control: fija la secuencia desde la que se cuentan los bytes
+            [&](const session_msg_t &m)
+            {
+                if (!sessionToken.empty() && m.token == sessionToken)
+                    cout << C_GREEN << "\nSesión reanudada." << C_RESET << endl;
+                else if (!sessionToken.empty())
+                {
+                    cout << C_YELLOW << "\nNo se pudo reanudar la sesión: puede que falten mensajes." << C_RESET << endl;
+                    senderNames.clear(); // sesión nueva: el servidor vuelve a enviar la tabla
+                }
+                sessionToken = m.token;
+                receivedBytes = m.seq;
+                resuming = false;
+                {
+                    // Lo escrito durante el corte sale ahora, detrás del saludo
+                    lock_guard<mutex> lock(linkMutex);
+                    if (!pendingFrames.empty())
+                        sendFrames(serverID, pendingFrames);
+                    pendingFrames.clear();
+                    linkDown = false;
+                }
+                failures = 0;
+                showPrompt = false;
+            },
+            // Versión acordada: lo que siga en esta conexión ya viene en ella
+            [&](const version_msg_t &m)
+            {
+                setFrameVersion(serverID, m.version);
+                int agreed = 0;
+                if (!protocolVersion.compare_exchange_strong(agreed, m.version) && agreed != m.version)
+                {
+                    // Llegó tarde (tras NEGOTIATE_TIMEOUT_MS ya se escribe en
+                    // v1) o el servidor bajó de versión al reanudar: él lee en
+                    // m.version desde el saludo y este cliente escribe en otra.
+                    // Se saluda de nuevo proponiendo la menor de las dos.
+                    protocolVersion = min(agreed, m.version);
+                    renegotiate = true;
+                }
+                else if (!resuming)
+                    senderNames.clear();
+                showPrompt = false;
+            },
+            [&](const user_msg_t &m)
+            {
+                if (m.name.empty())
+                    senderNames.erase(m.id);
+                else
+                    senderNames[m.id] = string(m.name);
+                showPrompt = false;
+            },
+            // Anillo de memoria compartida (este cliente no lo pide)
+            [&](const shm_msg_t &)
+            { showPrompt = false; },
+            // Lote comprimido: se descomprime aquí y se atiende después
+            [&](const compressed_msg_t &m)
+            {
+                if (!inflateFrames(m, inflated))
+                    cout << C_RED << "\nLote comprimido no válido." << C_RESET << endl;
+                showPrompt = false;
+            }};
+        bool ok = dispatchMessage<server_messages_t>(cursor, handlers);
+
+        // Las tramas del lote se atienden como si hubieran llegado sueltas (ya
+        // se contaron para la secuencia como parte del lote)
+        if (ok && !inflated.empty())
+        {
+            vector<unsigned char> batch;
+            batch.swap(inflated);
+            msg_cursor_t frames = makeCursor(batch);
+            frames.version = cursor.version;
+            msg_cursor_t frame;
+            bool shown = false;
+            while (ok && !exitChat && nextFrame(frames, frame))
+            {
+                showPrompt = true;
+                ok = dispatchMessage<server_messages_t>(frame, handlers);
+                shown = shown || showPrompt;
+            }
+            showPrompt = shown && !exitChat;
+        }
 
-        // 4. Mostrar según el tipo
-        switch (messageType)
+        if (renegotiate)
         {
-        case MSG_TYPE_PUBLIC: // Mensaje Público
-            cout << "\n"
-                 << C_BOLD << username << C_RESET << ": " << message << endl;
-            break;
-        case MSG_TYPE_PRIVATE: // Mensaje Privado
-            cout << "\n"
-                 << C_MAGENTA << "(Mensaje privado) " << C_BOLD << username << C_RESET << C_MAGENTA << ": " << message << C_RESET << endl;
-            break;
-        case MSG_TYPE_NOTIFICATION: // Notificación del Servidor
-            // Si es la notificación de 'exit()', solo salimos del bucle
-            if (message == "exit()")
+            renegotiate = false;
+            cout << C_YELLOW << "\nEl servidor acordó otra versión del protocolo: se vuelve a conectar (puede que se hayan perdido los últimos mensajes)." << C_RESET << endl;
+            sessionToken.clear(); // sesión nueva: no es un fallo de reanudación
+            if (!reconnect(username, false))
             {
                 exitChat = true;
-                continue; // No imprimas "Notificación: exit()"
+                cout << C_RED << "\nNo se pudo volver a conectar con el servidor." << C_RESET << endl;
             }
-            cout << "\n"
-                 << C_YELLOW << "Notificación: " << message << C_RESET << endl;
-            break;
+            continue;
+        }
+
+        if (!ok)
+        {
+            cout << C_RED << "\nMensaje mal formado del servidor." << C_RESET << endl;
+            continue;
         }
+        if (!showPrompt)
+            continue;
 
         cout << C_GREEN << "> " << C_RESET; // Volver a mostrar el prompt
         fflush(stdout);                     // Asegurar que el prompt se imprima
-        buffer.clear();
 
     } // fin del while
 }
 
 int main(int argc, char **argv)
 {
-    vector<unsigned char> buffer;
     string username;
     string inputLine; // Línea completa leída de cin
     string message;   // Mensaje final a enviar
+    string currentChannel; // Canal al que van los mensajes normales (vacío: público)
     bool exitChat = false;
 
+    if (argc == 3 && string(argv[1]) == "--unix")
+        unixPath = argv[2];
+    else if (argc != 1)
+    {
+        cout << "Uso: " << argv[0] << " [--unix PATH]" << endl;
+        return -1;
+    }
+
     // Pedir nombre de usuario por terminal
     cout << C_CYAN << "Introduzca nombre de usuario:" << C_RESET << endl;
     getline(cin, username);
 
-    // Iniciar conexión al server en localhost:3000
-    auto connection = initClient("127.0.0.1", 3000);
+    // Iniciar conexión al server en localhost:3000 (o en su socket local)
+    auto connection = connectServer();
     if (connection.socket == -1)
     {
         cout << C_RED << "Error: No se pudo conectar al servidor." << C_RESET << endl;
         return -1;
     }
     cout << C_GREEN << "Conectado al servidor. Escribe 'exit()' para salir o '/msg <usuario> <mensaje>' para mensaje privado." << C_RESET << endl;
+    cout << C_GREEN << "Canales: '/join <canal>', '/leave [canal]', '/list' y '/all <mensaje>' para escribir a todos." << C_RESET << endl;
+    cout << C_GREEN << "Historial: '/history [n]' muestra los últimos n mensajes." << C_RESET << endl;
+
+    serverID = connection.serverId;
 
     // Iniciar thread "receiveMessages".
-    thread *receiveThread = new thread(receiveMessages, connection.serverId, ref(exitChat));
+    thread *receiveThread = new thread(receiveMessages, username, ref(exitChat));
 
     // --- TAREA: Enviar nombre de usuario al servidor ---
-    int usernameLen = username.length();
-    pack<int>(buffer, usernameLen);
-    packv<char>(buffer, (char *)username.c_str(), usernameLen);
-    sendMSG(connection.serverId, buffer);
-    buffer.clear();
+    // (pidiendo una sesión reanudable por si se cae la conexión)
+    sendHello(serverID, username, "", 0);
+    frame_builder_t &builder = threadFrameBuilder();
+
+    // Esperar la versión acordada antes de enviar nada más
+    for (int waited = 0; protocolVersion == 0 && waited < NEGOTIATE_TIMEOUT_MS; waited += 10)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    int unknown = 0;
+    protocolVersion.compare_exchange_strong(unknown, PROTOCOL_V1);
     // ----------------------------------------------------
 
     // Bucle hasta que el usuario escribe "exit()"
@@ -134,10 +364,7 @@ int main(int argc, char **argv)
         {
             message = "exit()";
             // Empaquetar como mensaje público
-            pack<int>(buffer, MSG_TYPE_PUBLIC);
-            int messageLen = message.length();
-            pack<int>(buffer, messageLen);
-            packv<char>(buffer, (char *)message.c_str(), messageLen);
+            encodeMessage(builder, public_request_t{message}, protocolVersion);
         }
         // --- Implementación de Mensajes Privados ---
         else if (inputLine.rfind("/msg", 0) == 0)
@@ -164,30 +391,75 @@ int main(int argc, char **argv)
             }
 
             // Empaquetar como mensaje privado
-            pack<int>(buffer, MSG_TYPE_PRIVATE);
+            encodeMessage(builder, private_request_t{recipientName, message}, protocolVersion);
+        }
+        // --- Canales: unirse, salir y listar ---
+        else if (inputLine.rfind("/join ", 0) == 0 || inputLine.rfind("/leave", 0) == 0)
+        {
+            stringstream ss(inputLine);
+            string command;
+            string channel;
+            ss >> command >> channel;
 
-            int recipientLen = recipientName.length();
-            pack<int>(buffer, recipientLen);
-            packv<char>(buffer, (char *)recipientName.c_str(), recipientLen);
+            bool join = command == "/join";
+            if (!join && command != "/leave")
+            {
+                cout << C_RED << "Error: Comando desconocido." << C_RESET << endl;
+                continue;
+            }
+            if (!join && channel.empty())
+                channel = currentChannel;
+            if (channel.empty())
+            {
+                cout << C_RED << "Error: Formato incorrecto. Use: /join <canal> o /leave [canal]" << C_RESET << endl;
+                continue;
+            }
+
+            // Los mensajes normales pasan a ir al último canal al que se une
+            if (join)
+                currentChannel = channel;
+            else if (channel == currentChannel)
+                currentChannel.clear();
 
-            int messageLen = message.length();
-            pack<int>(buffer, messageLen);
-            packv<char>(buffer, (char *)message.c_str(), messageLen);
+            message = inputLine;
+            if (join)
+                encodeMessage(builder, join_request_t{channel}, protocolVersion);
+            else
+                encodeMessage(builder, leave_request_t{channel}, protocolVersion);
+        }
+        else if (inputLine == "/list")
+        {
+            message = inputLine;
+            encodeMessage(builder, list_request_t{}, protocolVersion);
+        }
+        // --- Historial: los últimos n mensajes públicos y privados ---
+        else if (inputLine == "/history" || inputLine.rfind("/history ", 0) == 0)
+        {
+            int count = inputLine.size() > 9 ? atoi(inputLine.c_str() + 9) : 20;
+            if (count <= 0)
+            {
+                cout << C_RED << "Error: Formato incorrecto. Use: /history [n]" << C_RESET << endl;
+                continue;
+            }
+            message = inputLine;
+            encodeMessage(builder, history_request_t{-1, count}, protocolVersion);
+        }
+        // --- Mensaje al canal actual ---
+        else if (!currentChannel.empty() && inputLine.rfind("/all ", 0) != 0)
+        {
+            message = inputLine;
+            encodeMessage(builder, channel_request_t{currentChannel, message}, protocolVersion);
         }
         // --- Mensaje Público Normal ---
         else
         {
-            message = inputLine;
+            message = inputLine.rfind("/all ", 0) == 0 ? inputLine.substr(5) : inputLine;
             // Empaquetar como mensaje público
-            pack<int>(buffer, MSG_TYPE_PUBLIC);
-            int messageLen = message.length();
-            pack<int>(buffer, messageLen);
-            packv<char>(buffer, (char *)message.c_str(), messageLen);
+            encodeMessage(builder, public_request_t{message}, protocolVersion);
         }
 
-        // Enviar el buffer (público, privado o de salida)
-        sendMSG(connection.serverId, buffer);
-        buffer.clear();
+        // Enviar la trama (público, privado o de salida) de una sola vez
+        sendOrQueue(builder);
 
     } while (message != "exit()");
 
@@ -197,7 +469,7 @@ int main(int argc, char **argv)
     receiveThread->join(); // sincronizar con el thread antes de cerrar la conexión
 
     // Cerrar conexión con el servidor
-    closeConnection(connection.serverId);
+    closeConnection(serverID);
 
     cout << "Desconectado." << endl;
 
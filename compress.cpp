@@ -0,0 +1,94 @@
+#include "compress.h"
+
+#include <zlib.h>
+
+// Estado de zlib del hilo: deflateInit reserva unos 256 KB, así que se crea
+// una vez y se reinicia en cada lote
+typedef struct zlib_streams_t
+{
+    z_stream deflater;
+    z_stream inflater;
+    bool deflateReady;
+    bool inflateReady;
+
+    zlib_streams_t() : deflateReady(false), inflateReady(false)
+    {
+        memset(&deflater, 0, sizeof(deflater));
+        memset(&inflater, 0, sizeof(inflater));
+    }
+    ~zlib_streams_t()
+    {
+        if (deflateReady)
+            deflateEnd(&deflater);
+        if (inflateReady)
+            inflateEnd(&inflater);
+    }
+} zlib_streams_t;
+
+static zlib_streams_t &threadStreams()
+{
+    static thread_local zlib_streams_t streams;
+    return streams;
+}
+
+bool compressFrames(const unsigned char *frames, size_t size, int version, std::vector<unsigned char> &out)
+{
+    if (size == 0 || size > MAX_INFLATED_SIZE)
+        return false;
+
+    zlib_streams_t &streams = threadStreams();
+    if (streams.deflateReady)
+        deflateReset(&streams.deflater);
+    else if (deflateInit(&streams.deflater, Z_BEST_SPEED) == Z_OK)
+        streams.deflateReady = true;
+    else
+        return false;
+
+    // Primero a un buffer del hilo (el tamaño final no se conoce hasta el
+    // final) y después a la trama con su cabecera
+    static thread_local std::vector<unsigned char> packed;
+    packed.resize(deflateBound(&streams.deflater, size));
+    streams.deflater.next_in = (Bytef *)frames;
+    streams.deflater.avail_in = size;
+    streams.deflater.next_out = packed.data();
+    streams.deflater.avail_out = packed.size();
+    if (deflate(&streams.deflater, Z_FINISH) != Z_STREAM_END)
+        return false;
+    size_t packedSize = packed.size() - streams.deflater.avail_out;
+    if (packedSize >= size)
+        return false;
+
+    frame_builder_t builder;
+    encodeMessage(builder, compressed_msg_t{(int)size, std::string_view((const char *)packed.data(), packedSize)}, version);
+    if (builder.bytes.size() >= size || builder.payloadSize() >= (size_t)MAX_FRAME_SIZE)
+        return false;
+    out = std::move(builder.bytes);
+    return true;
+}
+
+bool inflateFrames(const compressed_msg_t &message, std::vector<unsigned char> &out)
+{
+    if (message.size <= 0 || (size_t)message.size > MAX_INFLATED_SIZE)
+        return false;
+
+    zlib_streams_t &streams = threadStreams();
+    if (streams.inflateReady)
+        inflateReset(&streams.inflater);
+    else if (inflateInit(&streams.inflater) == Z_OK)
+        streams.inflateReady = true;
+    else
+        return false;
+
+    out.resize(message.size);
+    streams.inflater.next_in = (Bytef *)message.data.data();
+    streams.inflater.avail_in = message.data.size();
+    streams.inflater.next_out = out.data();
+    streams.inflater.avail_out = out.size();
+    // Z_STREAM_END con el buffer justo lleno: ni más ni menos de lo anunciado
+    if (inflate(&streams.inflater, Z_FINISH) != Z_STREAM_END || streams.inflater.avail_out != 0)
+    {
+        out.clear();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include "protocol.h"
+#include <vector>
+
+/**
+ * Compresión de tramas con zlib. Un lote de tramas ya terminadas (una sola o
+ * varias concatenadas, p. ej. una respuesta del historial) se envuelve en una
+ * única trama MSG_TYPE_COMPRESSED en la versión de la conexión. Quien la recibe
+ * la descomprime y atiende las tramas de dentro como si hubieran llegado
+ * sueltas, así que la compresión no cambia nada por encima del transporte.
+ *
+ * Solo se envía a conexiones que la acordaron en el saludo. El estado de zlib
+ * es uno por hilo y se reinicia en cada lote en vez de crearlo de nuevo.
+ */
+
+// Por debajo de este tamaño comprimir no compensa (la cabecera de zlib y la
+// CPU cuestan más de lo que se ahorra)
+const size_t COMPRESS_MIN_BYTES = 512;
+
+// Tamaño máximo de un lote descomprimido (protege de tramas manipuladas)
+const size_t MAX_INFLATED_SIZE = 4 * (size_t)MAX_FRAME_SIZE;
+
+/**
+ * @brief Comprime un lote de tramas terminadas en una trama MSG_TYPE_COMPRESSED
+ * @param version Versión de las tramas del lote (y de la trama resultante)
+ * @return false si comprimido no ocupa menos que el lote (out no cambia)
+ */
+bool compressFrames(const unsigned char *frames, size_t size, int version, std::vector<unsigned char> &out);
+
+/**
+ * @brief Descomprime el lote de una trama MSG_TYPE_COMPRESSED
+ * @param out Tramas concatenadas, a recorrer con nextFrame
+ * @return false si los datos están corruptos o no miden lo anunciado
+ */
+bool inflateFrames(const compressed_msg_t &message, std::vector<unsigned char> &out);
+
+#endif
@@ -0,0 +1,150 @@
+#include "coro.h"
+#include "logger.h"
+#include <unordered_map>
+
+// Conexiones con corrutina de cada bucle. Las callbacks de una conexión se
+// ejecutan siempre en el hilo de su bucle, así que no hace falta cerrojo.
+static thread_local std::unordered_map<int, coro_conn_t *> connections;
+
+static coro_conn_t *findConn(int connID)
+{
+    auto it = connections.find(connID);
+    return it == connections.end() ? nullptr : it->second;
+}
+
+session_task_t::promise_type::~promise_type()
+{
+    // La corrutina ha terminado: nadie más la va a reanudar
+    connections.erase(conn.id);
+    delete &conn;
+}
+
+bool recv_awaiter_t::await_ready()
+{
+    if (!conn.backlog.empty())
+    {
+        conn.current = std::move(conn.backlog.front());
+        conn.backlog.pop_front();
+        frame = makeCursor(conn.current.bytes);
+        frame.version = conn.current.version;
+        received = true;
+        return true;
+    }
+    return conn.closed;
+}
+
+void recv_awaiter_t::await_suspend(std::coroutine_handle<> waiting)
+{
+    handle = waiting;
+    conn.receiving = this;
+    if (conn.paused)
+    {
+        // Ya no queda nada guardado: se vuelve a leer el socket
+        conn.paused = false;
+        reactorPauseRead(conn.id, false);
+    }
+}
+
+bool send_awaiter_t::await_ready()
+{
+    if (conn.closed)
+        return true;
+    reactorSendFrame(conn.id, frame);
+    return false;
+}
+
+static void resumeSending(int connID)
+{
+    coro_conn_t *conn = findConn(connID);
+    if (conn == nullptr || !conn->sending)
+        return;
+    std::coroutine_handle<> waiting = conn->sending;
+    conn->sending = nullptr;
+    waiting.resume();
+}
+
+bool send_awaiter_t::await_suspend(std::coroutine_handle<> waiting)
+{
+    // Se reanuda desde el propio bucle (una tarea), nunca dentro de reactorWaitDrain
+    int id = conn.id;
+    if (!reactorWaitDrain(id, CORO_SEND_HIGH_BYTES, CORO_SEND_LOW_BYTES, [id]()
+                          { resumeSending(id); }))
+        return false;
+    conn.sending = waiting;
+    return true;
+}
+
+// La corrutina puede terminar (y liberar conn) dentro de resume(): después ya
+// no se toca conn
+
+static void onOpen(coroSession_t session, int connID)
+{
+    coro_conn_t *conn = new coro_conn_t();
+    conn->id = connID;
+    conn->closed = false;
+    conn->receiving = nullptr;
+    conn->sending = nullptr;
+    conn->paused = false;
+    connections[connID] = conn;
+    session(*conn);
+}
+
+static void onFrame(int connID, msg_cursor_t &frame)
+{
+    coro_conn_t *conn = findConn(connID);
+    if (conn == nullptr)
+        return;
+    if (conn->receiving)
+    {
+        // La sesión espera una trama: la recibe sin copia
+        recv_awaiter_t *waiter = conn->receiving;
+        conn->receiving = nullptr;
+        waiter->frame = frame;
+        waiter->received = true;
+        waiter->handle.resume();
+        return;
+    }
+
+    // Está esperando a que se vacíe su cola de salida: se guarda para después
+    // y no se lee más hasta que la pida (el cliente que no lee las respuestas
+    // se queda con sus peticiones en el socket)
+    coro_frame_t copy;
+    copy.bytes.assign(frame.data + frame.pos, frame.data + frame.size);
+    copy.version = frame.version;
+    conn->backlog.push_back(std::move(copy));
+    if (!conn->paused)
+    {
+        conn->paused = true;
+        reactorPauseRead(connID, true);
+    }
+}
+
+static void onClose(int connID)
+{
+    coro_conn_t *conn = findConn(connID);
+    if (conn == nullptr)
+        return;
+    conn->closed = true;
+    if (conn->sending)
+    {
+        std::coroutine_handle<> waiting = conn->sending;
+        conn->sending = nullptr;
+        waiting.resume();
+    }
+    else if (conn->receiving)
+    {
+        recv_awaiter_t *waiter = conn->receiving;
+        conn->receiving = nullptr;
+        waiter->handle.resume();
+    }
+}
+
+reactor_callbacks_t coroCallbacks(coroSession_t session)
+{
+    reactor_callbacks_t callbacks;
+    callbacks.onOpen = [session](int connID)
+    { onOpen(session, connID); };
+    callbacks.onFrame = onFrame;
+    callbacks.onClose = onClose;
+    return callbacks;
+}
@@ -0,0 +1,125 @@
+#ifndef _CORO_H_
+#define _CORO_H_
+
+#include "reactor.h"
+#include <coroutine>
+#include <deque>
+#include <exception>
+
+/**
+ * Sesiones escritas como corrutinas de C++20 sobre el reactor. Cada conexión
+ * ejecuta una corrutina que espera tramas con co_await recvFrame y envía con
+ * co_await sendFrame. No tiene pila propia: mientras espera solo ocupa su marco
+ * en el heap. El bucle dueño de la conexión la reanuda cuando llega una trama,
+ * cuando se vacía su cola de salida o cuando se cierra, así que la lógica se
+ * lee de arriba abajo como la del modo clásico (un hilo por cliente) pero
+ * miles de sesiones comparten cada hilo de eventos.
+ */
+
+// Por encima de esto pendiente de enviar, sendFrame suspende la sesión hasta
+// que la cola baje de CORO_SEND_LOW_BYTES (no atiende más peticiones del
+// cliente mientras no lea las respuestas)
+const size_t CORO_SEND_HIGH_BYTES = 1024 * 1024;
+const size_t CORO_SEND_LOW_BYTES = 256 * 1024;
+
+struct recv_awaiter_t;
+
+// Trama copiada del buffer de recepción
+typedef struct coro_frame_t
+{
+    std::vector<unsigned char> bytes;
+    int version;
+} coro_frame_t;
+
+/**
+ * Conexión vista desde su corrutina. La crea la capa al abrirse la conexión y
+ * la libera al terminar la corrutina.
+ */
+typedef struct coro_conn_t
+{
+    int id;
+    bool closed;                     // el reactor ya la cerró
+    recv_awaiter_t *receiving;       // recvFrame en espera (o nullptr)
+    std::coroutine_handle<> sending; // sendFrame en espera (o nullptr)
+    bool paused;                     // no se lee el socket hasta el próximo recvFrame
+    // Trama que llegó mientras la sesión no esperaba ninguna (copiada: la
+    // vista del reactor solo vale durante la entrega). Al guardarla se deja de
+    // leer el socket, así que nunca pasa de una
+    std::deque<coro_frame_t> backlog;
+    coro_frame_t current; // trama del backlog que se está atendiendo
+} coro_conn_t;
+
+/**
+ * Corrutina de sesión: arranca al crearla, corre hasta su primer co_await y
+ * libera su marco (y su coro_conn_t) al terminar. El primer parámetro de la
+ * función de sesión tiene que ser la conexión.
+ */
+typedef struct session_task_t
+{
+    struct promise_type
+    {
+        coro_conn_t &conn;
+
+        template <typename... Args>
+        promise_type(coro_conn_t &connection, Args &...) : conn(connection)
+        {
+        }
+        ~promise_type();
+
+        session_task_t get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+} session_task_t;
+
+typedef session_task_t (*coroSession_t)(coro_conn_t &conn);
+
+/**
+ * @brief Callbacks del reactor que ejecutan session como corrutina por conexión
+ */
+reactor_callbacks_t coroCallbacks(coroSession_t session);
+
+/**
+ * co_await recvFrame(conn, frame): espera la siguiente trama. Devuelve false
+ * si la conexión se cerró. La vista vale hasta el siguiente co_await.
+ */
+typedef struct recv_awaiter_t
+{
+    coro_conn_t &conn;
+    msg_cursor_t &frame;
+    bool received;
+    std::coroutine_handle<> handle;
+
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> waiting);
+    bool await_resume() { return received; }
+} recv_awaiter_t;
+
+inline recv_awaiter_t recvFrame(coro_conn_t &conn, msg_cursor_t &frame)
+{
+    return recv_awaiter_t{conn, frame, false, nullptr};
+}
+
+/**
+ * co_await sendFrame(conn, frame): encola la trama (nunca bloquea el hilo) y,
+ * si la cola de salida pasa de CORO_SEND_HIGH_BYTES, suspende la sesión hasta
+ * que el cliente la vacíe. Devuelve false si la conexión se cerró.
+ */
+typedef struct send_awaiter_t
+{
+    coro_conn_t &conn;
+    const frame_ptr_t &frame;
+
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> waiting);
+    bool await_resume() { return !conn.closed; }
+} send_awaiter_t;
+
+inline send_awaiter_t sendFrame(coro_conn_t &conn, const frame_ptr_t &frame)
+{
+    return send_awaiter_t{conn, frame};
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "directory.h"
+
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+
+// Potencia de 2 para elegir el shard con una máscara
+const int DIRECTORY_SHARDS = 64;
+
+typedef struct alignas(64) directory_shard_t
+{
+    std::shared_mutex mutex;
+    std::map<std::string, int, std::less<>> users; // less<> permite buscar con string_view
+} directory_shard_t;
+
+static directory_shard_t shards[DIRECTORY_SHARDS];
+
+static directory_shard_t &shardOf(std::string_view name)
+{
+    return shards[std::hash<std::string_view>()(name) & (DIRECTORY_SHARDS - 1)];
+}
+
+void directorySet(std::string_view name, int connID)
+{
+    directory_shard_t &shard = shardOf(name);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(name);
+    if (it != shard.users.end())
+        it->second = connID;
+    else
+        shard.users.emplace(std::string(name), connID);
+}
+
+void directoryRemove(std::string_view name, int connID)
+{
+    directory_shard_t &shard = shardOf(name);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(name);
+    if (it != shard.users.end() && it->second == connID)
+        shard.users.erase(it);
+}
+
+int directoryFind(std::string_view name)
+{
+    directory_shard_t &shard = shardOf(name);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(name);
+    return it != shard.users.end() ? it->second : -1;
+}
+
+void directoryMembers(std::vector<int> &ids)
+{
+    ids.clear();
+    for (directory_shard_t &shard : shards)
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (auto const &user : shard.users)
+            ids.push_back(user.second);
+    }
+}
+
+size_t directorySize()
+{
+    size_t size = 0;
+    for (directory_shard_t &shard : shards)
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        size += shard.users.size();
+    }
+    return size;
+}
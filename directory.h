@@ -0,0 +1,43 @@
+#ifndef _DIRECTORY_H_
+#define _DIRECTORY_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Directorio de usuarios (nombre → id de conexión) pensado para lecturas. Los
+ * nombres se reparten por hash entre shards, cada uno con su propio cerrojo de
+ * lectura/escritura: un /msg solo toma en modo lectura el shard del
+ * destinatario, así que no compite con otras búsquedas ni con un broadcast, y
+ * las altas y bajas solo bloquean su shard.
+ *
+ * Los broadcast no recorren el directorio con el cerrojo tomado: piden una
+ * copia de los ids (directoryMembers) y envían sin cerrojos. Los ids llevan
+ * generación, así que enviar a uno que se acaba de cerrar es inofensivo.
+ */
+
+/**
+ * @brief Asocia el nombre a la conexión (sustituye la asociación anterior)
+ */
+void directorySet(std::string_view name, int connID);
+
+/**
+ * @brief Quita el nombre solo si sigue asociado a esa conexión
+ */
+void directoryRemove(std::string_view name, int connID);
+
+/**
+ * @brief Busca la conexión de un usuario
+ * @return El id o -1 si no está conectado
+ */
+int directoryFind(std::string_view name);
+
+/**
+ * @brief Copia en ids las conexiones de todos los usuarios
+ */
+void directoryMembers(std::vector<int> &ids);
+
+size_t directorySize();
+
+#endif
@@ -0,0 +1,59 @@
+#include "fanout.h"
+
+#include <unordered_set>
+
+// Miembros de cada shard. Cada conjunto solo lo toca el hilo de su bucle, así
+// el broadcast recorre sus usuarios locales sin cerrojos.
+static std::vector<std::unordered_set<int>> shardMembers;
+
+void fanoutInit(int numShards)
+{
+    shardMembers.clear();
+    shardMembers.resize(numShards);
+}
+
+void fanoutJoin(int connID)
+{
+    shardMembers[reactorLoopOf(connID)].insert(connID);
+}
+
+void fanoutLeave(int connID)
+{
+    shardMembers[reactorLoopOf(connID)].erase(connID);
+}
+
+void fanoutBroadcast(const frame_versions_t &frames, int exceptID)
+{
+    unsigned long long start = metricsNowNs();
+    for (int shard = 0; shard < (int)shardMembers.size(); shard++)
+    {
+        reactorPostLoop(shard, [shard, frames, exceptID, start]()
+                        {
+                            for (int memberID : shardMembers[shard])
+                            {
+                                if (memberID != exceptID)
+                                    reactorSendFrame(memberID, frames);
+                            }
+                            metricsRecord(METRIC_HIST_FANOUT_NS, metricsNowNs() - start); });
+    }
+}
+
+void fanoutSendTo(const std::vector<int> &members, const frame_versions_t &frames, int exceptID)
+{
+    unsigned long long start = metricsNowNs();
+    std::vector<std::vector<int>> byShard(shardMembers.size());
+    for (int memberID : members)
+        if (memberID != exceptID)
+            byShard[reactorLoopOf(memberID)].push_back(memberID);
+
+    for (int shard = 0; shard < (int)byShard.size(); shard++)
+    {
+        if (byShard[shard].empty())
+            continue;
+        reactorPostLoop(shard, [targets = std::move(byShard[shard]), frames, start]()
+                        {
+                            for (int memberID : targets)
+                                reactorSendFrame(memberID, frames);
+                            metricsRecord(METRIC_HIST_FANOUT_NS, metricsNowNs() - start); });
+    }
+}
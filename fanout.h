@@ -0,0 +1,39 @@
+#ifndef _FANOUT_H_
+#define _FANOUT_H_
+
+#include "reactor.h"
+
+/**
+ * Motor de difusión (fan-out) sobre el reactor. Cada bucle/shard tiene su
+ * propia lista de miembros, que solo modifica y recorre su hilo. Un broadcast
+ * se serializa una única vez por versión del protocolo y se entrega con una
+ * sola tarea por shard, que lo añade a la cola de salida de cada miembro local
+ * sin copias.
+ * El hilo que origina el mensaje nunca escribe en sockets ajenos.
+ */
+
+/**
+ * @brief Prepara las listas de miembros (una por bucle del reactor)
+ */
+void fanoutInit(int numShards);
+
+/**
+ * @brief Alta/baja de un destinatario de broadcast; llamar desde el hilo dueño
+ */
+void fanoutJoin(int connID);
+void fanoutLeave(int connID);
+
+/**
+ * @brief Entrega la trama a todos los miembros salvo exceptID (-1 para ninguno).
+ * Cada miembro recibe la de su versión del protocolo.
+ */
+void fanoutBroadcast(const frame_versions_t &frames, int exceptID);
+
+/**
+ * @brief Entrega la trama a un grupo concreto (p. ej. los miembros de un
+ * canal): se agrupan por shard y cada shard recibe una sola tarea con los
+ * suyos, así el coste es proporcional al tamaño del grupo
+ */
+void fanoutSendTo(const std::vector<int> &members, const frame_versions_t &frames, int exceptID);
+
+#endif
@@ -0,0 +1,491 @@
+#include "federation.h"
+#include "utils.h"
+#include "logger.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Tramas que se escriben como mucho en un writev
+const size_t FEDERATION_BATCH = 64;
+// Tiempo máximo para el saludo de enlace
+const int FEDERATION_HELLO_TIMEOUT_S = 5;
+
+// Enlace saliente: la cola la llenan los bucles y la vacía el hilo del enlace
+typedef struct peer_link_t
+{
+    std::string host;
+    struct in_addr address; // host ya convertido: solo se aceptan enlaces desde los pares
+    int port;
+    std::string node; // nombre que anunció al conectar
+    std::mutex mutex;
+    std::condition_variable pending;
+    std::deque<frame_ptr_t> queue;
+    size_t queuedBytes = 0;
+    bool connected = false;
+    bool overflowing = false; // ya se avisó de que se descarta
+} peer_link_t;
+
+// Nodo donde está conectado un usuario remoto y enlace entrante que lo anunció
+typedef struct remote_user_t
+{
+    std::string node;
+    int link;
+} remote_user_t;
+
+static bool enabled = false;
+static std::string nodeName;
+static federation_callbacks_t federationCallbacks;
+static std::vector<std::unique_ptr<peer_link_t>> peerLinks;
+
+// Usuarios locales (nombre → conexiones con ese nombre). Se anuncian con el
+// cerrojo tomado para que un enlace que conecta no pierda ni duplique altas.
+static std::mutex local_mutex;
+static std::unordered_map<std::string, int> localUsers;
+
+static std::mutex remote_mutex;
+static std::unordered_map<std::string, remote_user_t> remoteUsers;
+static std::atomic<int> nextLinkID{1};
+
+static std::atomic<unsigned long long> connectedLinks{0};
+static std::atomic<unsigned long long> forwardedFrames{0};
+static std::atomic<unsigned long long> droppedFrames{0};
+
+// ============================================================================
+// Enlaces salientes
+// ============================================================================
+
+// Los mensajes (también los privados enrutados) se descartan si la cola está
+// llena; la presencia siempre entra (son tramas pequeñas y perder una dejaría
+// al par con una lista de usuarios equivocada). Con el enlace caído no se
+// encola nada.
+static bool enqueueLocked(peer_link_t &peer, const frame_ptr_t &frame)
+{
+    bool presence = frame->type == MSG_TYPE_PRESENCE;
+    if (!peer.connected)
+    {
+        if (!presence)
+            droppedFrames++;
+        return false;
+    }
+    if (!presence && peer.queuedBytes + frame->bytes.size() > FEDERATION_QUEUE_BYTES)
+    {
+        if (!peer.overflowing)
+            LOG_WARN("federación -- cola llena hacia el nodo %s: se descartan mensajes", peer.node);
+        peer.overflowing = true;
+        droppedFrames++;
+        return false;
+    }
+    peer.queue.push_back(frame);
+    peer.queuedBytes += frame->bytes.size();
+    if (peer.queue.size() == 1)
+        peer.pending.notify_one();
+    return true;
+}
+
+static void enqueue(peer_link_t &peer, const frame_ptr_t &frame)
+{
+    std::lock_guard<std::mutex> lock(peer.mutex);
+    enqueueLocked(peer, frame);
+}
+
+static frame_ptr_t presenceFrame(std::string_view username, bool online)
+{
+    return adoptFrame(encodeFrame(presence_msg_t{username, online ? 1 : 0}), true, MSG_TYPE_PRESENCE);
+}
+
+static bool writeFrame(int socket, const std::vector<unsigned char> &bytes)
+{
+    struct iovec iov = {(void *)bytes.data(), bytes.size()};
+    return writeAll(socket, &iov, 1);
+}
+
+// Lectura bloqueante de la siguiente trama de un enlace
+static bool readFrame(int socket, frame_reader_t &reader, msg_cursor_t &frame)
+{
+    while (!reader.next(frame))
+    {
+        if (reader.bad)
+            return false;
+        ssize_t n = reader.fill(socket);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+    }
+    return true;
+}
+
+static bool readHello(int socket, frame_reader_t &reader, std::string &node)
+{
+    msg_cursor_t frame;
+    peer_msg_t hello;
+    if (!readFrame(socket, reader, frame) || unpackMessageType(frame) != MSG_TYPE_PEER ||
+        !decodeMessage(frame, hello) || hello.node.empty())
+        return false;
+    node = hello.node;
+    return true;
+}
+
+/**
+ * @brief Conecta con el par e intercambia los saludos
+ * @return El socket o -1
+ */
+static int connectPeer(peer_link_t &peer, std::string &node)
+{
+    int socketFD = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socketFD < 0)
+        return -1;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(peer.port);
+    address.sin_addr = peer.address;
+
+    struct timeval timeout = {FEDERATION_HELLO_TIMEOUT_S, 0};
+    setsockopt(socketFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int noDelay = 1;
+    setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    frame_reader_t reader(4096);
+    if (connect(socketFD, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        !writeFrame(socketFD, encodeFrame(peer_msg_t{nodeName})) || !readHello(socketFD, reader, node))
+    {
+        close(socketFD);
+        return -1;
+    }
+    return socketFD;
+}
+
+/**
+ * @brief Marca el enlace como conectado y le encola la presencia completa
+ */
+static void announceUsers(peer_link_t &peer, const std::string &node)
+{
+    std::lock_guard<std::mutex> users(local_mutex);
+    std::lock_guard<std::mutex> lock(peer.mutex);
+    peer.node = node;
+    peer.connected = true;
+    peer.overflowing = false;
+    for (const auto &user : localUsers)
+        enqueueLocked(peer, presenceFrame(user.first, true));
+}
+
+// Quien acepta el enlace no escribe nada tras el saludo: si el socket se puede
+// leer es que el par lo cerró
+static bool peerClosed(int socketFD)
+{
+    struct pollfd fd = {socketFD, POLLIN | POLLRDHUP, 0};
+    return poll(&fd, 1, 0) > 0;
+}
+
+/**
+ * @brief Escribe la cola del enlace por tandas hasta que falle el socket
+ */
+static void pumpLink(peer_link_t &peer, int socketFD)
+{
+    std::vector<frame_ptr_t> batch;
+    std::vector<struct iovec> iov;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(peer.mutex);
+            if (!peer.pending.wait_for(lock, std::chrono::milliseconds(FEDERATION_RETRY_MS), [&peer]()
+                                       { return !peer.queue.empty(); }))
+            {
+                lock.unlock();
+                if (peerClosed(socketFD))
+                    return;
+                continue;
+            }
+            while (!peer.queue.empty() && batch.size() < FEDERATION_BATCH)
+            {
+                peer.queuedBytes -= peer.queue.front()->bytes.size();
+                batch.push_back(std::move(peer.queue.front()));
+                peer.queue.pop_front();
+            }
+            if (peer.queue.empty())
+                peer.overflowing = false;
+        }
+
+        for (const frame_ptr_t &frame : batch)
+            iov.push_back({(void *)frame->bytes.data(), frame->bytes.size()});
+        if (!writeAll(socketFD, iov.data(), iov.size()))
+            return;
+        forwardedFrames += batch.size();
+        batch.clear();
+        iov.clear();
+    }
+}
+
+static void runLink(peer_link_t *peer)
+{
+    bool reported = false; // ya se avisó de que el par no responde
+    while (true)
+    {
+        std::string node;
+        int socketFD = connectPeer(*peer, node);
+        if (socketFD < 0)
+        {
+            if (!reported)
+                LOG_WARN("federación -- no se pudo enlazar con %s:%d; se reintentará", peer->host, peer->port);
+            reported = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(FEDERATION_RETRY_MS));
+            continue;
+        }
+        reported = false;
+        if (node == nodeName)
+        {
+            LOG_ERROR("federación -- %s:%d es este mismo nodo (%s)", peer->host, peer->port, node);
+            close(socketFD);
+            return;
+        }
+
+        announceUsers(*peer, node);
+        connectedLinks++;
+        LOG_INFO("Enlace con el nodo %s (%s:%d) establecido", node, peer->host, peer->port);
+        pumpLink(*peer, socketFD);
+        close(socketFD);
+        {
+            std::lock_guard<std::mutex> lock(peer->mutex);
+            peer->connected = false;
+            peer->queue.clear();
+            peer->queuedBytes = 0;
+        }
+        connectedLinks--;
+        LOG_WARN("Enlace con el nodo %s caído", node);
+    }
+}
+
+// ============================================================================
+// Enlaces entrantes
+// ============================================================================
+
+static void setPresence(const std::string &node, int link, std::string_view username, bool online)
+{
+    std::lock_guard<std::mutex> lock(remote_mutex);
+    if (online)
+    {
+        remoteUsers[std::string(username)] = remote_user_t{node, link};
+        return;
+    }
+    // Solo la quita el enlace que la anunció (el usuario puede haberse
+    // conectado después a otro nodo)
+    auto it = remoteUsers.find(std::string(username));
+    if (it != remoteUsers.end() && it->second.link == link)
+        remoteUsers.erase(it);
+}
+
+static void forgetLink(int link)
+{
+    std::lock_guard<std::mutex> lock(remote_mutex);
+    for (auto it = remoteUsers.begin(); it != remoteUsers.end();)
+    {
+        if (it->second.link == link)
+            it = remoteUsers.erase(it);
+        else
+            ++it;
+    }
+}
+
+static void serveLink(int socketFD)
+{
+    struct timeval timeout = {FEDERATION_HELLO_TIMEOUT_S, 0};
+    setsockopt(socketFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    frame_reader_t reader;
+    std::string node;
+    if (!readHello(socketFD, reader, node) || !writeFrame(socketFD, encodeFrame(peer_msg_t{nodeName})))
+    {
+        LOG_WARN("federación -- conexión rechazada: no es un enlace de servidor");
+        close(socketFD);
+        return;
+    }
+    // Desde aquí el par puede pasar mucho tiempo sin escribir
+    timeout.tv_sec = 0;
+    setsockopt(socketFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    int link = nextLinkID++;
+    LOG_INFO("Enlace entrante del nodo %s", node);
+    auto handlers = message_visitor_t{
+        [&](const peer_msg_t &) {},
+        [&](const presence_msg_t &presence)
+        { setPresence(node, link, presence.username, presence.online != 0); },
+        [&](const public_msg_t &message)
+        { federationCallbacks.onPublic(message); },
+        [&](const channel_msg_t &message)
+        { federationCallbacks.onChannel(message); },
+        [&](const routed_msg_t &message)
+        { federationCallbacks.onRouted(message); }};
+
+    msg_cursor_t frame;
+    while (readFrame(socketFD, reader, frame))
+    {
+        if (!dispatchMessage<peer_messages_t>(frame, handlers))
+        {
+            LOG_WARN("federación -- trama no válida del nodo %s", node);
+            break;
+        }
+    }
+    forgetLink(link);
+    close(socketFD);
+    LOG_WARN("Enlace entrante del nodo %s cerrado", node);
+}
+
+static bool isPeerAddress(const struct in_addr &address)
+{
+    for (const auto &peer : peerLinks)
+        if (peer->address.s_addr == address.s_addr)
+            return true;
+    return false;
+}
+
+// Lo que llega por un enlace entrante se entrega a los clientes sin más
+// comprobaciones: solo se aceptan conexiones desde las direcciones de --peer
+static void acceptLinks(int listenFD)
+{
+    while (true)
+    {
+        struct sockaddr_in remote;
+        socklen_t length = sizeof(remote);
+        int socketFD = accept4(listenFD, (struct sockaddr *)&remote, &length, SOCK_CLOEXEC);
+        if (socketFD < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            LOG_ERROR("federación -- accept: %s", strerror(errno));
+            return;
+        }
+        if (remote.sin_family != AF_INET || !isPeerAddress(remote.sin_addr))
+        {
+            char text[INET_ADDRSTRLEN];
+            const char *host = inet_ntop(AF_INET, &remote.sin_addr, text, sizeof(text));
+            LOG_WARN("federación -- enlace rechazado desde %s: no es un par configurado", host);
+            close(socketFD);
+            continue;
+        }
+        std::thread(serveLink, socketFD).detach();
+    }
+}
+
+// ============================================================================
+// API
+// ============================================================================
+
+bool federationStart(const std::string &node, int port, const std::vector<std::string> &peers,
+                     federation_callbacks_t callbacks)
+{
+    for (const std::string &peer : peers)
+    {
+        size_t colon = peer.rfind(':');
+        std::unique_ptr<peer_link_t> link(new peer_link_t());
+        if (colon != std::string::npos)
+        {
+            link->host = peer.substr(0, colon);
+            link->port = atoi(peer.c_str() + colon + 1);
+        }
+        if (colon == std::string::npos || link->port <= 0 || inet_pton(AF_INET, link->host.c_str(), &link->address) != 1)
+        {
+            LOG_ERROR("federación -- par no válido: %s (se espera ip:puerto)", peer);
+            return false;
+        }
+        peerLinks.push_back(std::move(link));
+    }
+
+    int listenFD = initListener(port, false);
+    if (listenFD == -1)
+        return false;
+
+    nodeName = node;
+    federationCallbacks = callbacks;
+    enabled = true;
+    std::thread(acceptLinks, listenFD).detach();
+    for (auto &peer : peerLinks)
+        std::thread(runLink, peer.get()).detach();
+    return true;
+}
+
+bool federationEnabled()
+{
+    return enabled;
+}
+
+void federationUserOnline(std::string_view username)
+{
+    if (!enabled)
+        return;
+    std::lock_guard<std::mutex> lock(local_mutex);
+    if (localUsers[std::string(username)]++ > 0)
+        return;
+    frame_ptr_t frame = presenceFrame(username, true);
+    for (auto &peer : peerLinks)
+        enqueue(*peer, frame);
+}
+
+void federationUserOffline(std::string_view username)
+{
+    if (!enabled)
+        return;
+    std::lock_guard<std::mutex> lock(local_mutex);
+    auto it = localUsers.find(std::string(username));
+    if (it == localUsers.end() || --it->second > 0)
+        return;
+    localUsers.erase(it);
+    frame_ptr_t frame = presenceFrame(username, false);
+    for (auto &peer : peerLinks)
+        enqueue(*peer, frame);
+}
+
+void federationForward(const frame_ptr_t &frame)
+{
+    if (!enabled)
+        return;
+    for (auto &peer : peerLinks)
+        enqueue(*peer, frame);
+}
+
+route_result_t federationRoute(std::string_view sender, std::string_view recipient, std::string_view text)
+{
+    if (!enabled)
+        return ROUTE_NOT_FOUND;
+    std::string node;
+    {
+        std::lock_guard<std::mutex> lock(remote_mutex);
+        auto it = remoteUsers.find(std::string(recipient));
+        if (it == remoteUsers.end())
+            return ROUTE_NOT_FOUND;
+        node = it->second.node;
+    }
+
+    frame_ptr_t frame = adoptFrame(encodeFrame(routed_msg_t{sender, recipient, text}), true, MSG_TYPE_ROUTED);
+    for (auto &peer : peerLinks)
+    {
+        std::lock_guard<std::mutex> lock(peer->mutex);
+        if (peer->connected && peer->node == node)
+            return enqueueLocked(*peer, frame) ? ROUTE_QUEUED : ROUTE_DROPPED;
+    }
+    return ROUTE_NOT_FOUND;
+}
+
+federation_stats_t federationGetStats()
+{
+    federation_stats_t stats;
+    stats.links = connectedLinks;
+    stats.forwarded = forwardedFrames;
+    stats.dropped = droppedFrames;
+    std::lock_guard<std::mutex> lock(remote_mutex);
+    stats.remoteUsers = remoteUsers.size();
+    return stats;
+}
@@ -0,0 +1,90 @@
+#ifndef _FEDERATION_H_
+#define _FEDERATION_H_
+
+#include "reactor.h"
+#include "protocol.h"
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Federación de servidores: varios procesos (en la misma máquina o en otras)
+ * forman una sola sala. Cada nodo abre un enlace saliente hacia cada uno de
+ * sus pares configurados y acepta los suyos en el puerto de federación; por el
+ * enlace que abre solo escribe y por los que acepta solo lee (solo se aceptan
+ * enlaces cuya dirección de origen es la de algún par). La malla es
+ * completa: todos los nodos deben tener a todos los demás como pares, porque
+ * lo que llega de otro nodo se entrega a los clientes locales y no se reenvía.
+ *
+ * Los nodos se cuentan sus usuarios (presencia) para saber a quién enrutar un
+ * /msg. Un broadcast sale una vez por enlace, no una vez por usuario remoto: la
+ * trama v1 que reciben los clientes locales se encola tal cual en cada enlace.
+ *
+ * Cada enlace saliente tiene su hilo y su cola acotada; un par lento o caído
+ * nunca bloquea a los bucles del reactor: lo que no cabe (también los /msg
+ * enrutados; solo la presencia entra siempre) se descarta y lo que
+ * se envía mientras el enlace está caído se pierde (al reconectar se vuelve a
+ * anunciar la presencia completa).
+ */
+
+// Bytes pendientes por enlace saliente antes de descartar
+const size_t FEDERATION_QUEUE_BYTES = 16 * 1024 * 1024;
+// Espera entre intentos de conexión con un par
+const int FEDERATION_RETRY_MS = 1000;
+
+typedef struct federation_callbacks_t
+{
+    // Se ejecutan en el hilo del enlace entrante (vistas válidas solo durante la llamada)
+    std::function<void(const public_msg_t &message)> onPublic;
+    std::function<void(const channel_msg_t &message)> onChannel;
+    std::function<void(const routed_msg_t &message)> onRouted;
+} federation_callbacks_t;
+
+typedef struct federation_stats_t
+{
+    unsigned long long links;       // enlaces salientes conectados
+    unsigned long long remoteUsers; // usuarios conocidos en otros nodos
+    unsigned long long forwarded;   // tramas enviadas a otros nodos
+    unsigned long long dropped;     // tramas descartadas (enlace caído o cola llena)
+} federation_stats_t;
+
+/**
+ * @brief Abre el puerto de federación y lanza un enlace por par
+ * @param node Nombre de este nodo (único en la federación)
+ * @param port Puerto donde se aceptan los enlaces de los pares
+ * @param peers Pares como "ip:puerto" (su puerto de federación); solo se
+ * aceptan enlaces desde esas direcciones
+ * @return false si el puerto no se pudo abrir o algún par no es válido
+ */
+bool federationStart(const std::string &node, int port, const std::vector<std::string> &peers,
+                     federation_callbacks_t callbacks);
+
+bool federationEnabled();
+
+/**
+ * @brief Alta/baja de un usuario local: se anuncia a los pares
+ */
+void federationUserOnline(std::string_view username);
+void federationUserOffline(std::string_view username);
+
+/**
+ * @brief Reenvía a todos los pares una trama v1 pública o de canal
+ */
+void federationForward(const frame_ptr_t &frame);
+
+typedef enum route_result_t
+{
+    ROUTE_NOT_FOUND, // el destinatario no está en ningún otro nodo
+    ROUTE_DROPPED,   // la cola del enlace con su nodo está llena
+    ROUTE_QUEUED
+} route_result_t;
+
+/**
+ * @brief Enruta un privado al nodo donde está conectado el destinatario
+ */
+route_result_t federationRoute(std::string_view sender, std::string_view recipient, std::string_view text);
+
+federation_stats_t federationGetStats();
+
+#endif
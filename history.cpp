@@ -0,0 +1,448 @@
+#include "history.h"
+#include "logger.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+// Tamaño de cada segmento y cuántos se conservan (los más antiguos se borran)
+const size_t HISTORY_SEGMENT_BYTES = 16 * 1024 * 1024;
+const size_t HISTORY_MAX_SEGMENTS = 16;
+// Bytes pendientes de volcar a partir de los cuales se descartan registros
+const size_t HISTORY_MAX_PENDING = 64 * 1024 * 1024;
+
+/**
+ * Formato de un registro (orden de bytes del host, como el resto del protocolo):
+ *   [u32 tamaño][u64 secuencia][u8 ámbito][u16 lenA][A][u16 lenB][B][trama]
+ * El tamaño no incluye su propio campo. Un tamaño 0 marca el final del
+ * segmento (el fichero se crea relleno de ceros).
+ */
+const size_t RECORD_HEADER = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint8_t);
+
+typedef struct history_record_t
+{
+    unsigned long long seq;
+    history_kind_t kind;
+    std::string_view scopeA;
+    std::string_view scopeB;
+    const unsigned char *frame;
+    size_t frameSize;
+    size_t total; // bytes del registro completo
+} history_record_t;
+
+typedef struct history_segment_t
+{
+    unsigned id;
+    int fd;
+    unsigned char *base;
+    size_t size;
+    size_t used;
+} history_segment_t;
+
+// Entrada del índice: 32 bytes por mensaje, sin copiar sus datos
+typedef struct history_entry_t
+{
+    unsigned long long seq;
+    unsigned segment;
+    unsigned offset;
+    unsigned hashA;
+    unsigned hashB;
+    unsigned kind;
+} history_entry_t;
+
+static std::string historyDir;
+static std::atomic<bool> enabled(false);
+
+// Segmentos (ids consecutivos, el más antiguo primero) e índice ordenado por secuencia
+static std::shared_mutex index_mutex;
+static std::deque<history_segment_t> segments;
+static std::deque<history_entry_t> entries;
+
+// Registros aún no volcados, ya con su número de secuencia
+static std::mutex pending_mutex;
+static std::condition_variable pending_cv;
+static std::vector<unsigned char> pending;
+static unsigned long long nextSeq = 1;
+
+static unsigned hashOf(std::string_view text)
+{
+    return (unsigned)std::hash<std::string_view>()(text);
+}
+
+static bool readString(const unsigned char *data, size_t size, size_t &pos, std::string_view &text)
+{
+    uint16_t length;
+    if (pos + sizeof(length) > size)
+        return false;
+    memcpy(&length, data + pos, sizeof(length));
+    pos += sizeof(length);
+    if (pos + length > size)
+        return false;
+    text = std::string_view((const char *)data + pos, length);
+    pos += length;
+    return true;
+}
+
+/**
+ * @brief Interpreta el registro que empieza en data
+ * @return false si no hay un registro completo y bien formado
+ */
+static bool parseRecord(const unsigned char *data, size_t available, history_record_t &record)
+{
+    if (available < RECORD_HEADER)
+        return false;
+    uint32_t length;
+    memcpy(&length, data, sizeof(length));
+    if (length == 0 || length > available - sizeof(length))
+        return false;
+    size_t size = sizeof(length) + length;
+
+    uint64_t seq;
+    memcpy(&seq, data + sizeof(length), sizeof(seq));
+    record.seq = seq;
+    record.kind = (history_kind_t)data[sizeof(length) + sizeof(seq)];
+    if (record.kind > HISTORY_CHANNEL)
+        return false;
+
+    size_t pos = RECORD_HEADER;
+    if (!readString(data, size, pos, record.scopeA) || !readString(data, size, pos, record.scopeB))
+        return false;
+    record.frame = data + pos;
+    record.frameSize = size - pos;
+    record.total = size;
+    return record.frameSize >= sizeof(int);
+}
+
+static history_entry_t makeEntry(const history_record_t &record, unsigned segment, size_t offset)
+{
+    history_entry_t entry;
+    entry.seq = record.seq;
+    entry.segment = segment;
+    entry.offset = offset;
+    entry.hashA = hashOf(record.scopeA);
+    entry.hashB = hashOf(record.scopeB);
+    entry.kind = record.kind;
+    return entry;
+}
+
+static std::string segmentPath(unsigned id)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%08u.log", id);
+    return historyDir + name;
+}
+
+static bool mapSegment(history_segment_t &segment, bool create)
+{
+    std::string path = segmentPath(segment.id);
+    segment.fd = open(path.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0644);
+    if (segment.fd < 0)
+        return false;
+
+    if (create && ftruncate(segment.fd, HISTORY_SEGMENT_BYTES) < 0)
+    {
+        close(segment.fd);
+        unlink(path.c_str());
+        return false;
+    }
+    struct stat info;
+    if (fstat(segment.fd, &info) < 0 || info.st_size == 0)
+    {
+        close(segment.fd);
+        return false;
+    }
+    segment.size = info.st_size;
+
+    void *base = mmap(nullptr, segment.size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+    if (base == MAP_FAILED)
+    {
+        close(segment.fd);
+        return false;
+    }
+    segment.base = (unsigned char *)base;
+    segment.used = 0;
+    return true;
+}
+
+// Borra los segmentos que sobran (con index_mutex en exclusiva)
+static void dropOldSegments()
+{
+    while (segments.size() > HISTORY_MAX_SEGMENTS)
+    {
+        history_segment_t &oldest = segments.front();
+        while (!entries.empty() && entries.front().segment == oldest.id)
+            entries.pop_front();
+        munmap(oldest.base, oldest.size);
+        close(oldest.fd);
+        unlink(segmentPath(oldest.id).c_str());
+        segments.pop_front();
+    }
+}
+
+/**
+ * @brief Recupera los segmentos de una ejecución anterior y reconstruye el índice
+ */
+static void recoverSegments()
+{
+    std::vector<unsigned> ids;
+    DIR *dir = opendir(historyDir.c_str());
+    if (dir != nullptr)
+    {
+        struct dirent *item;
+        while ((item = readdir(dir)) != nullptr)
+        {
+            unsigned id;
+            char extra;
+            if (strlen(item->d_name) == 12 && sscanf(item->d_name, "%8u.lo%c", &id, &extra) == 2 && extra == 'g')
+                ids.push_back(id);
+        }
+        closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    for (unsigned id : ids)
+    {
+        // Los ids deben ser consecutivos: un hueco deja fuera lo anterior
+        if (!segments.empty() && id != segments.back().id + 1)
+        {
+            for (history_segment_t &old : segments)
+            {
+                munmap(old.base, old.size);
+                close(old.fd);
+            }
+            segments.clear();
+            entries.clear();
+        }
+        history_segment_t segment;
+        segment.id = id;
+        if (!mapSegment(segment, false))
+        {
+            LOG_ERROR("history -- no se pudo abrir %s", segmentPath(id).c_str());
+            continue;
+        }
+
+        history_record_t record;
+        while (parseRecord(segment.base + segment.used, segment.size - segment.used, record) &&
+               (entries.empty() || record.seq > entries.back().seq))
+        {
+            entries.push_back(makeEntry(record, id, segment.used));
+            segment.used += record.total;
+        }
+        segments.push_back(segment);
+    }
+    dropOldSegments();
+    if (!entries.empty())
+        nextSeq = entries.back().seq + 1;
+}
+
+/**
+ * @brief Copia un registro al segmento actual (abre uno nuevo si no cabe)
+ */
+static void writeRecord(const unsigned char *data, const history_record_t &record)
+{
+    if (segments.empty() || segments.back().used + record.total > segments.back().size)
+    {
+        history_segment_t segment;
+        segment.id = segments.empty() ? 1 : segments.back().id + 1;
+        if (!mapSegment(segment, true))
+        {
+            LOG_ERROR("history -- no se pudo crear %s", segmentPath(segment.id).c_str());
+            return;
+        }
+        if (!segments.empty())
+            msync(segments.back().base, segments.back().size, MS_ASYNC);
+
+        std::unique_lock<std::shared_mutex> lock(index_mutex);
+        segments.push_back(segment);
+        dropOldSegments();
+    }
+
+    // Los lectores no miran más allá de lo que ya está en el índice: la copia
+    // se hace sin cerrojo y la entrada se publica después
+    history_segment_t &current = segments.back();
+    memcpy(current.base + current.used, data, record.total);
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    entries.push_back(makeEntry(record, current.id, current.used));
+    current.used += record.total;
+}
+
+static void writerLoop()
+{
+    std::vector<unsigned char> batch;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            pending_cv.wait(lock, []
+                            { return !pending.empty(); });
+            batch.swap(pending);
+        }
+
+        size_t pos = 0;
+        history_record_t record;
+        while (pos < batch.size() && parseRecord(batch.data() + pos, batch.size() - pos, record))
+        {
+            writeRecord(batch.data() + pos, record);
+            pos += record.total;
+        }
+        batch.clear();
+    }
+}
+
+bool historyOpen(const std::string &dir)
+{
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        LOG_ERROR("history -- no se pudo crear el directorio %s", dir.c_str());
+        return false;
+    }
+    historyDir = dir;
+    recoverSegments();
+
+    std::thread(writerLoop).detach();
+    enabled = true;
+    return true;
+}
+
+bool historyEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+static void appendField(std::vector<unsigned char> &out, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+unsigned long long historyAppend(history_kind_t kind, std::string_view scopeA, std::string_view scopeB,
+                                 const std::vector<unsigned char> &frame)
+{
+    if (!historyEnabled() || scopeA.size() > UINT16_MAX || scopeB.size() > UINT16_MAX)
+        return 0;
+    size_t total = RECORD_HEADER + 2 * sizeof(uint16_t) + scopeA.size() + scopeB.size() + frame.size();
+    if (total > HISTORY_SEGMENT_BYTES)
+        return 0;
+
+    uint32_t length = total - sizeof(uint32_t);
+    uint8_t kindByte = kind;
+    uint16_t lengthA = scopeA.size();
+    uint16_t lengthB = scopeB.size();
+
+    unsigned long long seq;
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        if (pending.size() + total > HISTORY_MAX_PENDING)
+            return 0; // el escritor no da abasto: se pierde este registro
+        seq = nextSeq++;
+        uint64_t seqField = seq;
+        wake = pending.empty();
+        pending.reserve(pending.size() + total);
+        appendField(pending, &length, sizeof(length));
+        appendField(pending, &seqField, sizeof(seqField));
+        appendField(pending, &kindByte, sizeof(kindByte));
+        appendField(pending, &lengthA, sizeof(lengthA));
+        appendField(pending, scopeA.data(), scopeA.size());
+        appendField(pending, &lengthB, sizeof(lengthB));
+        appendField(pending, scopeB.data(), scopeB.size());
+        appendField(pending, frame.data(), frame.size());
+    }
+    if (wake)
+        pending_cv.notify_one();
+    return seq;
+}
+
+/**
+ * @brief Comprueba el ámbito exacto (el hash del índice solo descarta rápido)
+ */
+static bool recordVisible(const history_record_t &record, const history_query_t &query)
+{
+    if (!query.channel.empty())
+        return record.kind == HISTORY_CHANNEL && record.scopeA == query.channel;
+    if (record.kind == HISTORY_PUBLIC)
+        return true;
+    return record.kind == HISTORY_PRIVATE && (record.scopeA == query.user || record.scopeB == query.user);
+}
+
+size_t historyReplay(const history_query_t &query, std::vector<unsigned char> &out)
+{
+    if (!historyEnabled() || query.limit == 0)
+        return 0;
+
+    unsigned hash = hashOf(query.channel.empty() ? query.user : query.channel);
+    auto candidate = [&](const history_entry_t &entry)
+    {
+        if (!query.channel.empty())
+            return entry.kind == HISTORY_CHANNEL && entry.hashA == hash;
+        return entry.kind == HISTORY_PUBLIC ||
+               (entry.kind == HISTORY_PRIVATE && query.privatesFrom > 0 && entry.seq >= query.privatesFrom &&
+                (entry.hashA == hash || entry.hashB == hash));
+    };
+
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    if (entries.empty())
+        return 0;
+    unsigned firstSegment = segments.front().id;
+
+    // Registros que cumplen la consulta, en orden de secuencia
+    std::vector<history_record_t> matched;
+    auto consider = [&](const history_entry_t &entry)
+    {
+        if (!candidate(entry))
+            return;
+        const history_segment_t &segment = segments[entry.segment - firstSegment];
+        history_record_t record;
+        if (parseRecord(segment.base + entry.offset, segment.size - entry.offset, record) && recordVisible(record, query))
+            matched.push_back(record);
+    };
+
+    if (query.since >= 0)
+    {
+        auto it = std::upper_bound(entries.begin(), entries.end(), (unsigned long long)query.since,
+                                   [](unsigned long long seq, const history_entry_t &entry)
+                                   { return seq < entry.seq; });
+        for (; it != entries.end() && matched.size() < query.limit; ++it)
+            consider(*it);
+    }
+    else
+    {
+        for (auto it = entries.rbegin(); it != entries.rend() && matched.size() < query.limit; ++it)
+            consider(*it);
+        std::reverse(matched.begin(), matched.end());
+    }
+
+    size_t bytes = 0;
+    for (const history_record_t &record : matched)
+        bytes += record.frameSize;
+    out.reserve(out.size() + bytes);
+    for (const history_record_t &record : matched)
+        out.insert(out.end(), record.frame, record.frame + record.frameSize);
+    return matched.size();
+}
+
+unsigned long long historyNextSeq()
+{
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    return nextSeq;
+}
+
+unsigned long long historyLastSeq()
+{
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    return entries.empty() ? 0 : entries.back().seq;
+}
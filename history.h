@@ -0,0 +1,76 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Historial persistente de mensajes. Es un log de solo-añadir repartido en
+ * segmentos de tamaño fijo (DIR/00000001.log, ...) que se leen y escriben a
+ * través de mmap. Cada registro guarda la trama tal y como la recibe el
+ * cliente, así que reenviarla no requiere recodificar nada.
+ *
+ * Los hilos que atienden mensajes solo copian el registro a un buffer en
+ * memoria; un hilo escritor lo vuelca a los segmentos y actualiza el índice
+ * (número de secuencia → segmento y desplazamiento). Nunca hay E/S de disco en
+ * el camino de un mensaje.
+ */
+
+// Ámbito de un registro: quién puede verlo al reproducir el historial
+typedef enum history_kind_t
+{
+    HISTORY_PUBLIC = 0,  // todos
+    HISTORY_PRIVATE = 1, // remitente y destinatario
+    HISTORY_CHANNEL = 2  // miembros del canal
+} history_kind_t;
+
+// Qué registros reproducir
+typedef struct history_query_t
+{
+    std::string user;    // públicos + privados en los que participa (si channel está vacío)
+    std::string channel; // o solo los de este canal
+    long long since;     // solo secuencias > since (-1: los últimos limit)
+    size_t limit;        // máximo de mensajes
+    // Privados solo con secuencia >= privatesFrom (0: ninguno). Los nombres no
+    // se autentican: una sesión solo ve los privados de su propia vida.
+    unsigned long long privatesFrom;
+} history_query_t;
+
+/**
+ * @brief Abre (o crea) el historial en dir, recupera los segmentos existentes
+ * y arranca el hilo escritor
+ * @return false si no se pudo usar el directorio
+ */
+bool historyOpen(const std::string &dir);
+
+bool historyEnabled();
+
+/**
+ * @brief Añade una trama terminada (prefijo + datos) al historial. Solo copia
+ * en memoria; el volcado al segmento lo hace el hilo escritor.
+ * @param scopeA Canal (HISTORY_CHANNEL) o remitente (HISTORY_PRIVATE)
+ * @param scopeB Destinatario (HISTORY_PRIVATE)
+ * @return Número de secuencia asignado (0 si el historial está desactivado)
+ */
+unsigned long long historyAppend(history_kind_t kind, std::string_view scopeA, std::string_view scopeB,
+                                 const std::vector<unsigned char> &frame);
+
+/**
+ * @brief Añade a out, una tras otra y en orden, las tramas que cumplen la
+ * consulta, listas para enviarse en una sola escritura
+ * @return Número de tramas añadidas
+ */
+size_t historyReplay(const history_query_t &query, std::vector<unsigned char> &out);
+
+/**
+ * @brief Secuencia que recibirá el próximo registro (los anteriores ya existían)
+ */
+unsigned long long historyNextSeq();
+
+/**
+ * @brief Última secuencia escrita en los segmentos
+ */
+unsigned long long historyLastSeq();
+
+#endif
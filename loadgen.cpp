@@ -0,0 +1,672 @@
+#include "utils.h"
+#include "protocol.h"
+#include "compress.h"
+#include "shmring.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cinttypes>
+
+using namespace std;
+
+/**
+ * Generador de carga sin interfaz: abre muchas sesiones de bots contra el
+ * servidor con el mismo protocolo que el cliente (initClient + tramas
+ * [tipo][texto], en la versión que se pida) y mide el rendimiento de extremo
+ * a extremo.
+ *
+ * Cada mensaje lleva en el texto la marca de tiempo de envío ("lg <ns> ..."),
+ * así el bot que lo recibe calcula la latencia de entrega. Emisores y
+ * receptores están en este mismo proceso, por lo que basta con el reloj
+ * monótono.
+ */
+
+const string STAMP_PREFIX = "lg ";
+
+typedef struct loadgen_options_t
+{
+    string host;
+    int port;
+    int bots;
+    int threads;
+    double duration; // segundos de medida
+    double rate;     // mensajes por segundo en total (0: sin límite)
+    int size;        // tamaño mínimo del texto
+    int mixPublic;   // pesos de cada acción
+    int mixPrivate;
+    int mixChurn;
+    int protocol;    // versión del protocolo que proponen los bots
+    bool compress;   // admiten tramas comprimidas (solo con v2 o superior)
+    string unixPath; // socket local del servidor (vacío: TCP a host:port)
+    bool shm;        // reciben por memoria compartida (solo con unixPath)
+} loadgen_options_t;
+
+static inline int64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * Histograma log-lineal de latencias (estilo HDR): 64 sub-cubos por potencia
+ * de 2, error relativo < 1,6 % en todo el rango y tamaño fijo.
+ */
+const int HIST_SUB_BITS = 7;
+const int HIST_SUB_BUCKETS = 1 << HIST_SUB_BITS;
+const int HIST_HALF = HIST_SUB_BUCKETS / 2;
+const int HIST_BUCKETS = HIST_SUB_BUCKETS + 64 * HIST_HALF;
+
+typedef struct latency_histogram_t
+{
+    vector<uint64_t> counts;
+    uint64_t total;
+
+    latency_histogram_t() : counts(HIST_BUCKETS, 0), total(0) {}
+
+    // Valores pequeños tienen cubo propio; a partir de ahí se guardan los 7 bits
+    // más significativos (64 cubos por cada potencia de 2)
+    static int indexOf(uint64_t value)
+    {
+        if (value < (uint64_t)HIST_SUB_BUCKETS)
+            return (int)value;
+        int exponent = 63 - __builtin_clzll(value) - HIST_SUB_BITS + 1;
+        int top = (int)(value >> exponent);
+        return HIST_SUB_BUCKETS + (exponent - 1) * HIST_HALF + (top - HIST_HALF);
+    }
+
+    static uint64_t valueOf(int index)
+    {
+        if (index < HIST_SUB_BUCKETS)
+            return index;
+        int k = index - HIST_SUB_BUCKETS;
+        int exponent = k / HIST_HALF + 1;
+        uint64_t top = k % HIST_HALF + HIST_HALF;
+        return top << exponent;
+    }
+
+    void record(uint64_t value)
+    {
+        counts[indexOf(value)]++;
+        total++;
+    }
+
+    void merge(const latency_histogram_t &other)
+    {
+        for (int i = 0; i < HIST_BUCKETS; i++)
+            counts[i] += other.counts[i];
+        total += other.total;
+    }
+
+    uint64_t percentile(double p) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(p / 100.0 * total);
+        if (rank >= total)
+            rank = total - 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < HIST_BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen > rank)
+                return valueOf(i);
+        }
+        return valueOf(HIST_BUCKETS - 1);
+    }
+} latency_histogram_t;
+
+// Contadores de un hilo de trabajo (se suman al final y en cada informe)
+typedef struct worker_stats_t
+{
+    atomic<uint64_t> sentMsgs{0};
+    atomic<uint64_t> sentBytes{0};
+    atomic<uint64_t> recvMsgs{0};
+    atomic<uint64_t> recvBytes{0};
+    atomic<uint64_t> notifications{0};
+    atomic<uint64_t> joins{0};
+    atomic<uint64_t> leaves{0};
+    atomic<uint64_t> errors{0};
+} worker_stats_t;
+
+typedef struct bot_t
+{
+    string name;
+    atomic<int> clientID{-1}; // id en el registro de conexiones (-1 si desconectado)
+    atomic<int> version{0};   // versión acordada (0: esperando la respuesta al saludo)
+} bot_t;
+
+typedef struct worker_t
+{
+    int index;
+    int epollFD;
+    int firstBot; // bots [firstBot, lastBot) de este hilo
+    int lastBot;
+    worker_stats_t stats;
+    latency_histogram_t histogram; // solo lo toca el hilo receptor
+    mutex histogram_mutex;         // para leerlo desde el informe periódico
+} worker_t;
+
+static loadgen_options_t options;
+static vector<bot_t> bots;
+static vector<worker_t *> workers;
+static atomic<bool> sending(false);
+static atomic<bool> receiving(true);
+
+static bool requestShm(worker_t *worker, int botIndex, int clientID);
+
+/**
+ * @brief Conecta el bot, envía su nombre y registra el socket en el epoll del hilo
+ */
+static bool connectBot(worker_t *worker, int botIndex)
+{
+    connection_t connection = options.unixPath.empty() ? initClient(options.host, options.port)
+                                                       : initUnixClient(options.unixPath);
+    if (connection.socket == -1)
+    {
+        worker->stats.errors++;
+        return false;
+    }
+
+    // Con v1 basta el nombre; si no, no se envía nada más hasta que el
+    // servidor conteste con la versión acordada
+    int clientID = connection.serverId;
+    if (options.protocol == PROTOCOL_V1)
+    {
+        bots[botIndex].version = PROTOCOL_V1;
+        sendFrame(clientID, encodeMessage(threadFrameBuilder(), name_msg_t{bots[botIndex].name}));
+    }
+    else
+    {
+        bots[botIndex].version = 0;
+        int compression = options.compress ? COMPRESSION_ZLIB : COMPRESSION_NONE;
+        sendFrame(clientID, encodeMessage(threadFrameBuilder(),
+                                          hello_msg_t{bots[botIndex].name, "", -1, options.protocol, compression}));
+    }
+
+    int watchFD = connection.socket;
+    if (options.shm)
+    {
+        if (!requestShm(worker, botIndex, clientID))
+        {
+            worker->stats.errors++;
+            closeConnection(clientID);
+            return false;
+        }
+        connection_ref_t attached(clientID);
+        watchFD = attached->shm->dataFD;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = (uint64_t)botIndex << 32 | (uint32_t)clientID;
+    epoll_ctl(worker->epollFD, EPOLL_CTL_ADD, watchFD, &event);
+
+    bots[botIndex].clientID = clientID;
+    worker->stats.joins++;
+    return true;
+}
+
+static void disconnectBot(worker_t *worker, int botIndex)
+{
+    int clientID = bots[botIndex].clientID.exchange(-1);
+    if (clientID < 0)
+        return;
+
+    int version = bots[botIndex].version;
+    if (version != 0)
+        sendFrame(clientID, encodeMessage(threadFrameBuilder(), public_request_t{"exit()"}, version));
+
+    // close() saca el socket del epoll; los eventos viejos ya no encuentran el id
+    closeConnection(clientID);
+    worker->stats.leaves++;
+}
+
+/**
+ * @brief Texto con marca de tiempo, relleno hasta el tamaño pedido
+ */
+static void buildStampedText(string &text, int64_t sentAt)
+{
+    text = STAMP_PREFIX + to_string(sentAt) + " ";
+    if ((int)text.size() < options.size)
+        text.append(options.size - text.size(), 'x');
+}
+
+/**
+ * @brief Hilo emisor: reparte su parte del ritmo total entre sus bots
+ */
+static void senderLoop(worker_t *worker)
+{
+    mt19937 random(1234 + worker->index);
+    int numBots = worker->lastBot - worker->firstBot;
+    uniform_int_distribution<int> pickBot(worker->firstBot, worker->lastBot - 1);
+    uniform_int_distribution<int> pickAnyBot(0, options.bots - 1);
+    uniform_int_distribution<int> pickAction(0, options.mixPublic + options.mixPrivate + options.mixChurn - 1);
+
+    double workerRate = options.rate / options.threads;
+    int64_t interval = workerRate > 0 ? (int64_t)(1e9 / workerRate) : 0;
+    int64_t nextSend = nowNs();
+    string text;
+
+    while (sending && numBots > 0)
+    {
+        if (interval > 0)
+        {
+            int64_t now = nowNs();
+            if (now < nextSend)
+            {
+                this_thread::sleep_for(chrono::nanoseconds(nextSend - now));
+                continue;
+            }
+            nextSend += interval;
+            // Si se acumula retraso no se intenta recuperar de golpe
+            if (nextSend < now - 100 * interval)
+                nextSend = now;
+        }
+
+        int botIndex = pickBot(random);
+        int action = pickAction(random);
+
+        if (action >= options.mixPublic + options.mixPrivate)
+        {
+            // Entrada/salida de sesión
+            disconnectBot(worker, botIndex);
+            connectBot(worker, botIndex);
+            continue;
+        }
+
+        int clientID = bots[botIndex].clientID;
+        int version = bots[botIndex].version;
+        if (clientID < 0 || version == 0)
+            continue;
+
+        frame_builder_t &builder = threadFrameBuilder();
+        buildStampedText(text, nowNs());
+        if (action < options.mixPublic)
+            encodeMessage(builder, public_request_t{text}, version);
+        else
+            encodeMessage(builder, private_request_t{bots[pickAnyBot(random)].name, text}, version);
+        sendFrame(clientID, builder);
+
+        worker->stats.sentMsgs++;
+        worker->stats.sentBytes += builder.bytes.size();
+    }
+}
+
+/**
+ * @brief Procesa una trama recibida por un bot y anota su latencia
+ */
+static void handleFrame(worker_t *worker, int botIndex, frame_reader_t *reader, msg_cursor_t &frame, int64_t receivedAt)
+{
+    if (peekMessageType(frame) != MSG_TYPE_COMPRESSED)
+        worker->stats.recvMsgs++;
+
+    string_view message;
+    static thread_local vector<unsigned char> inflated;
+    bool ok = dispatchMessage<server_messages_t>(frame, message_visitor_t{
+        [&](const public_msg_t &m) { message = m.text; },
+        [&](const private_msg_t &m) { message = m.text; },
+        [&](const channel_msg_t &m) { message = m.text; },
+        [&](const notification_msg_t &) { worker->stats.notifications++; },
+        [&](const session_msg_t &) {},
+        // Lo que siga en el buffer ya viene en la versión acordada
+        [&](const version_msg_t &m)
+        {
+            reader->version = m.version;
+            bots[botIndex].version = m.version;
+        },
+        [&](const user_msg_t &) {},
+        [&](const shm_msg_t &) {},
+        // Un lote comprimido cuenta por las tramas que lleva dentro
+        [&](const compressed_msg_t &m)
+        {
+            if (!inflateFrames(m, inflated))
+            {
+                worker->stats.errors++;
+                return;
+            }
+            vector<unsigned char> batch;
+            batch.swap(inflated);
+            msg_cursor_t frames = makeCursor(batch);
+            frames.version = frame.version;
+            msg_cursor_t inner;
+            while (nextFrame(frames, inner))
+                handleFrame(worker, botIndex, reader, inner, receivedAt);
+        }});
+    if (!ok)
+    {
+        worker->stats.errors++;
+        return;
+    }
+
+    if (message.compare(0, STAMP_PREFIX.size(), STAMP_PREFIX) != 0)
+        return;
+    int64_t sentAt = strtoll(string(message.substr(STAMP_PREFIX.size(), 20)).c_str(), nullptr, 10);
+    if (sentAt > 0 && receivedAt >= sentAt)
+    {
+        lock_guard<mutex> lock(worker->histogram_mutex);
+        worker->histogram.record(receivedAt - sentAt);
+    }
+}
+
+/**
+ * @brief Pide el anillo de memoria compartida y espera (bloqueando) su anuncio;
+ * lo que llegue antes se atiende como cualquier otra trama
+ * @return false si el servidor no lo concede
+ */
+static bool requestShm(worker_t *worker, int botIndex, int clientID)
+{
+    connection_ref_t connection(clientID);
+    msg_cursor_t frame;
+    // La petición va en la versión acordada
+    while (bots[botIndex].version == 0)
+    {
+        if (!recvFrame(clientID, frame))
+            return false;
+        handleFrame(worker, botIndex, connection->reader, frame, nowNs());
+    }
+    sendFrame(clientID, encodeMessage(threadFrameBuilder(), shm_request_t{0}, bots[botIndex].version));
+
+    while (recvFrame(clientID, frame))
+    {
+        int type = peekMessageType(frame);
+        handleFrame(worker, botIndex, connection->reader, frame, nowNs());
+        if (type == MSG_TYPE_SHM)
+            return connection->shm != nullptr;
+        if (type == MSG_TYPE_NOTIFICATION)
+            return false; // rechazada
+    }
+    return false;
+}
+
+/**
+ * @brief Hilo receptor: vacía los sockets de sus bots con epoll, sin bloquear
+ * nunca al emisor (si el servidor escribe más rápido de lo que se lee, el que
+ * frena es el servidor, no este proceso)
+ */
+static void receiverLoop(worker_t *worker)
+{
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (receiving)
+    {
+        int n = epoll_wait(worker->epollFD, events, MAX_EVENTS, 100);
+        int64_t receivedAt = nowNs();
+        for (int i = 0; i < n; i++)
+        {
+            int clientID = (int)(uint32_t)events[i].data.u64;
+            int botIndex = (int)(events[i].data.u64 >> 32);
+            connection_ref_t connection(clientID);
+            if (!connection)
+                continue;
+
+            frame_reader_t *reader = connection->reader;
+            shm_ring_t *ring = connection->shm;
+            if (ring)
+            {
+                uint64_t value;
+                ssize_t r = read(ring->dataFD, &value, sizeof(value));
+                (void)r;
+            }
+
+            // Un read() por evento; con anillo, todo lo publicado y, antes de
+            // volver a dormir, el aviso al servidor (si entretanto escribió, otra vuelta)
+            bool closed = false;
+            while (true)
+            {
+                ssize_t readBytes = ring ? shmRead(*ring, *reader) : reader->fill(connection->socket);
+                closed = readBytes < 0 || (readBytes == 0 && (!ring || shmFinished(*ring)));
+                if (closed)
+                    break;
+                msg_cursor_t frame;
+                while (reader->next(frame))
+                {
+                    worker->stats.recvBytes += frameWireSize(frame);
+                    handleFrame(worker, botIndex, reader, frame, receivedAt);
+                }
+                if (!ring || shmWaitData(*ring))
+                    break;
+            }
+            if (closed)
+            {
+                // El servidor cerró la sesión: dejar de vigilar el socket (o el anillo)
+                epoll_ctl(worker->epollFD, EPOLL_CTL_DEL, ring ? ring->dataFD : connection->socket, nullptr);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Suma los contadores e histogramas de todos los hilos
+ */
+static void collect(worker_stats_t &total, latency_histogram_t &histogram)
+{
+    for (worker_t *worker : workers)
+    {
+        total.sentMsgs += worker->stats.sentMsgs;
+        total.sentBytes += worker->stats.sentBytes;
+        total.recvMsgs += worker->stats.recvMsgs;
+        total.recvBytes += worker->stats.recvBytes;
+        total.notifications += worker->stats.notifications;
+        total.joins += worker->stats.joins;
+        total.leaves += worker->stats.leaves;
+        total.errors += worker->stats.errors;
+        lock_guard<mutex> lock(worker->histogram_mutex);
+        histogram.merge(worker->histogram);
+    }
+}
+
+static void printReport(const char *label, double seconds, worker_stats_t &stats, latency_histogram_t &histogram)
+{
+    printf("%s %.1f s | enviados %.0f msg/s %.2f MB/s | recibidos %.0f msg/s %.2f MB/s | "
+           "latencia p50 %.1f us p99 %.1f us p999 %.1f us | altas %" PRIu64 " bajas %" PRIu64 " errores %" PRIu64 "\n",
+           label, seconds,
+           stats.sentMsgs / seconds, stats.sentBytes / seconds / 1e6,
+           stats.recvMsgs / seconds, stats.recvBytes / seconds / 1e6,
+           histogram.percentile(50) / 1e3, histogram.percentile(99) / 1e3, histogram.percentile(99.9) / 1e3,
+           stats.joins.load(), stats.leaves.load(), stats.errors.load());
+    fflush(stdout);
+}
+
+void printUsage(const char *program)
+{
+    cout << "Uso: " << program << " [opciones]" << endl
+         << "  --host H               servidor (127.0.0.1)" << endl
+         << "  --port N               puerto (3000)" << endl
+         << "  --bots N               sesiones simultáneas (1000)" << endl
+         << "  --threads N            hilos emisores/receptores (4)" << endl
+         << "  --duration S           segundos de medida (10)" << endl
+         << "  --rate N               mensajes/s en total, 0 sin límite (1000)" << endl
+         << "  --size N               tamaño mínimo del texto en bytes (64)" << endl
+         << "  --mix P,M,C            pesos de público, /msg y entrada/salida (80,15,5)" << endl
+         << "  --protocol N           versión del protocolo (" << PROTOCOL_LATEST << ")" << endl
+         << "  --compress             acepta tramas comprimidas (v2)" << endl
+         << "  --unix PATH            conecta por el socket local del servidor" << endl
+         << "  --shm                  recibe por memoria compartida (con --unix)" << endl;
+}
+
+bool parseOptions(int argc, char **argv)
+{
+    options = {"127.0.0.1", 3000, 1000, 4, 10, 1000, 64, 80, 15, 5, PROTOCOL_LATEST, false, "", false};
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--host" && hasValue)
+            options.host = argv[++i];
+        else if (arg == "--port" && hasValue)
+            options.port = atoi(argv[++i]);
+        else if (arg == "--bots" && hasValue)
+            options.bots = atoi(argv[++i]);
+        else if (arg == "--threads" && hasValue)
+            options.threads = atoi(argv[++i]);
+        else if (arg == "--duration" && hasValue)
+            options.duration = atof(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+            options.rate = atof(argv[++i]);
+        else if (arg == "--size" && hasValue)
+            options.size = atoi(argv[++i]);
+        else if (arg == "--mix" && hasValue)
+        {
+            if (sscanf(argv[++i], "%d,%d,%d", &options.mixPublic, &options.mixPrivate, &options.mixChurn) != 3)
+                return false;
+        }
+        else if (arg == "--protocol" && hasValue)
+            options.protocol = atoi(argv[++i]);
+        else if (arg == "--compress")
+            options.compress = true;
+        else if (arg == "--unix" && hasValue)
+            options.unixPath = argv[++i];
+        else if (arg == "--shm")
+            options.shm = true;
+        else
+            return false;
+    }
+
+    return options.bots > 0 && options.threads > 0 && options.duration > 0 &&
+           options.mixPublic >= 0 && options.mixPrivate >= 0 && options.mixChurn >= 0 &&
+           options.mixPublic + options.mixPrivate + options.mixChurn > 0 &&
+           options.protocol >= PROTOCOL_V1 && options.protocol <= PROTOCOL_LATEST &&
+           (!options.shm || !options.unixPath.empty());
+}
+
+int main(int argc, char **argv)
+{
+    if (!parseOptions(argc, argv))
+    {
+        printUsage(argv[0]);
+        return -1;
+    }
+    if (options.threads > options.bots)
+        options.threads = options.bots;
+
+    // Una sesión cerrada por el servidor no debe tumbar el proceso al escribir
+    signal(SIGPIPE, SIG_IGN);
+
+    // Miles de sockets: subir el límite de descriptores al máximo permitido
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    bots = vector<bot_t>(options.bots);
+    for (int i = 0; i < options.bots; i++)
+        bots[i].name = "bot" + to_string(i);
+
+    // Fase de conexión
+    int64_t connectStart = nowNs();
+    for (int w = 0; w < options.threads; w++)
+    {
+        worker_t *worker = new worker_t();
+        worker->index = w;
+        worker->epollFD = epoll_create1(0);
+        worker->firstBot = (long)options.bots * w / options.threads;
+        worker->lastBot = (long)options.bots * (w + 1) / options.threads;
+        workers.push_back(worker);
+    }
+
+    vector<thread> receivers;
+    for (worker_t *worker : workers)
+        receivers.emplace_back(receiverLoop, worker);
+
+    vector<thread> connectors;
+    for (worker_t *worker : workers)
+        connectors.emplace_back([worker]()
+                                {
+            for (int b = worker->firstBot; b < worker->lastBot; b++)
+                connectBot(worker, b); });
+    for (thread &connector : connectors)
+        connector.join();
+
+    worker_stats_t connected;
+    latency_histogram_t unused;
+    collect(connected, unused);
+    printf("%" PRIu64 " bots conectados en %.2f s (%" PRIu64 " errores)\n",
+           connected.joins.load(), (nowNs() - connectStart) / 1e9, connected.errors.load());
+
+    // Dar tiempo al servidor a registrar todos los nombres antes de medir
+    this_thread::sleep_for(chrono::milliseconds(500));
+    for (worker_t *worker : workers)
+    {
+        worker->stats.recvMsgs = 0;
+        worker->stats.recvBytes = 0;
+        worker->stats.notifications = 0;
+        worker->stats.joins = 0;
+        worker->stats.errors = 0;
+    }
+
+    // Fase de medida, con un informe por segundo
+    sending = true;
+    int64_t start = nowNs();
+    vector<thread> senders;
+    for (worker_t *worker : workers)
+        senders.emplace_back(senderLoop, worker);
+
+    worker_stats_t previous;
+    for (int second = 1; second <= (int)options.duration; second++)
+    {
+        this_thread::sleep_until(chrono::steady_clock::time_point(chrono::nanoseconds(start + second * 1000000000LL)));
+        worker_stats_t now, interval;
+        latency_histogram_t histogram;
+        collect(now, histogram);
+        interval.sentMsgs = now.sentMsgs - previous.sentMsgs;
+        interval.sentBytes = now.sentBytes - previous.sentBytes;
+        interval.recvMsgs = now.recvMsgs - previous.recvMsgs;
+        interval.recvBytes = now.recvBytes - previous.recvBytes;
+        interval.joins = now.joins - previous.joins;
+        interval.leaves = now.leaves - previous.leaves;
+        interval.errors = now.errors - previous.errors;
+        char label[16];
+        snprintf(label, sizeof(label), "[%3ds]", second); // percentiles acumulados
+        printReport(label, 1, interval, histogram);
+        previous.sentMsgs = now.sentMsgs.load();
+        previous.sentBytes = now.sentBytes.load();
+        previous.recvMsgs = now.recvMsgs.load();
+        previous.recvBytes = now.recvBytes.load();
+        previous.joins = now.joins.load();
+        previous.leaves = now.leaves.load();
+        previous.errors = now.errors.load();
+    }
+    this_thread::sleep_until(chrono::steady_clock::time_point(chrono::nanoseconds(start + (int64_t)(options.duration * 1e9))));
+
+    sending = false;
+    for (thread &sender : senders)
+        sender.join();
+    double elapsed = (nowNs() - start) / 1e9;
+
+    // Esperar a que llegue lo que queda en vuelo
+    this_thread::sleep_for(chrono::milliseconds(500));
+
+    worker_stats_t total;
+    latency_histogram_t histogram;
+    collect(total, histogram);
+    printReport("TOTAL", elapsed, total, histogram);
+    printf("muestras de latencia %" PRIu64 ", notificaciones %" PRIu64 ", máx. aprox. %.1f us\n",
+           histogram.total, total.notifications.load(), histogram.percentile(100) / 1e3);
+    printf("protocolo v%d%s: %.1f bytes por mensaje recibido\n", options.protocol, options.compress ? " con compresión" : "",
+           total.recvMsgs > 0 ? (double)total.recvBytes / total.recvMsgs : 0.0);
+
+    receiving = false;
+    for (thread &receiver : receivers)
+        receiver.join();
+    for (int i = 0; i < options.bots; i++)
+    {
+        int clientID = bots[i].clientID.exchange(-1);
+        if (clientID >= 0)
+            closeConnection(clientID);
+    }
+
+    return 0;
+}
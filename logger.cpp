@@ -0,0 +1,455 @@
+#include "logger.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<int> logLevel(LOG_LEVEL_INFO);
+
+// Bytes del anillo de cada hilo (potencia de 2). Un registro no puede ocupar
+// más de una cuarta parte.
+const size_t LOG_RING_BYTES = 64 * 1024;
+const int32_t LOG_PADDING = -1; // hueco al final del anillo: el siguiente empieza en 0
+// Espera máxima del escritor sin que nadie lo despierte (solo para liberar
+// anillos de hilos terminados y avisar de descartes)
+const int LOG_IDLE_MS = 100;
+
+static const char *LEVEL_NAMES[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+static const char *LEVEL_COLORS[] = {"\033[2m", "\033[32m", "\033[33m", "\033[31m"};
+static const char *COLOR_RESET = "\033[0m";
+
+/**
+ * Anillo de un hilo. Solo él avanza head (al publicar) y solo el escritor
+ * avanza tail (al terminar de escribir); los dos son contadores de bytes que
+ * nunca vuelven atrás.
+ */
+typedef struct log_ring_t
+{
+    unsigned char *buf;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<unsigned long long> dropped;
+    std::atomic<bool> retired; // el hilo terminó: liberar cuando quede vacío
+    size_t reserved;           // inicio del registro reservado (solo el productor)
+} log_ring_t;
+
+static thread_local log_ring_t *currentRing = nullptr;
+
+static std::mutex rings_mutex;
+static std::vector<log_ring_t *> rings;
+static unsigned long long retiredDropped = 0; // descartes de anillos ya liberados
+
+static std::atomic<bool> writerRunning(false);
+static std::thread writer;
+// El escritor duerme cuando no queda nada; quien publica con writerIdle
+// activo lo despierta (sin escritor dormido, publicar no toca ningún cerrojo)
+static std::atomic<bool> writerIdle(false);
+static std::mutex wake_mutex;
+static std::condition_variable wake_cv;
+static bool wakePending = false; // protegido por wake_mutex
+static std::mutex output_mutex; // escrituras síncronas (sin escritor)
+static bool colors = false;
+
+uint64_t logNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void logSetLevel(int level)
+{
+    logLevel.store(level, std::memory_order_relaxed);
+}
+
+int logParseLevel(const std::string &name)
+{
+    for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_ERROR; level++)
+    {
+        std::string levelName = LEVEL_NAMES[level];
+        std::transform(levelName.begin(), levelName.end(), levelName.begin(), ::tolower);
+        if (name == levelName)
+            return level;
+    }
+    return -1;
+}
+
+unsigned long long logDropped()
+{
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    unsigned long long total = retiredDropped;
+    for (log_ring_t *ring : rings)
+        total += ring->dropped.load(std::memory_order_relaxed);
+    return total;
+}
+
+// Al terminar un hilo su anillo queda para que el escritor lo vacíe y lo libere
+typedef struct log_thread_guard_t
+{
+    ~log_thread_guard_t()
+    {
+        if (currentRing != nullptr)
+            currentRing->retired.store(true, std::memory_order_release);
+        currentRing = nullptr;
+    }
+} log_thread_guard_t;
+
+static log_ring_t *registerRing()
+{
+    static thread_local log_thread_guard_t guard;
+    (void)guard;
+
+    log_ring_t *ring = new log_ring_t();
+    ring->buf = new unsigned char[LOG_RING_BYTES]; // sin inicializar: solo se tocan las páginas usadas
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    ring->retired = false;
+    ring->reserved = 0;
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    rings.push_back(ring);
+    currentRing = ring;
+    return ring;
+}
+
+unsigned char *logReserve(size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+
+    // Sin escritor se formatea en el momento desde un buffer del hilo
+    if (!writerRunning.load(std::memory_order_acquire))
+    {
+        static thread_local std::vector<uint64_t> scratch;
+        scratch.resize(size / sizeof(uint64_t));
+        log_record_t *record = (log_record_t *)scratch.data();
+        record->size = size;
+        return (unsigned char *)record;
+    }
+
+    log_ring_t *ring = currentRing != nullptr ? currentRing : registerRing();
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    size_t used = head - ring->tail.load(std::memory_order_acquire);
+    size_t pos = head & (LOG_RING_BYTES - 1);
+    size_t padding = pos + size > LOG_RING_BYTES ? LOG_RING_BYTES - pos : 0;
+    if (size > LOG_RING_BYTES / 4 || used + padding + size > LOG_RING_BYTES)
+    {
+        ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // El relleno se publica junto con el registro (en logCommit)
+    if (padding > 0)
+    {
+        log_record_t *gap = (log_record_t *)(ring->buf + pos);
+        gap->size = padding;
+        gap->level = LOG_PADDING;
+        head += padding;
+    }
+    ring->reserved = head;
+    log_record_t *record = (log_record_t *)(ring->buf + (head & (LOG_RING_BYTES - 1)));
+    record->size = size;
+    return (unsigned char *)record;
+}
+
+// Formato "HH:MM:SS.mmm" de la hora local (la de cada segundo se reutiliza)
+static void appendTime(std::string &out, uint64_t timestamp)
+{
+    static time_t cachedSecond = -1;
+    static char cached[16];
+    time_t second = timestamp / 1000000000ULL;
+    if (second != cachedSecond)
+    {
+        struct tm local;
+        localtime_r(&second, &local);
+        strftime(cached, sizeof(cached), "%H:%M:%S", &local);
+        cachedSecond = second;
+    }
+    char millis[8];
+    snprintf(millis, sizeof(millis), ".%03u", (unsigned)(timestamp / 1000000ULL % 1000));
+    out += cached;
+    out += millis;
+}
+
+template <typename T>
+static void appendFormatted(std::string &out, const std::string &spec, T value)
+{
+    char buffer[256];
+    int n = snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+    if (n < 0)
+        return;
+    if ((size_t)n < sizeof(buffer))
+    {
+        out.append(buffer, n);
+        return;
+    }
+    size_t pos = out.size();
+    out.resize(pos + n + 1);
+    snprintf(&out[pos], n + 1, spec.c_str(), value);
+    out.resize(pos + n);
+}
+
+/**
+ * @brief Aplica una especificación de printf a un argumento guardado. El tipo
+ * lo decide el argumento (no la especificación), así que un formato que no
+ * cuadra con sus argumentos nunca lee memoria que no debe.
+ * @param flags Banderas, anchura y precisión de la especificación original
+ */
+static void appendArg(std::string &out, const std::string &flags, char conversion, const log_arg_t &arg,
+                      const char *text)
+{
+    bool floating = strchr("fFeEgGaA", conversion) != nullptr;
+    bool unsignedConversion = strchr("uxXo", conversion) != nullptr;
+    switch (arg.tag)
+    {
+    case LOG_ARG_INT:
+        if (floating)
+            appendFormatted(out, "%" + flags + conversion, (double)arg.i);
+        else if (unsignedConversion)
+            appendFormatted(out, "%" + flags + "ll" + conversion, (unsigned long long)arg.i);
+        else
+            appendFormatted(out, "%" + flags + "lld", arg.i);
+        break;
+    case LOG_ARG_UINT:
+        if (floating)
+            appendFormatted(out, "%" + flags + conversion, (double)arg.u);
+        else
+            appendFormatted(out, "%" + flags + "ll" + (unsignedConversion ? conversion : 'u'), arg.u);
+        break;
+    case LOG_ARG_DOUBLE:
+        appendFormatted(out, "%" + flags + (floating ? conversion : 'g'), arg.d);
+        break;
+    case LOG_ARG_CHAR:
+        appendFormatted(out, "%" + flags + "c", (int)arg.i);
+        break;
+    case LOG_ARG_POINTER:
+        appendFormatted(out, "%" + flags + "p", arg.p);
+        break;
+    case LOG_ARG_STRING:
+    {
+        // Anchura y alineación de la especificación; la longitud es la guardada
+        std::string padding = flags.substr(0, flags.find('.'));
+        std::string value(text, arg.length);
+        appendFormatted(out, "%" + padding + "s", value.c_str());
+        break;
+    }
+    }
+}
+
+/**
+ * @brief Línea completa de un registro: hora, nivel y mensaje formateado
+ */
+static void formatRecord(std::string &out, const log_record_t *record)
+{
+    int level = std::max(LOG_LEVEL_DEBUG, std::min(LOG_LEVEL_ERROR, (int)record->level));
+    if (colors)
+        out += LEVEL_COLORS[level];
+    appendTime(out, record->timestamp);
+    out += ' ';
+    out += LEVEL_NAMES[level];
+    out += level == LOG_LEVEL_INFO || level == LOG_LEVEL_WARN ? "  " : " ";
+
+    const log_arg_t *args = (const log_arg_t *)(record + 1);
+    const char *text = (const char *)(args + record->argc);
+    uint32_t next = 0;
+    for (const char *p = record->format; *p; p++)
+    {
+        if (*p != '%')
+        {
+            out += *p;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            out += '%';
+            p++;
+            continue;
+        }
+
+        // %[banderas][anchura][.precisión][longitud]conversión
+        const char *start = ++p;
+        while (*p && strchr("-+ #0", *p))
+            p++;
+        while (*p && (isdigit((unsigned char)*p) || *p == '.'))
+            p++;
+        std::string flags(start, p - start);
+        while (*p && strchr("hlLqjzt", *p))
+            p++;
+        if (*p == '\0' || next >= record->argc)
+        {
+            // Sin argumento para la especificación: se escribe tal cual
+            out.append(start - 1, p - start + 1);
+            if (*p == '\0')
+                break;
+            continue;
+        }
+        const log_arg_t &arg = args[next++];
+        appendArg(out, flags, *p, arg, text);
+        if (arg.tag == LOG_ARG_STRING)
+            text += arg.length;
+    }
+
+    // Una línea por registro, aunque el formato traiga sus propios saltos
+    while (!out.empty() && out.back() == '\n')
+        out.pop_back();
+    if (colors)
+        out += COLOR_RESET;
+    out += '\n';
+}
+
+static void wakeWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wakePending = true;
+    }
+    wake_cv.notify_one();
+}
+
+void logCommit(unsigned char *bytes)
+{
+    log_ring_t *ring = currentRing;
+    if (ring != nullptr && bytes >= ring->buf && bytes < ring->buf + LOG_RING_BYTES)
+    {
+        const log_record_t *record = (const log_record_t *)bytes;
+        ring->head.store(ring->reserved + record->size, std::memory_order_release);
+        // Pareja de la barrera de writerLoop: o el escritor ve el registro al
+        // revisar los anillos o aquí se ve que va a dormir
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writerIdle.load(std::memory_order_relaxed))
+            wakeWriter();
+        return;
+    }
+
+    // Registro síncrono (sin escritor)
+    std::string line;
+    formatRecord(line, (const log_record_t *)bytes);
+    std::lock_guard<std::mutex> lock(output_mutex);
+    fwrite(line.data(), 1, line.size(), stdout);
+    fflush(stdout);
+}
+
+typedef struct log_pending_t
+{
+    uint64_t timestamp;
+    const log_record_t *record;
+} log_pending_t;
+
+/**
+ * @brief Escribe todo lo publicado en los anillos, en orden de tiempo, con una
+ * sola escritura, y libera los anillos de hilos que ya terminaron
+ * @return false si no había nada
+ */
+static bool drainRings(std::string &out, std::vector<log_pending_t> &pending, unsigned long long &reportedDrops)
+{
+    std::vector<log_ring_t *> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        snapshot = rings;
+    }
+
+    std::vector<size_t> heads(snapshot.size());
+    pending.clear();
+    for (size_t i = 0; i < snapshot.size(); i++)
+    {
+        log_ring_t *ring = snapshot[i];
+        size_t head = ring->head.load(std::memory_order_acquire);
+        for (size_t pos = ring->tail.load(std::memory_order_relaxed); pos < head;)
+        {
+            const log_record_t *record = (const log_record_t *)(ring->buf + (pos & (LOG_RING_BYTES - 1)));
+            if (record->level != LOG_PADDING)
+                pending.push_back({record->timestamp, record});
+            pos += record->size;
+        }
+        heads[i] = head;
+    }
+
+    std::stable_sort(pending.begin(), pending.end(), [](const log_pending_t &a, const log_pending_t &b)
+                     { return a.timestamp < b.timestamp; });
+    out.clear();
+    for (const log_pending_t &entry : pending)
+        formatRecord(out, entry.record);
+
+    unsigned long long dropped = logDropped();
+    if (dropped > reportedDrops)
+    {
+        out += "registro: se descartaron " + std::to_string(dropped - reportedDrops) + " líneas (anillo lleno)\n";
+        reportedDrops = dropped;
+    }
+    if (!out.empty())
+    {
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+    }
+
+    for (size_t i = 0; i < snapshot.size(); i++)
+        snapshot[i]->tail.store(heads[i], std::memory_order_release);
+
+    // Anillos de hilos terminados y ya vacíos
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (size_t i = 0; i < rings.size();)
+        {
+            log_ring_t *ring = rings[i];
+            if (ring->retired.load(std::memory_order_acquire) &&
+                ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire))
+            {
+                retiredDropped += ring->dropped.load(std::memory_order_relaxed);
+                rings[i] = rings.back();
+                rings.pop_back();
+                delete[] ring->buf;
+                delete ring;
+            }
+            else
+                i++;
+        }
+    }
+    return !pending.empty();
+}
+
+static void writerLoop()
+{
+    std::string out;
+    std::vector<log_pending_t> pending;
+    unsigned long long reportedDrops = 0;
+    while (writerRunning.load(std::memory_order_acquire))
+    {
+        if (drainRings(out, pending, reportedDrops))
+            continue;
+
+        // Se anuncia que va a dormir y se revisa otra vez: lo publicado antes
+        // del anuncio no habría despertado a nadie
+        writerIdle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!drainRings(out, pending, reportedDrops))
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake_cv.wait_for(lock, std::chrono::milliseconds(LOG_IDLE_MS), []()
+                             { return wakePending; });
+            wakePending = false;
+        }
+        writerIdle.store(false, std::memory_order_relaxed);
+    }
+    drainRings(out, pending, reportedDrops);
+}
+
+void logStart()
+{
+    if (writerRunning.exchange(true))
+        return;
+    colors = isatty(STDOUT_FILENO);
+    writer = std::thread(writerLoop);
+}
+
+void logStop()
+{
+    if (!writerRunning.exchange(false))
+        return;
+    wakeWriter();
+    writer.join();
+}
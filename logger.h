@@ -0,0 +1,246 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Registro asíncrono. Una llamada a LOG_* no formatea ni escribe: guarda el
+ * formato (un literal, solo su puntero) y los argumentos en binario en el
+ * anillo del hilo que llama, que tiene un único productor y un único
+ * consumidor y no usa cerrojos. Un hilo escritor vacía todos los anillos,
+ * ordena los registros por tiempo, los formatea y los escribe de una vez. Si el
+ * anillo está lleno el registro se descarta y se cuenta: quien atiende los
+ * mensajes nunca espera a la consola.
+ *
+ * Los niveles por debajo de LOG_COMPILE_LEVEL desaparecen al compilar (ni
+ * siquiera se evalúan sus argumentos); el resto se filtra en ejecución con
+ * logSetLevel. Antes de logStart, y tras logStop, cada registro se formatea y
+ * escribe en el momento, así que los programas que no lo arrancan (cliente,
+ * herramientas) siguen viendo los mensajes.
+ */
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// -DLOG_COMPILE_LEVEL=LOG_LEVEL_WARN quita del binario las trazas de depuración e información
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// El formato tiene que ser un literal (se concatena con ""): se guarda su puntero
+#define LOG_AT(level, format, ...)                         \
+    do                                                     \
+    {                                                      \
+        if (logEnabled(level))                             \
+            logWrite(level, "" format, ##__VA_ARGS__);     \
+    } while (0)
+
+#define LOG_REMOVED() \
+    do                \
+    {                 \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) LOG_REMOVED()
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) LOG_REMOVED()
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) LOG_REMOVED()
+#endif
+
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+/**
+ * @brief Arranca el hilo escritor: desde ahora los registros son asíncronos
+ */
+void logStart();
+
+/**
+ * @brief Escribe lo pendiente y para el hilo escritor (se puede registrar con atexit)
+ */
+void logStop();
+
+/**
+ * @brief Nivel mínimo que se registra en ejecución (LOG_LEVEL_INFO por defecto)
+ */
+void logSetLevel(int level);
+
+/**
+ * @brief Nivel a partir de su nombre (debug, info, warn, error)
+ * @return -1 si no es ninguno
+ */
+int logParseLevel(const std::string &name);
+
+/**
+ * @brief Registros descartados porque el anillo de su hilo estaba lleno
+ */
+unsigned long long logDropped();
+
+// ============================================================================
+// Implementación de las llamadas (no usar directamente: LOG_*)
+// ============================================================================
+
+extern std::atomic<int> logLevel;
+
+inline bool logEnabled(int level)
+{
+    return level >= logLevel.load(std::memory_order_relaxed);
+}
+
+// Las cadenas se copian al anillo recortadas a este tamaño
+const size_t LOG_MAX_STRING = 512;
+
+typedef enum log_arg_tag_t
+{
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_CHAR,
+    LOG_ARG_STRING, // los bytes van tras los argumentos, en orden
+    LOG_ARG_POINTER
+} log_arg_tag_t;
+
+// Cabecera de un registro en el anillo; le siguen argc log_arg_t y las cadenas
+typedef struct log_record_t
+{
+    uint32_t size;      // bytes del registro completo (múltiplo de 8)
+    int32_t level;      // LOG_LEVEL_* (o relleno hasta el final del anillo)
+    uint64_t timestamp; // ns de reloj de pared, para ordenar los de varios hilos
+    const char *format;
+    uint32_t argc;
+    uint32_t reserved;
+} log_record_t;
+
+typedef struct log_arg_t
+{
+    uint32_t tag;    // log_arg_tag_t
+    uint32_t length; // bytes de la cadena (LOG_ARG_STRING)
+    union
+    {
+        long long i;
+        unsigned long long u;
+        double d;
+        const void *p;
+    };
+} log_arg_t;
+
+/**
+ * @brief Reserva size bytes para un registro en el anillo del hilo
+ * @return nullptr si no cabe (el registro se descarta)
+ */
+unsigned char *logReserve(size_t size);
+
+/**
+ * @brief Publica el registro reservado (o lo escribe ya si no hay escritor)
+ */
+void logCommit(unsigned char *record);
+
+uint64_t logNow();
+
+namespace logdetail
+{
+    template <typename T>
+    inline std::string_view toText(const T &value)
+    {
+        if constexpr (std::is_pointer_v<std::decay_t<T>>)
+            return value ? std::string_view(value) : std::string_view("(null)");
+        else
+            return std::string_view(value);
+    }
+
+    template <typename T>
+    inline size_t extraSize(const T &value)
+    {
+        if constexpr (std::is_convertible_v<const T &, std::string_view>)
+            return std::min(toText(value).size(), LOG_MAX_STRING);
+        else
+            return 0;
+    }
+
+    template <typename T>
+    inline void putArg(log_arg_t &arg, char *&strings, const T &value)
+    {
+        typedef std::decay_t<T> value_t;
+        arg.length = 0;
+        if constexpr (std::is_convertible_v<const T &, std::string_view>)
+        {
+            std::string_view text = toText(value);
+            arg.tag = LOG_ARG_STRING;
+            arg.length = std::min(text.size(), LOG_MAX_STRING);
+            memcpy(strings, text.data(), arg.length);
+            strings += arg.length;
+        }
+        else if constexpr (std::is_same_v<value_t, char>)
+        {
+            arg.tag = LOG_ARG_CHAR;
+            arg.i = value;
+        }
+        else if constexpr (std::is_floating_point_v<value_t>)
+        {
+            arg.tag = LOG_ARG_DOUBLE;
+            arg.d = value;
+        }
+        else if constexpr (std::is_enum_v<value_t> || std::is_same_v<value_t, bool> ||
+                           (std::is_integral_v<value_t> && std::is_signed_v<value_t>))
+        {
+            arg.tag = LOG_ARG_INT;
+            arg.i = (long long)value;
+        }
+        else if constexpr (std::is_integral_v<value_t>)
+        {
+            arg.tag = LOG_ARG_UINT;
+            arg.u = value;
+        }
+        else if constexpr (std::is_pointer_v<value_t>)
+        {
+            arg.tag = LOG_ARG_POINTER;
+            arg.p = (const void *)value;
+        }
+        else
+            static_assert(sizeof(T) == 0, "tipo de argumento no admitido por el registro");
+    }
+} // namespace logdetail
+
+/**
+ * @brief Copia el registro al anillo del hilo; el formateo lo hace el escritor
+ */
+template <typename... Args>
+inline void logWrite(int level, const char *format, const Args &...args)
+{
+    constexpr size_t argc = sizeof...(Args);
+    size_t size = sizeof(log_record_t) + argc * sizeof(log_arg_t) + (logdetail::extraSize(args) + ... + 0);
+    unsigned char *bytes = logReserve(size);
+    if (bytes == nullptr)
+        return;
+
+    log_record_t *record = (log_record_t *)bytes;
+    record->level = level;
+    record->timestamp = logNow();
+    record->format = format;
+    record->argc = argc;
+    log_arg_t *arg = (log_arg_t *)(record + 1);
+    char *strings = (char *)(arg + argc);
+    (logdetail::putArg(*arg++, strings, args), ...);
+    (void)strings;
+    logCommit(bytes);
+}
+
+#endif
@@ -0,0 +1,224 @@
+#include "metrics.h"
+#include "logger.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+thread_local metrics_block_t *metricsCurrentBlock = nullptr;
+
+// Bloques de los hilos vivos y acumulado de los que ya terminaron
+static std::mutex blocks_mutex;
+static std::vector<metrics_block_t *> liveBlocks;
+static metrics_block_t *retired = nullptr;
+static std::vector<std::function<void(std::string &)>> sources;
+
+static const char *TYPE_NAMES[METRIC_NUM_TYPES] = {"public", "private", "notification", "join", "leave", "list", "channel", "history",
+                                                    "session", "version", "user", "compressed", "shm"};
+static const char *HISTOGRAM_NAMES[METRIC_NUM_HISTOGRAMS] = {"chat_fanout_ns", "chat_users_mutex_wait_ns", "chat_queue_depth_bytes"};
+
+static metrics_block_t *newBlock()
+{
+    metrics_block_t *block = new metrics_block_t();
+    for (int i = 0; i < METRIC_NUM_COUNTERS; i++)
+        block->counters[i] = 0;
+    for (int h = 0; h < METRIC_NUM_HISTOGRAMS; h++)
+    {
+        for (int b = 0; b < METRIC_HIST_BUCKETS; b++)
+            block->histograms[h].counts[b] = 0;
+        block->histograms[h].total = 0;
+        block->histograms[h].sum = 0;
+        block->histograms[h].max = 0;
+    }
+    return block;
+}
+
+// Suma src en dst (dst solo lo toca quien tiene blocks_mutex)
+static void accumulate(metrics_block_t *dst, const metrics_block_t *src)
+{
+    for (int i = 0; i < METRIC_NUM_COUNTERS; i++)
+        dst->counters[i] += src->counters[i].load(std::memory_order_relaxed);
+    for (int h = 0; h < METRIC_NUM_HISTOGRAMS; h++)
+    {
+        const metrics_histogram_t &from = src->histograms[h];
+        metrics_histogram_t &to = dst->histograms[h];
+        for (int b = 0; b < METRIC_HIST_BUCKETS; b++)
+            to.counts[b] += from.counts[b].load(std::memory_order_relaxed);
+        to.total += from.total.load(std::memory_order_relaxed);
+        to.sum += from.sum.load(std::memory_order_relaxed);
+        to.max = std::max(to.max.load(), from.max.load(std::memory_order_relaxed));
+    }
+}
+
+// Al terminar un hilo su bloque se acumula en el global y se libera
+typedef struct metrics_thread_guard_t
+{
+    ~metrics_thread_guard_t()
+    {
+        metrics_block_t *block = metricsCurrentBlock;
+        if (block == nullptr)
+            return;
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        accumulate(retired, block);
+        liveBlocks.erase(std::find(liveBlocks.begin(), liveBlocks.end(), block));
+        metricsCurrentBlock = nullptr;
+        delete block;
+    }
+} metrics_thread_guard_t;
+
+metrics_block_t *metricsRegisterThread()
+{
+    static thread_local metrics_thread_guard_t guard;
+    (void)guard;
+
+    metrics_block_t *block = newBlock();
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    if (retired == nullptr)
+        retired = newBlock();
+    liveBlocks.push_back(block);
+    metricsCurrentBlock = block;
+    return block;
+}
+
+void metricsAddSource(std::function<void(std::string &out)> source)
+{
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    sources.push_back(std::move(source));
+}
+
+static unsigned long long bucketValue(int index)
+{
+    if (index < METRIC_HIST_LINEAR)
+        return index;
+    int k = index - METRIC_HIST_LINEAR;
+    int exponent = k / METRIC_HIST_HALF + 1;
+    unsigned long long top = k % METRIC_HIST_HALF + METRIC_HIST_HALF;
+    return top << exponent;
+}
+
+static unsigned long long percentile(const metrics_histogram_t &h, double p)
+{
+    unsigned long long total = h.total.load();
+    if (total == 0)
+        return 0;
+    unsigned long long rank = (unsigned long long)(p * total);
+    if (rank >= total)
+        rank = total - 1;
+    unsigned long long seen = 0;
+    for (int b = 0; b < METRIC_HIST_BUCKETS; b++)
+    {
+        seen += h.counts[b].load();
+        if (seen > rank)
+            return bucketValue(b);
+    }
+    return h.max.load();
+}
+
+static void appendLine(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void appendLine(std::string &out, const char *format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    out += line;
+}
+
+std::string metricsDump()
+{
+    metrics_block_t *total = newBlock();
+    std::vector<std::function<void(std::string &)>> extra;
+    {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        if (retired != nullptr)
+            accumulate(total, retired);
+        for (metrics_block_t *block : liveBlocks)
+            accumulate(total, block);
+        extra = sources;
+    }
+
+    std::string out;
+    appendLine(out, "chat_connections_opened_total %lld\n", total->counters[METRIC_CONNECTIONS_OPENED].load());
+    appendLine(out, "chat_connections_closed_total %lld\n", total->counters[METRIC_CONNECTIONS_CLOSED].load());
+    appendLine(out, "chat_users %lld\n", total->counters[METRIC_USERS].load());
+    appendLine(out, "chat_queue_frames %lld\n", total->counters[METRIC_QUEUE_FRAMES].load());
+    appendLine(out, "chat_queue_bytes %lld\n", total->counters[METRIC_QUEUE_BYTES].load());
+    for (int t = 0; t < METRIC_NUM_TYPES; t++)
+    {
+        appendLine(out, "chat_messages_in_total{type=\"%s\"} %lld\n", TYPE_NAMES[t], total->counters[METRIC_MSGS_IN + t].load());
+        appendLine(out, "chat_bytes_in_total{type=\"%s\"} %lld\n", TYPE_NAMES[t], total->counters[METRIC_BYTES_IN + t].load());
+        appendLine(out, "chat_messages_out_total{type=\"%s\"} %lld\n", TYPE_NAMES[t], total->counters[METRIC_MSGS_OUT + t].load());
+        appendLine(out, "chat_bytes_out_total{type=\"%s\"} %lld\n", TYPE_NAMES[t], total->counters[METRIC_BYTES_OUT + t].load());
+    }
+    appendLine(out, "chat_invalid_messages_total %lld\n", total->counters[METRIC_INVALID_MSGS].load());
+
+    for (int h = 0; h < METRIC_NUM_HISTOGRAMS; h++)
+    {
+        const metrics_histogram_t &histogram = total->histograms[h];
+        const char *name = HISTOGRAM_NAMES[h];
+        appendLine(out, "%s{quantile=\"0.5\"} %llu\n", name, percentile(histogram, 0.5));
+        appendLine(out, "%s{quantile=\"0.99\"} %llu\n", name, percentile(histogram, 0.99));
+        appendLine(out, "%s{quantile=\"0.999\"} %llu\n", name, percentile(histogram, 0.999));
+        appendLine(out, "%s_max %llu\n", name, histogram.max.load());
+        appendLine(out, "%s_sum %llu\n", name, histogram.sum.load());
+        appendLine(out, "%s_count %llu\n", name, histogram.total.load());
+    }
+    delete total;
+
+    for (auto &source : extra)
+        source(out);
+    return out;
+}
+
+static void serveAdmin(int listenFD)
+{
+    while (true)
+    {
+        int client = accept(listenFD, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        std::string dump = metricsDump();
+        size_t sent = 0;
+        while (sent < dump.size())
+        {
+            ssize_t n = send(client, dump.data() + sent, dump.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+        close(client);
+    }
+}
+
+bool metricsStartAdmin(int port)
+{
+    int listenFD = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFD < 0)
+        return false;
+
+    int opt = 1;
+    setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // solo accesible desde la máquina
+    address.sin_port = htons(port);
+    if (bind(listenFD, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listenFD, 16) < 0)
+    {
+        LOG_ERROR("metrics -- no se pudo abrir el puerto de administración %d", port);
+        close(listenFD);
+        return false;
+    }
+
+    std::thread(serveAdmin, listenFD).detach();
+    return true;
+}
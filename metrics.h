@@ -0,0 +1,178 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+
+/**
+ * Métricas del servidor. Cada hilo escribe en su propio bloque de contadores e
+ * histogramas (sin instrucciones atómicas de lectura-modificación-escritura ni
+ * cerrojos), y solo quien pide un volcado recorre y suma todos los bloques.
+ * Así la instrumentación puede quedarse activa con el servidor a plena carga.
+ *
+ * El volcado se sirve en texto (formato de Prometheus) por un socket de
+ * administración que solo escucha en 127.0.0.1.
+ */
+
+// Tipos de mensaje que se contabilizan por separado (MSG_TYPE_* hasta
+// MSG_TYPE_SHM, el último que puede enviar un cliente)
+const int METRIC_NUM_TYPES = 13;
+
+typedef enum metric_counter_t
+{
+    METRIC_CONNECTIONS_OPENED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_USERS,        // gauge: usuarios con nombre conectados
+    METRIC_QUEUE_FRAMES, // gauge: tramas en colas de salida
+    METRIC_QUEUE_BYTES,  // gauge: bytes en colas de salida
+    METRIC_MSGS_IN,      // + tipo (METRIC_NUM_TYPES entradas)
+    METRIC_BYTES_IN = METRIC_MSGS_IN + METRIC_NUM_TYPES,
+    METRIC_MSGS_OUT = METRIC_BYTES_IN + METRIC_NUM_TYPES,
+    METRIC_BYTES_OUT = METRIC_MSGS_OUT + METRIC_NUM_TYPES,
+    METRIC_INVALID_MSGS = METRIC_BYTES_OUT + METRIC_NUM_TYPES,
+    METRIC_NUM_COUNTERS
+} metric_counter_t;
+
+typedef enum metric_histogram_t
+{
+    METRIC_HIST_FANOUT_NS,     // desde que se origina un broadcast hasta que cada shard lo encola
+    METRIC_HIST_USERS_WAIT_NS, // espera para tomar users_mutex
+    METRIC_HIST_QUEUE_BYTES,   // profundidad de la cola de salida al encolar
+    METRIC_NUM_HISTOGRAMS
+} metric_histogram_t;
+
+/**
+ * Histograma log-lineal de tamaño fijo (estilo HDR): cubos exactos hasta 32 y
+ * después 16 cubos por potencia de 2 (error relativo < 6,25 %) hasta 2^40.
+ */
+const int METRIC_HIST_SUB_BITS = 5;
+const int METRIC_HIST_LINEAR = 1 << METRIC_HIST_SUB_BITS;
+const int METRIC_HIST_HALF = METRIC_HIST_LINEAR / 2;
+const int METRIC_HIST_MAX_BITS = 40;
+const int METRIC_HIST_BUCKETS = METRIC_HIST_LINEAR + (METRIC_HIST_MAX_BITS - METRIC_HIST_SUB_BITS + 1) * METRIC_HIST_HALF;
+
+typedef struct metrics_histogram_t
+{
+    std::atomic<unsigned long long> counts[METRIC_HIST_BUCKETS];
+    std::atomic<unsigned long long> total;
+    std::atomic<unsigned long long> sum;
+    std::atomic<unsigned long long> max;
+} metrics_histogram_t;
+
+// Bloque de un hilo: solo lo modifica ese hilo (los lectores solo cargan)
+typedef struct metrics_block_t
+{
+    std::atomic<long long> counters[METRIC_NUM_COUNTERS];
+    metrics_histogram_t histograms[METRIC_NUM_HISTOGRAMS];
+} metrics_block_t;
+
+extern thread_local metrics_block_t *metricsCurrentBlock;
+
+/**
+ * @brief Crea y registra el bloque del hilo que llama; al terminar el hilo sus
+ * valores se acumulan en un bloque global y el suyo se libera
+ */
+metrics_block_t *metricsRegisterThread();
+
+inline metrics_block_t &metricsThreadBlock()
+{
+    metrics_block_t *block = metricsCurrentBlock;
+    if (block == nullptr)
+        block = metricsRegisterThread();
+    return *block;
+}
+
+inline void metricsAdd(metric_counter_t counter, long long value = 1)
+{
+    std::atomic<long long> &c = metricsThreadBlock().counters[counter];
+    c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline int metricsBucketOf(unsigned long long value)
+{
+    if (value < (unsigned long long)METRIC_HIST_LINEAR)
+        return (int)value;
+    if (value >> METRIC_HIST_MAX_BITS)
+        value = (1ULL << METRIC_HIST_MAX_BITS) - 1;
+    int exponent = 63 - __builtin_clzll(value) - METRIC_HIST_SUB_BITS + 1;
+    int top = (int)(value >> exponent);
+    return METRIC_HIST_LINEAR + (exponent - 1) * METRIC_HIST_HALF + (top - METRIC_HIST_HALF);
+}
+
+inline void metricsRecord(metric_histogram_t histogram, unsigned long long value)
+{
+    metrics_histogram_t &h = metricsThreadBlock().histograms[histogram];
+    std::atomic<unsigned long long> &bucket = h.counts[metricsBucketOf(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h.total.store(h.total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h.sum.store(h.sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value > h.max.load(std::memory_order_relaxed))
+        h.max.store(value, std::memory_order_relaxed);
+}
+
+// Mensajes de un tipo que entran o salen (tipos desconocidos: METRIC_INVALID_MSGS)
+inline void metricsCountIn(int type, size_t bytes)
+{
+    if (type < 0 || type >= METRIC_NUM_TYPES)
+    {
+        metricsAdd(METRIC_INVALID_MSGS);
+        return;
+    }
+    metricsAdd((metric_counter_t)(METRIC_MSGS_IN + type));
+    metricsAdd((metric_counter_t)(METRIC_BYTES_IN + type), bytes);
+}
+
+inline void metricsCountOut(int type, size_t bytes, long long count = 1)
+{
+    if (type < 0 || type >= METRIC_NUM_TYPES)
+        return;
+    metricsAdd((metric_counter_t)(METRIC_MSGS_OUT + type), count);
+    metricsAdd((metric_counter_t)(METRIC_BYTES_OUT + type), bytes * count);
+}
+
+inline unsigned long long metricsNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Toma el mutex anotando cuánto se esperó. Si está libre no se lee el
+ * reloj (se anota 0).
+ */
+inline std::unique_lock<std::mutex> metricsLock(std::mutex &mutex, metric_histogram_t histogram)
+{
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (lock.owns_lock())
+    {
+        metricsRecord(histogram, 0);
+        return lock;
+    }
+    unsigned long long start = metricsNowNs();
+    lock.lock();
+    metricsRecord(histogram, metricsNowNs() - start);
+    return lock;
+}
+
+/**
+ * @brief Añade al volcado líneas de otro subsistema (p. ej. estadísticas de colas)
+ */
+void metricsAddSource(std::function<void(std::string &out)> source);
+
+/**
+ * @brief Texto con todos los contadores e histogramas sumados
+ */
+std::string metricsDump();
+
+/**
+ * @brief Atiende el socket de administración en 127.0.0.1:port en un hilo:
+ * cada conexión recibe un volcado y se cierra
+ * @return false si no se pudo abrir el puerto
+ */
+bool metricsStartAdmin(int port);
+
+#endif
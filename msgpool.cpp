@@ -0,0 +1,163 @@
+#include "msgpool.h"
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Clases de tamaño: 64 B, 128 B, ... 64 KB. Lo mayor se reserva aparte.
+const int POOL_MIN_SHIFT = 6;
+const int POOL_NUM_CLASSES = 11;
+// Bloques libres que se guardan por clase (el resto se devuelve al sistema)
+const size_t POOL_MAX_FREE = 4096;
+
+typedef struct pool_class_t
+{
+    std::mutex mutex;
+    std::vector<msg_t *> free;
+} pool_class_t;
+
+static pool_class_t poolClasses[POOL_NUM_CLASSES];
+
+static std::atomic<unsigned long long> statAcquires(0);
+static std::atomic<unsigned long long> statHits(0);
+static std::atomic<unsigned long long> statMisses(0);
+static std::atomic<unsigned long long> statOversize(0);
+static std::atomic<unsigned long long> statInUse(0);
+static std::atomic<unsigned long long> statInUseHighWater(0);
+static std::atomic<unsigned long long> statQueueHighWater(0);
+
+static void raiseHighWater(std::atomic<unsigned long long> &mark, unsigned long long value)
+{
+    unsigned long long current = mark.load(std::memory_order_relaxed);
+    while (value > current &&
+           !mark.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        ;
+}
+
+static int sizeClassOf(int size)
+{
+    int sizeClass = 0;
+    while (sizeClass < POOL_NUM_CLASSES && (1 << (POOL_MIN_SHIFT + sizeClass)) < size)
+        sizeClass++;
+    return sizeClass < POOL_NUM_CLASSES ? sizeClass : -1;
+}
+
+static msg_t *allocMSG(int capacity, int sizeClass)
+{
+    void *block = ::operator new(sizeof(msg_t) + capacity);
+    msg_t *msg = static_cast<msg_t *>(block);
+    msg->size = 0;
+    msg->capacity = capacity;
+    msg->sizeClass = sizeClass;
+    msg->data = reinterpret_cast<unsigned char *>(msg + 1);
+    return msg;
+}
+
+msg_t *acquireMSG(int size)
+{
+    statAcquires.fetch_add(1, std::memory_order_relaxed);
+    raiseHighWater(statInUseHighWater, statInUse.fetch_add(1, std::memory_order_relaxed) + 1);
+
+    int sizeClass = sizeClassOf(size);
+    if (sizeClass < 0)
+    {
+        statOversize.fetch_add(1, std::memory_order_relaxed);
+        return allocMSG(size, -1);
+    }
+
+    pool_class_t &pool = poolClasses[sizeClass];
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (!pool.free.empty())
+        {
+            msg_t *msg = pool.free.back();
+            pool.free.pop_back();
+            statHits.fetch_add(1, std::memory_order_relaxed);
+            msg->size = 0;
+            return msg;
+        }
+    }
+
+    statMisses.fetch_add(1, std::memory_order_relaxed);
+    return allocMSG(1 << (POOL_MIN_SHIFT + sizeClass), sizeClass);
+}
+
+void releaseMSG(msg_t *msg)
+{
+    if (msg == nullptr)
+        return;
+    statInUse.fetch_sub(1, std::memory_order_relaxed);
+
+    if (msg->sizeClass >= 0)
+    {
+        pool_class_t &pool = poolClasses[msg->sizeClass];
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.free.size() < POOL_MAX_FREE)
+        {
+            pool.free.push_back(msg);
+            return;
+        }
+    }
+    ::operator delete(msg);
+}
+
+msg_pool_stats_t getMsgPoolStats()
+{
+    msg_pool_stats_t stats;
+    stats.acquires = statAcquires.load();
+    stats.hits = statHits.load();
+    stats.misses = statMisses.load();
+    stats.oversize = statOversize.load();
+    stats.inUse = statInUse.load();
+    stats.inUseHighWater = statInUseHighWater.load();
+    stats.queueHighWater = statQueueHighWater.load();
+    return stats;
+}
+
+msg_queue_t::msg_queue_t(size_t capacity) : head(0), tail(0), highWater(0)
+{
+    size_t rounded = 1;
+    while (rounded < capacity)
+        rounded <<= 1;
+    slots = new msg_t *[rounded];
+    mask = rounded - 1;
+}
+
+msg_queue_t::~msg_queue_t()
+{
+    delete[] slots;
+}
+
+bool msg_queue_t::push(msg_t *msg)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t used = t - head.load(std::memory_order_acquire);
+    if (used > mask)
+        return false;
+
+    slots[t & mask] = msg;
+    tail.store(t + 1, std::memory_order_release);
+
+    if (used + 1 > highWater)
+    {
+        highWater = used + 1;
+        raiseHighWater(statQueueHighWater, highWater);
+    }
+    return true;
+}
+
+msg_t *msg_queue_t::pop()
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+        return nullptr;
+
+    msg_t *msg = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return msg;
+}
+
+size_t msg_queue_t::size() const
+{
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+}
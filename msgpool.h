@@ -0,0 +1,78 @@
+#ifndef _MSGPOOL_H_
+#define _MSGPOOL_H_
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Mensaje recibido por la vía asíncrona (recvMSGAsync → getMSG). La cabecera y
+ * los datos van en un único bloque que sale de un pool por clases de tamaño, así
+ * recibir y consumir un mensaje no reserva memoria una vez que el pool está
+ * caliente.
+ */
+typedef struct msg_t
+{
+    int size;            // bytes útiles
+    int capacity;        // bytes reservados tras la cabecera
+    int sizeClass;       // clase del pool (-1: fuera del pool, se libera al soltarlo)
+    unsigned char *data; // apunta justo detrás de la cabecera
+} msg_t;
+
+/**
+ * @brief Saca del pool un mensaje con capacidad para al menos size bytes
+ */
+msg_t *acquireMSG(int size);
+
+/**
+ * @brief Devuelve el mensaje a su clase del pool (o lo libera si no es del pool)
+ */
+void releaseMSG(msg_t *msg);
+
+// Contadores del pool y de las colas de mensajes (acumulados de todo el proceso)
+typedef struct msg_pool_stats_t
+{
+    unsigned long long acquires;  // mensajes pedidos
+    unsigned long long hits;      // servidos reutilizando un bloque libre
+    unsigned long long misses;    // bloques nuevos reservados
+    unsigned long long oversize;  // mayores que la clase más grande (sin pool)
+    unsigned long long inUse;     // mensajes sin devolver ahora mismo
+    unsigned long long inUseHighWater;
+    unsigned long long queueHighWater; // máximo de mensajes esperando en una cola
+} msg_pool_stats_t;
+
+msg_pool_stats_t getMsgPoolStats();
+
+/**
+ * Cola circular acotada de un productor y un consumidor (el hilo de
+ * recvMSGAsync y quien llame a getMSG) sin cerrojos: cada extremo solo escribe
+ * su propio índice.
+ */
+typedef struct msg_queue_t
+{
+    msg_t **slots;
+    size_t mask; // capacidad - 1 (potencia de 2)
+    alignas(64) std::atomic<size_t> head; // siguiente a consumir (consumidor)
+    alignas(64) std::atomic<size_t> tail; // siguiente hueco libre (productor)
+    size_t highWater;                     // solo lo toca el productor
+
+    explicit msg_queue_t(size_t capacity = 1024);
+    ~msg_queue_t();
+    msg_queue_t(const msg_queue_t &) = delete;
+    msg_queue_t &operator=(const msg_queue_t &) = delete;
+
+    /**
+     * @brief Encola (solo el productor)
+     * @return false si la cola está llena
+     */
+    bool push(msg_t *msg);
+
+    /**
+     * @brief Desencola (solo el consumidor)
+     * @return El mensaje o nullptr si no hay ninguno
+     */
+    msg_t *pop();
+
+    size_t size() const;
+} msg_queue_t;
+
+#endif
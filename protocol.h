@@ -0,0 +1,630 @@
+#ifndef _PROTOCOL_H_
+#define _PROTOCOL_H_
+
+#include "utils.h"
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+/**
+ * Esquema del protocolo. Cada mensaje se declara una sola vez como un struct
+ * con su tipo (TYPE) y sus campos; el codificador, el decodificador, el tamaño
+ * exacto de la trama y las comprobaciones de límites se generan en tiempo de
+ * compilación a partir de esa declaración.
+ *
+ *   v1: [int tamaño][int tipo][campo]...           (orden de la máquina)
+ *   v2: [u24 tamaño][u8 tipo][campo]...            (cabecera en orden de red)
+ *
+ * Campos admitidos: int, long long, std::string_view (cadena con prefijo de
+ * longitud) y user_ref_t (remitente). En v2 los enteros y las longitudes van
+ * como varint y el remitente como un id que el cliente ya conoce (MSG_TYPE_USER)
+ * en lugar del nombre. Al decodificar, las cadenas son vistas sobre la trama
+ * recibida: solo son válidas mientras lo sea el buffer. Los bytes que sobren al
+ * final de una trama se ignoran, así se pueden añadir campos sin romper a quien
+ * no los conoce.
+ *
+ * Versión: el cliente la propone en el saludo (que siempre va en v1) y el
+ * servidor contesta con MSG_TYPE_VERSION, también en v1. Desde ese momento los
+ * dos lados usan la versión acordada. Un saludo sin versión es un cliente v1.
+ *
+ * Compresión: el saludo también indica qué algoritmos admite el cliente y la
+ * respuesta de versión el elegido. Desde entonces el servidor puede enviarle
+ * tramas MSG_TYPE_COMPRESSED, que envuelven una o varias tramas normales
+ * (compress.h).
+ *
+ * Memoria compartida: un cliente conectado por el socket local puede pedir
+ * (MSG_TYPE_SHM) que lo que le envía el servidor llegue por un anillo en
+ * memoria compartida (shmring.h). La respuesta, con el mismo tipo, viaja por el
+ * socket con los descriptores del anillo; las tramas siguientes, con el mismo
+ * formato, ya van por el anillo.
+ *
+ * Federación: los servidores enlazados (federation.h) hablan entre ellos con
+ * tramas v1 de este mismo esquema. Tras el saludo de enlace (MSG_TYPE_PEER)
+ * cada nodo anuncia sus usuarios (MSG_TYPE_PRESENCE) y reenvía los mensajes
+ * públicos y de canal tal cual los recibirían sus clientes v1; los privados
+ * llevan además el destinatario (MSG_TYPE_ROUTED).
+ */
+
+// --- Constantes del Protocolo ---
+const int MSG_TYPE_PUBLIC = 0;
+const int MSG_TYPE_PRIVATE = 1;
+const int MSG_TYPE_NOTIFICATION = 2; // Mensajes del servidor al cliente
+const int MSG_TYPE_JOIN = 3;         // Unirse a un canal
+const int MSG_TYPE_LEAVE = 4;        // Salir de un canal
+const int MSG_TYPE_LIST = 5;         // Listar canales (respuesta por notificación)
+const int MSG_TYPE_CHANNEL = 6;      // Mensaje a un canal
+const int MSG_TYPE_HISTORY = 7;      // Pedir el historial
+const int MSG_TYPE_SESSION = 8;      // Sesión creada o reanudada (control)
+const int MSG_TYPE_VERSION = 9;      // Versión acordada (control, siempre en v1)
+const int MSG_TYPE_USER = 10;        // id → nombre de un remitente (solo v2)
+const int MSG_TYPE_COMPRESSED = 11;  // lote de tramas comprimido (servidor → cliente)
+const int MSG_TYPE_SHM = 12;         // pasar a memoria compartida (solo socket local)
+const int MSG_TYPE_PEER = 13;        // saludo de enlace entre servidores
+const int MSG_TYPE_PRESENCE = 14;    // usuario conectado/desconectado en otro nodo
+const int MSG_TYPE_ROUTED = 15;      // privado para un usuario de otro nodo
+
+// Algoritmos de compresión (máscara en el saludo, uno solo en la respuesta)
+const int COMPRESSION_NONE = 0;
+const int COMPRESSION_ZLIB = 1;
+
+// Los mensajes sin tipo (el saludo) no llevan el int del tipo
+const int MSG_TYPE_NONE = -1;
+
+// Remitente de las notificaciones
+const std::string_view SERVER_NAME = "Servidor";
+
+/**
+ * Remitente de un mensaje. En v1 viaja el nombre; en v2 el id con el que el
+ * servidor lo anunció (MSG_TYPE_USER), o 0 seguido del nombre si no tiene id
+ * (p. ej. mensajes del historial de usuarios que ya no están).
+ */
+typedef struct user_ref_t
+{
+    unsigned int id;
+    std::string_view name;
+} user_ref_t;
+
+// Declara los campos de un mensaje, en el orden en que viajan
+#define MESSAGE_FIELDS(...)                                     \
+    auto fields() { return std::tie(__VA_ARGS__); }             \
+    auto fields() const { return std::tie(__VA_ARGS__); }
+
+// ============================================================================
+// Cliente → servidor
+// ============================================================================
+
+// Saludo: [usuario][token][long long recibido][int versión][int compresión].
+// Los clientes anteriores envían solo los primeros campos (ver decodeHello).
+typedef struct hello_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_NONE;
+    std::string_view username;
+    std::string_view token;
+    long long received; // -1: no pide sesión reanudable
+    int version;        // 0: no la propone (v1)
+    int compression;    // COMPRESSION_* que admite (máscara)
+    MESSAGE_FIELDS(username, token, received, version, compression)
+} hello_msg_t;
+
+// Saludo de los clientes que solo envían el nombre
+typedef struct name_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_NONE;
+    std::string_view username;
+    MESSAGE_FIELDS(username)
+} name_msg_t;
+
+typedef struct public_request_t
+{
+    static constexpr int TYPE = MSG_TYPE_PUBLIC;
+    std::string_view text;
+    MESSAGE_FIELDS(text)
+} public_request_t;
+
+typedef struct private_request_t
+{
+    static constexpr int TYPE = MSG_TYPE_PRIVATE;
+    std::string_view recipient;
+    std::string_view text;
+    MESSAGE_FIELDS(recipient, text)
+} private_request_t;
+
+typedef struct join_request_t
+{
+    static constexpr int TYPE = MSG_TYPE_JOIN;
+    std::string_view channel;
+    MESSAGE_FIELDS(channel)
+} join_request_t;
+
+typedef struct leave_request_t
+{
+    static constexpr int TYPE = MSG_TYPE_LEAVE;
+    std::string_view channel;
+    MESSAGE_FIELDS(channel)
+} leave_request_t;
+
+typedef struct list_request_t
+{
+    static constexpr int TYPE = MSG_TYPE_LIST;
+    MESSAGE_FIELDS()
+} list_request_t;
+
+typedef struct channel_request_t
+{
+    static constexpr int TYPE = MSG_TYPE_CHANNEL;
+    std::string_view channel;
+    std::string_view text;
+    MESSAGE_FIELDS(channel, text)
+} channel_request_t;
+
+// since < 0: los últimos limit mensajes
+typedef struct history_request_t
+{
+    static constexpr int TYPE = MSG_TYPE_HISTORY;
+    long long since;
+    int limit;
+    MESSAGE_FIELDS(since, limit)
+} history_request_t;
+
+// bytes <= 0: tamaño de anillo por defecto
+typedef struct shm_request_t
+{
+    static constexpr int TYPE = MSG_TYPE_SHM;
+    int bytes;
+    MESSAGE_FIELDS(bytes)
+} shm_request_t;
+
+// ============================================================================
+// Servidor → cliente
+// ============================================================================
+
+typedef struct public_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_PUBLIC;
+    user_ref_t sender;
+    std::string_view text;
+    MESSAGE_FIELDS(sender, text)
+} public_msg_t;
+
+typedef struct private_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_PRIVATE;
+    user_ref_t sender;
+    std::string_view text;
+    MESSAGE_FIELDS(sender, text)
+} private_msg_t;
+
+typedef struct notification_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_NOTIFICATION;
+    std::string_view sender;
+    std::string_view text;
+    MESSAGE_FIELDS(sender, text)
+} notification_msg_t;
+
+typedef struct channel_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_CHANNEL;
+    user_ref_t sender;
+    std::string_view channel;
+    std::string_view text;
+    MESSAGE_FIELDS(sender, channel, text)
+} channel_msg_t;
+
+// El cliente cuenta los bytes de las tramas que recibe a partir de seq
+typedef struct session_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_SESSION;
+    std::string_view token;
+    long long seq;
+    MESSAGE_FIELDS(token, seq)
+} session_msg_t;
+
+typedef struct version_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_VERSION;
+    int version;
+    int compression; // COMPRESSION_* con el que se le enviarán los lotes comprimidos
+    MESSAGE_FIELDS(version, compression)
+} version_msg_t;
+
+// Anuncio de un remitente (nombre vacío: el id deja de usarse)
+typedef struct user_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_USER;
+    int id;
+    std::string_view name;
+    MESSAGE_FIELDS(id, name)
+} user_msg_t;
+
+// Tramas concatenadas (en la versión de la conexión) comprimidas con el
+// algoritmo acordado; size es lo que ocupan una vez descomprimidas
+typedef struct compressed_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_COMPRESSED;
+    int size;
+    std::string_view data;
+    MESSAGE_FIELDS(size, data)
+} compressed_msg_t;
+
+// Anillo concedido; sus descriptores llegan con la trama (SCM_RIGHTS)
+typedef struct shm_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_SHM;
+    int bytes;
+    MESSAGE_FIELDS(bytes)
+} shm_msg_t;
+
+// ============================================================================
+// Servidor ↔ servidor (federación)
+// ============================================================================
+
+// Lo envía quien abre el enlace y lo contesta quien lo acepta
+typedef struct peer_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_PEER;
+    std::string_view node;
+    MESSAGE_FIELDS(node)
+} peer_msg_t;
+
+typedef struct presence_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_PRESENCE;
+    std::string_view username;
+    int online; // 0: se desconectó
+    MESSAGE_FIELDS(username, online)
+} presence_msg_t;
+
+typedef struct routed_msg_t
+{
+    static constexpr int TYPE = MSG_TYPE_ROUTED;
+    std::string_view sender;
+    std::string_view recipient;
+    std::string_view text;
+    MESSAGE_FIELDS(sender, recipient, text)
+} routed_msg_t;
+
+/**
+ * @brief Notificación del servidor (remitente "Servidor")
+ */
+inline notification_msg_t serverNotification(std::string_view text)
+{
+    return notification_msg_t{SERVER_NAME, text};
+}
+
+// Lo que acepta cada lado, para el despacho estático
+template <typename... Messages>
+struct message_list_t
+{
+};
+typedef message_list_t<public_request_t, private_request_t, join_request_t, leave_request_t,
+                       list_request_t, channel_request_t, history_request_t, shm_request_t>
+    client_messages_t;
+typedef message_list_t<public_msg_t, private_msg_t, notification_msg_t, channel_msg_t, session_msg_t,
+                       version_msg_t, user_msg_t, compressed_msg_t, shm_msg_t>
+    server_messages_t;
+typedef message_list_t<peer_msg_t, presence_msg_t, public_msg_t, channel_msg_t, routed_msg_t>
+    peer_messages_t;
+
+// ============================================================================
+// Codificación y decodificación generadas
+// ============================================================================
+
+namespace schema
+{
+    // Tamaño fijo de un campo en v1 (0 si depende del valor)
+    template <typename T>
+    constexpr size_t fixedFieldSize()
+    {
+        typedef std::decay_t<T> field_t;
+        static_assert(std::is_same_v<field_t, int> || std::is_same_v<field_t, long long> ||
+                          std::is_same_v<field_t, std::string_view> || std::is_same_v<field_t, user_ref_t>,
+                      "tipo de campo no admitido por el esquema");
+        if constexpr (std::is_same_v<field_t, std::string_view> || std::is_same_v<field_t, user_ref_t>)
+            return 0;
+        else
+            return sizeof(field_t);
+    }
+
+    template <typename Tuple, size_t... I>
+    constexpr bool allFixed(std::index_sequence<I...>)
+    {
+        return ((fixedFieldSize<std::tuple_element_t<I, Tuple>>() > 0) && ...);
+    }
+
+    template <typename Tuple, size_t... I>
+    constexpr size_t sumFixed(std::index_sequence<I...>)
+    {
+        return (fixedFieldSize<std::tuple_element_t<I, Tuple>>() + ... + 0);
+    }
+
+    inline size_t fieldSize(int version, long long value)
+    {
+        return version == PROTOCOL_V2 ? varintSize(zigzagEncode(value)) : sizeof(long long);
+    }
+    inline size_t fieldSize(int version, int value)
+    {
+        return version == PROTOCOL_V2 ? varintSize(zigzagEncode(value)) : sizeof(int);
+    }
+    inline size_t fieldSize(int version, std::string_view text)
+    {
+        return version == PROTOCOL_V2 ? varintSize(text.length()) + text.length() : stringFieldSize(text);
+    }
+    inline size_t fieldSize(int version, const user_ref_t &user)
+    {
+        if (version != PROTOCOL_V2)
+            return stringFieldSize(user.name);
+        return varintSize(user.id) + (user.id == 0 ? fieldSize(version, user.name) : 0);
+    }
+
+    inline void putField(frame_builder_t &builder, int version, int value)
+    {
+        if (version == PROTOCOL_V2)
+            builder.putVarint(zigzagEncode(value));
+        else
+            builder.put<int>(value);
+    }
+    inline void putField(frame_builder_t &builder, int version, long long value)
+    {
+        if (version == PROTOCOL_V2)
+            builder.putVarint(zigzagEncode(value));
+        else
+            builder.put<long long>(value);
+    }
+    inline void putField(frame_builder_t &builder, int version, std::string_view text)
+    {
+        if (version == PROTOCOL_V2)
+            builder.putVarintString(text);
+        else
+            builder.putString(text);
+    }
+    inline void putField(frame_builder_t &builder, int version, const user_ref_t &user)
+    {
+        if (version != PROTOCOL_V2)
+        {
+            builder.putString(user.name);
+            return;
+        }
+        builder.putVarint(user.id);
+        if (user.id == 0)
+            builder.putVarintString(user.name);
+    }
+
+    inline void getField(msg_cursor_t &cursor, int &value)
+    {
+        value = cursor.version == PROTOCOL_V2 ? (int)zigzagDecode(unpackVarint(cursor)) : unpack<int>(cursor);
+    }
+    inline void getField(msg_cursor_t &cursor, long long &value)
+    {
+        value = cursor.version == PROTOCOL_V2 ? zigzagDecode(unpackVarint(cursor)) : unpack<long long>(cursor);
+    }
+    inline void getField(msg_cursor_t &cursor, std::string_view &text)
+    {
+        text = cursor.version == PROTOCOL_V2 ? unpackVarintView(cursor) : unpackView(cursor);
+    }
+    inline void getField(msg_cursor_t &cursor, user_ref_t &user)
+    {
+        user.id = cursor.version == PROTOCOL_V2 ? (unsigned int)unpackVarint(cursor) : 0;
+        user.name = std::string_view();
+        if (user.id == 0)
+            getField(cursor, user.name);
+    }
+
+    template <typename M>
+    using fields_t = decltype(std::declval<const M &>().fields());
+
+    template <typename M>
+    constexpr size_t fieldCount()
+    {
+        return std::tuple_size_v<fields_t<M>>;
+    }
+
+    template <typename M>
+    constexpr size_t tagSize()
+    {
+        return M::TYPE == MSG_TYPE_NONE ? 0 : sizeof(int);
+    }
+} // namespace schema
+
+/**
+ * @brief true si todos los campos del mensaje son de tamaño fijo (en v1)
+ */
+template <typename M>
+constexpr bool messageIsFixed()
+{
+    return schema::allFixed<schema::fields_t<M>>(std::make_index_sequence<schema::fieldCount<M>()>());
+}
+
+/**
+ * @brief Tamaño de los datos de la trama (sin el prefijo): constante en
+ * compilación en v1 si todos los campos son fijos. En v2 el tipo va en la
+ * cabecera y no cuenta.
+ */
+template <typename M>
+inline size_t messagePayloadSize(const M &message, int version = PROTOCOL_V1)
+{
+    if constexpr (messageIsFixed<M>())
+    {
+        constexpr size_t size = schema::tagSize<M>() +
+                                schema::sumFixed<schema::fields_t<M>>(std::make_index_sequence<schema::fieldCount<M>()>());
+        if (version != PROTOCOL_V2)
+            return size;
+    }
+    size_t tag = version == PROTOCOL_V2 ? 0 : schema::tagSize<M>();
+    return std::apply([version, tag](const auto &...field)
+                      { return tag + (schema::fieldSize(version, field) + ... + 0); },
+                      message.fields());
+}
+
+/**
+ * @brief Codifica el mensaje en el builder (reserva el tamaño exacto una vez)
+ * @param version Formato de la trama; los mensajes sin tipo (el saludo) solo
+ * existen en v1
+ */
+template <typename M>
+inline frame_builder_t &encodeMessage(frame_builder_t &builder, const M &message, int version = PROTOCOL_V1)
+{
+    static_assert(M::TYPE < 256, "el tipo no cabe en la cabecera v2");
+    if constexpr (M::TYPE == MSG_TYPE_NONE)
+        version = PROTOCOL_V1;
+    builder.begin(messagePayloadSize(message, version));
+    if (version != PROTOCOL_V2 && M::TYPE != MSG_TYPE_NONE)
+        builder.put<int>(M::TYPE);
+    std::apply([&builder, version](const auto &...field)
+               { (schema::putField(builder, version, field), ...); },
+               message.fields());
+    if (version == PROTOCOL_V2)
+        builder.finishV2((unsigned char)M::TYPE);
+    else
+        builder.finish();
+    return builder;
+}
+
+/**
+ * @brief Trama terminada del mensaje en un buffer propio
+ */
+template <typename M>
+inline std::vector<unsigned char> encodeFrame(const M &message, int version = PROTOCOL_V1)
+{
+    frame_builder_t builder;
+    encodeMessage(builder, message, version);
+    return std::move(builder.bytes);
+}
+
+/**
+ * @brief Decodifica los campos (el tipo ya se ha leído, si lo hay)
+ * @return false si la trama es más corta de lo que indica el esquema
+ */
+template <typename M>
+inline bool decodeMessage(msg_cursor_t &cursor, M &message)
+{
+    std::apply([&cursor](auto &...field)
+               { (schema::getField(cursor, field), ...); },
+               message.fields());
+    return cursor.ok;
+}
+
+/**
+ * @brief Saludo del cliente: el nombre es obligatorio y el resto de campos
+ * toman su valor por defecto si el cliente no los envía
+ * @return false si ni siquiera trae el nombre
+ */
+inline bool decodeHello(msg_cursor_t &cursor, hello_msg_t &hello)
+{
+    hello = hello_msg_t{std::string_view(), std::string_view(), -1, 0, COMPRESSION_NONE};
+    hello.username = unpackView(cursor);
+    if (!cursor.ok)
+        return false;
+
+    msg_cursor_t rest = cursor;
+    std::string_view token = unpackView(rest);
+    long long received = unpack<long long>(rest);
+    if (!rest.ok)
+        return true;
+    hello.token = token;
+    hello.received = received;
+    int version = unpack<int>(rest);
+    if (!rest.ok)
+        return true;
+    hello.version = version;
+    int compression = unpack<int>(rest);
+    if (rest.ok)
+        hello.compression = compression;
+    return true;
+}
+
+/**
+ * @brief Lee el tipo de la trama ([int] en v1, [u8] de la cabecera en v2)
+ */
+inline int unpackMessageType(msg_cursor_t &cursor)
+{
+    if (cursor.version == PROTOCOL_V2)
+        return unpack<unsigned char>(cursor);
+    return unpack<int>(cursor);
+}
+
+/**
+ * @brief Tipo de la trama sin consumirlo (-1 si no cabe)
+ */
+inline int peekMessageType(const msg_cursor_t &cursor)
+{
+    msg_cursor_t copy = cursor;
+    int type = unpackMessageType(copy);
+    return copy.ok ? type : -1;
+}
+
+namespace schema
+{
+    template <typename M, typename Visitor>
+    inline bool decodeAndVisit(msg_cursor_t &cursor, Visitor &visitor)
+    {
+        M message;
+        if (!decodeMessage(cursor, message))
+            return false;
+        visitor(message);
+        return true;
+    }
+
+    template <typename Visitor, typename... Messages>
+    inline bool dispatch(int type, msg_cursor_t &cursor, Visitor &visitor, message_list_t<Messages...>)
+    {
+        bool handled = false;
+        // Se expande a una cadena de comparaciones con constantes (como un switch)
+        (void)((type == Messages::TYPE && (handled = decodeAndVisit<Messages>(cursor, visitor), true)) || ...);
+        return handled;
+    }
+} // namespace schema
+
+/**
+ * @brief Lee el tipo, decodifica el mensaje que le corresponde en List y llama
+ * al visitante con él. El visitante debe aceptar todos los mensajes de la
+ * lista: si falta alguno, no compila.
+ * @return false si el tipo es desconocido o la trama está mal formada
+ */
+template <typename List, typename Visitor>
+inline bool dispatchMessage(msg_cursor_t &cursor, Visitor &&visitor)
+{
+    int type = unpackMessageType(cursor);
+    if (!cursor.ok)
+        return false;
+    return schema::dispatch(type, cursor, visitor, List());
+}
+
+// Reúne varias lambdas en un visitante (una por tipo de mensaje)
+template <typename... Handlers>
+struct message_visitor_t : Handlers...
+{
+    using Handlers::operator()...;
+};
+template <typename... Handlers>
+message_visitor_t(Handlers...) -> message_visitor_t<Handlers...>;
+
+/**
+ * @brief Recodifica en otra versión un lote de tramas v1 del servidor (p. ej.
+ * las del historial) y lo añade a out. Los remitentes van por nombre.
+ * @return Número de tramas recodificadas
+ */
+inline size_t transcodeFrames(const std::vector<unsigned char> &frames, int version, std::vector<unsigned char> &out)
+{
+    frame_builder_t &builder = threadFrameBuilder();
+    msg_cursor_t batch = makeCursor(frames);
+    msg_cursor_t frame;
+    size_t count = 0;
+    while (nextFrame(batch, frame))
+    {
+        bool ok = dispatchMessage<server_messages_t>(frame, [&](const auto &message)
+                                                     { encodeMessage(builder, message, version); });
+        if (!ok)
+            continue;
+        out.insert(out.end(), builder.bytes.begin(), builder.bytes.end());
+        count++;
+    }
+    return count;
+}
+
+// Comprobaciones en compilación de los tamaños fijos
+static_assert(messageIsFixed<history_request_t>() && messageIsFixed<list_request_t>(), "mensajes fijos");
+static_assert(!messageIsFixed<public_msg_t>(), "mensajes variables");
+static_assert(messageIsFixed<version_msg_t>(), "la respuesta de versión es fija");
+
+#endif
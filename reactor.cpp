@@ -0,0 +1,1801 @@
+#include "reactor.h"
+#include "uring.h"
+#include "shmring.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <deque>
+#include <chrono>
+
+// Envío en curso con io_uring. El kernel lee msg, iov y los buffers de frames
+// hasta que llega la terminación, así que si la conexión suelta el socket antes
+// el envío queda huérfano (sin dueño) y se libera al terminar.
+typedef struct uring_send_t
+{
+    int connID;
+    struct msghdr msg;
+    std::vector<struct iovec> iov;
+    std::vector<frame_ptr_t> frames;
+} uring_send_t;
+
+// Anillo de memoria compartida de una conexión local (shmring.h). Con io_uring
+// la espera de hueco lee spaceFD en spaceValue: si la conexión se destruye con
+// la lectura pendiente, el anillo queda huérfano hasta que termine.
+typedef struct reactor_shm_t
+{
+    int connID;
+    shm_ring_t ring;
+    frame_ptr_t announce; // anuncio aún en out (o nullptr: lo siguiente va por el anillo)
+    bool waiting;         // lleno, esperando a que el cliente lea
+    uint64_t spaceValue;
+
+    ~reactor_shm_t() { shmDestroy(ring); }
+} reactor_shm_t;
+
+typedef struct reactor_conn_t
+{
+    int id;
+    int socket;
+    frame_reader_t reader{4096};   // bytes leídos aún sin formar trama (crece si hace falta)
+    std::deque<frame_ptr_t> out;   // tramas compartidas pendientes de escribir
+    size_t outOffset;              // bytes ya escritos de out.front()
+    size_t outBytes;               // bytes pendientes en out (sin descontar outOffset)
+    long long overSince;           // ms en que superó el límite (-1 si no lo supera)
+    bool overflowed;               // superó el límite y aún no ha bajado a la mitad (ya contado)
+    bool wantWrite;                // EPOLLOUT activo
+    bool dirty;                    // en la lista de vaciado de este ciclo
+    bool closing;                  // cerrar en cuanto out quede vacío
+    bool moving;                   // su socket pasa a otra conexión (reactorResume)
+    bool paused;                   // la sesión no acepta tramas: no se lee el socket (reactorPauseRead)
+    int version;                   // versión del protocolo acordada (elige la trama en frame_versions_t)
+    bool compressed;               // acordó compresión (recibe las variantes comprimidas)
+    // Reanudación de sesión (solo si resumable)
+    bool resumable;
+    unsigned long long sentOffset; // bytes de tramas numeradas ya escritos: la secuencia
+    std::deque<frame_ptr_t> ring;  // últimas tramas escritas, por si hay que reenviarlas
+    unsigned long long ringStart;  // secuencia en la que empieza ring.front()
+    size_t ringBytes;
+    long long detachedSince;       // ms en que perdió el socket (-1 si lo tiene)
+    // Solo con io_uring
+    unsigned socketGen;                 // cambia con cada socket: descarta terminaciones viejas
+    bool recvArmed;                     // hay una recepción pendiente en el anillo
+    bool recvMultishot;                 // false si el kernel no admite recepción multishot
+    std::unique_ptr<uring_send_t> send; // envío en curso (o el anterior, que se reutiliza)
+    bool sending;
+    size_t inflight;                    // tramas al principio de out que van en el envío en curso
+    std::function<void()> afterRecv;    // al terminar la recepción (reanudación en curso)
+    std::function<void()> onDrained;    // cuando outBytes baje de drainBelow (reactorWaitDrain)
+    size_t drainBelow;
+    std::unique_ptr<reactor_shm_t> shm; // salida por memoria compartida (o nullptr)
+} reactor_conn_t;
+
+typedef struct reactor_loop_t
+{
+    int index;
+    int epollFD;
+    int wakeFD;
+    int listenFD;         // socket de escucha propio (-1 si no acepta)
+    int localFD;          // socket de escucha local AF_UNIX (-1 si no acepta)
+    unsigned int nextSeq; // contador local de conexiones (modo shards)
+    int cpu;              // núcleo al que se fija el hilo (-1 sin afinidad)
+    std::thread *thread;
+    std::mutex inbox_mutex;
+    std::vector<std::function<void()>> inbox;
+    std::unordered_map<int, reactor_conn_t *> conns;
+    std::unordered_map<int, reactor_conn_t *> overloaded; // colas por encima del límite (política DISCONNECT)
+    std::unordered_map<int, reactor_conn_t *> detached;   // sesiones sin socket esperando al cliente
+    std::vector<int> dirty;                               // conexiones con tramas nuevas sin vaciar
+    uring_t ring;                                         // solo con REACTOR_BACKEND_URING
+    uint64_t wakeValue;                                   // destino de la lectura del eventfd
+    bool acceptMultishot;                                 // false si el kernel no la admite
+} reactor_loop_t;
+
+static std::vector<reactor_loop_t *> loops;
+static reactor_callbacks_t callbacks;
+static bool sharded = false;
+static reactor_backend_t backend = REACTOR_BACKEND_EPOLL;
+static std::atomic<unsigned int> acceptCounter(0);
+static int localListenFD = -1;
+static thread_local reactor_loop_t *currentLoop = nullptr;
+
+static queue_limits_t queueLimits = {4 * 1024 * 1024, 10000, QUEUE_DROP_NON_PRIVATE, 5000};
+static std::atomic<unsigned long long> statOverflows(0);
+static std::atomic<unsigned long long> statDroppedOldest(0);
+static std::atomic<unsigned long long> statDroppedNonPrivate(0);
+static std::atomic<unsigned long long> statSlowDisconnects(0);
+
+static long long resumeMs = 0; // 0: sin reanudación
+static size_t resumeRingBytes = 1024 * 1024;
+
+// Anillo de cada bucle con io_uring: entradas de envío y buffers de recepción
+// (el número de buffers tiene que ser potencia de 2)
+static const unsigned URING_ENTRIES = 1024;
+static const unsigned URING_BUFFERS = 512;
+static const unsigned URING_BUFFER_SIZE = 8 * 1024;
+
+// user_data de las peticiones: la operación en los 3 bits bajos y, encima, la
+// conexión y la generación de su socket (los envíos llevan su uring_send_t)
+typedef enum uring_op_t
+{
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_WAKE,
+    URING_OP_CANCEL,
+    URING_OP_SPACE // espera de hueco en un anillo: lleva su reactor_shm_t
+} uring_op_t;
+
+static const uint64_t URING_OP_MASK = 7;
+static const unsigned URING_GEN_MASK = 0x1fffffff;
+
+static uint64_t uringTag(uring_op_t op, int connID = 0, unsigned gen = 0)
+{
+    return ((uint64_t)(uint32_t)connID << 32) | ((uint64_t)(gen & URING_GEN_MASK) << 3) | op;
+}
+
+static long long nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// El identificador codifica el bucle dueño: id % numLoops
+static reactor_loop_t *loopOf(int connID)
+{
+    return loops[connID % loops.size()];
+}
+
+static void post(reactor_loop_t *loop, std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(loop->inbox_mutex);
+        loop->inbox.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    write(loop->wakeFD, &one, sizeof(one));
+}
+
+static void setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void updateEvents(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    // Una conexión que se cierra o está en pausa no lee: si siguiera pidiendo
+    // EPOLLIN (por nivel), los bytes sin leer o el cierre de escritura del
+    // cliente despertarían al bucle en cada vuelta
+    struct epoll_event ev;
+    ev.events = conn->closing || conn->paused ? 0u : (uint32_t)(EPOLLIN | EPOLLRDHUP);
+    if (conn->wantWrite)
+        ev.events |= EPOLLOUT;
+    ev.data.u64 = (uint64_t)conn->id;
+    epoll_ctl(loop->epollFD, EPOLL_CTL_MOD, conn->socket, &ev);
+}
+
+static void armRecv(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (sqe == nullptr)
+    {
+        LOG_ERROR("reactor -- anillo lleno: la conexión %d deja de recibir", conn->id);
+        return;
+    }
+    uringPrepRecv(sqe, conn->socket, conn->recvMultishot);
+    sqe->user_data = uringTag(URING_OP_RECV, conn->id, conn->socketGen);
+    conn->recvArmed = true;
+}
+
+static void cancelOp(reactor_loop_t *loop, uint64_t userData)
+{
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (sqe == nullptr)
+        return;
+    uringPrepCancel(sqe, userData);
+    sqe->user_data = uringTag(URING_OP_CANCEL);
+}
+
+// El envío en curso deja de ser de la conexión: sus tramas siguen en out (sin
+// contar como escritas) y el uring_send_t se libera cuando termine
+static void orphanSend(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    if (!conn->sending)
+        return;
+    cancelOp(loop, (uint64_t)conn->send.get() | URING_OP_SEND);
+    conn->send.release();
+    conn->sending = false;
+    conn->inflight = 0;
+}
+
+// Empieza a vigilar el socket de la conexión (uno nuevo o el de una sesión reanudada)
+static void watchSocket(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    if (backend == REACTOR_BACKEND_URING)
+    {
+        conn->socketGen++;
+        if (!conn->paused)
+            armRecv(loop, conn);
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = conn->paused ? 0u : (uint32_t)(EPOLLIN | EPOLLRDHUP);
+    ev.data.u64 = (uint64_t)conn->id;
+    epoll_ctl(loop->epollFD, EPOLL_CTL_ADD, conn->socket, &ev);
+}
+
+// Deja de vigilar el socket sin cerrarlo. Con io_uring hay que cancelar lo que
+// quede en el anillo: mientras una petición siga viva el kernel mantiene el
+// socket abierto aunque se haga close.
+static void unwatchSocket(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    if (backend == REACTOR_BACKEND_EPOLL)
+    {
+        epoll_ctl(loop->epollFD, EPOLL_CTL_DEL, conn->socket, nullptr);
+        return;
+    }
+    if (conn->recvArmed)
+        cancelOp(loop, uringTag(URING_OP_RECV, conn->id, conn->socketGen));
+    conn->recvArmed = false;
+    orphanSend(loop, conn);
+    conn->socketGen++;
+}
+
+// Lo que sale de una cola de salida sin escribirse (descartes y cierres)
+static void countDequeued(long long frames, long long bytes)
+{
+    metricsAdd(METRIC_QUEUE_FRAMES, -frames);
+    metricsAdd(METRIC_QUEUE_BYTES, -bytes);
+}
+
+// El cliente lee lo que quedó en el anillo y ve el cierre. Con io_uring una
+// espera de hueco pendiente se cancela y el anillo se libera al terminar.
+static void releaseShm(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    reactor_shm_t *shm = conn->shm.get();
+    shmClose(shm->ring);
+    if (backend == REACTOR_BACKEND_EPOLL)
+        epoll_ctl(loop->epollFD, EPOLL_CTL_DEL, shm->ring.spaceFD, nullptr);
+    else if (shm->waiting)
+    {
+        cancelOp(loop, (uint64_t)shm | URING_OP_SPACE);
+        conn->shm.release();
+        return;
+    }
+    conn->shm.reset();
+}
+
+static void destroyConn(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    countDequeued(conn->out.size(), conn->outBytes);
+    metricsAdd(METRIC_CONNECTIONS_CLOSED);
+    loop->overloaded.erase(conn->id);
+    loop->detached.erase(conn->id);
+    if (conn->shm)
+        releaseShm(loop, conn);
+    if (conn->socket >= 0)
+    {
+        unwatchSocket(loop, conn);
+        close(conn->socket);
+    }
+    loop->conns.erase(conn->id);
+    int id = conn->id;
+    delete conn;
+    if (callbacks.onClose)
+        callbacks.onClose(id);
+}
+
+// Una sesión reanudable que pierde el socket se conserva (sin él) hasta que el
+// cliente vuelva o pase resumeMs; el resto de conexiones se destruyen
+static bool canDetach(reactor_conn_t *conn)
+{
+    return conn->resumable && !conn->closing && resumeMs > 0;
+}
+
+static void detachConn(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    unwatchSocket(loop, conn);
+    close(conn->socket);
+    conn->socket = -1;
+    conn->wantWrite = false;
+    conn->detachedSince = nowMs();
+    loop->detached[conn->id] = conn;
+}
+
+static void closeOrDetach(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    if (canDetach(conn))
+        detachConn(loop, conn);
+    else
+        destroyConn(loop, conn);
+}
+
+// Anota una trama numerada ya escrita entera y recorta el anillo a su límite
+static void recordSent(reactor_conn_t *conn, const frame_ptr_t &frame)
+{
+    size_t size = frame->bytes.size();
+    conn->sentOffset += size;
+    conn->ring.push_back(frame);
+    conn->ringBytes += size;
+    while (conn->ringBytes > resumeRingBytes)
+    {
+        size_t oldest = conn->ring.front()->bytes.size();
+        conn->ringBytes -= oldest;
+        conn->ringStart += oldest;
+        conn->ring.pop_front();
+    }
+}
+
+// Tramas como máximo por writev (el kernel no admite más de IOV_MAX)
+static const int MAX_IOV = IOV_MAX < 256 ? IOV_MAX : 256;
+
+// Saca de out las tramas ya escritas por completo y avanza en la parcial
+static void consumeWritten(reactor_conn_t *conn, size_t written)
+{
+    while (written > 0)
+    {
+        size_t frameLeft = conn->out.front()->bytes.size() - conn->outOffset;
+        if (written < frameLeft)
+        {
+            conn->outOffset += written;
+            break;
+        }
+        written -= frameLeft;
+        const frame_ptr_t &sent = conn->out.front();
+        if (conn->shm && sent == conn->shm->announce)
+            conn->shm->announce = nullptr; // lo que sigue ya va por el anillo
+        metricsCountOut(sent->type, sent->bytes.size());
+        countDequeued(1, sent->bytes.size());
+        conn->outBytes -= sent->bytes.size();
+        if (conn->resumable && sent->sequenced)
+            recordSent(conn, sent);
+        conn->out.pop_front();
+        conn->outOffset = 0;
+    }
+}
+
+// Tras escribir: fuera del periodo de gracia si la cola ha vuelto por debajo
+// del límite, y aviso a quien espera a que se vacíe (se encola para no
+// reanudar la lógica de sesión en mitad del vaciado)
+static void checkRecovered(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    if (conn->overSince >= 0 && conn->outBytes <= queueLimits.maxBytes &&
+        conn->out.size() <= queueLimits.maxFrames)
+    {
+        conn->overSince = -1;
+        loop->overloaded.erase(conn->id);
+    }
+    // Tras descartar la cola se queda justo en el límite: el desbordamiento
+    // solo acaba cuando el cliente ha vaciado la mitad
+    if (conn->overflowed && conn->outBytes <= queueLimits.maxBytes / 2 &&
+        conn->out.size() <= queueLimits.maxFrames / 2)
+        conn->overflowed = false;
+    if (conn->onDrained && conn->outBytes <= conn->drainBelow)
+    {
+        post(loop, std::move(conn->onDrained));
+        conn->onDrained = nullptr;
+    }
+}
+
+// Prepara en iov las tramas de out a partir de outOffset. El anuncio del anillo
+// sale solo (lleva los descriptores) y lo que va detrás ya no es para el
+// socket, así que el lote se corta antes del anuncio o, si ya salió en parte,
+// justo después.
+static int gatherOut(reactor_conn_t *conn, struct iovec *iov, int maxIov)
+{
+    const frame_ptr_t *announce = conn->shm && conn->shm->announce ? &conn->shm->announce : nullptr;
+    int iovcnt = 0;
+    size_t offset = conn->outOffset;
+    for (auto it = conn->out.begin(); it != conn->out.end() && iovcnt < maxIov; ++it)
+    {
+        bool isAnnounce = announce && *it == *announce;
+        if (isAnnounce && offset == 0)
+            break;
+        const std::vector<unsigned char> &bytes = (*it)->bytes;
+        iov[iovcnt].iov_base = (void *)(bytes.data() + offset);
+        iov[iovcnt].iov_len = bytes.size() - offset;
+        iovcnt++;
+        offset = 0;
+        if (isAnnounce)
+            break;
+    }
+    return iovcnt;
+}
+
+// Con io_uring: prepara un sendmsg con lo encolado (como mucho uno en curso por
+// conexión). Sale en el siguiente uringWait junto a los de las demás conexiones
+// del ciclo, así que un broadcast entero cuesta una sola llamada al sistema.
+static bool submitSend(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    if (conn->sending || conn->out.empty())
+        return true;
+    if (!conn->send)
+    {
+        conn->send.reset(new uring_send_t());
+        conn->send->connID = conn->id;
+    }
+    uring_send_t *send = conn->send.get();
+    send->iov.resize(MAX_IOV);
+    send->iov.resize(gatherOut(conn, send->iov.data(), MAX_IOV));
+    if (send->iov.empty())
+        return true; // solo queda el anuncio del anillo
+    send->frames.assign(conn->out.begin(), conn->out.begin() + send->iov.size());
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_iov = send->iov.data();
+    send->msg.msg_iovlen = send->iov.size();
+
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (sqe == nullptr)
+        return false;
+    uringPrepSendmsg(sqe, conn->socket, &send->msg);
+    sqe->user_data = (uint64_t)send | URING_OP_SEND;
+    conn->sending = true;
+    conn->inflight = send->frames.size();
+    return true;
+}
+
+static bool flushConn(reactor_loop_t *loop, reactor_conn_t *conn);
+
+// Con io_uring la espera de hueco es una lectura de spaceFD en el anillo; con
+// epoll spaceFD está siempre vigilado (ver reactorEnableShm)
+static void armSpace(reactor_loop_t *loop, reactor_shm_t *shm)
+{
+    shm->waiting = true;
+    if (backend == REACTOR_BACKEND_EPOLL)
+        return;
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (sqe == nullptr)
+    {
+        LOG_ERROR("reactor -- anillo lleno: la conexión %d deja de escribir", shm->connID);
+        return;
+    }
+    uringPrepRead(sqe, shm->ring.spaceFD, &shm->spaceValue, sizeof(shm->spaceValue));
+    sqe->user_data = (uint64_t)shm | URING_OP_SPACE;
+}
+
+// Copia al anillo todo lo que quepa de out y despierta al cliente una sola vez.
+// Si se llena, espera a spaceFD; lo que no cupo sigue en out con las mismas
+// políticas de consumidor lento que un socket. Devuelve false si el cliente
+// corrompió el anillo.
+static bool flushShm(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    reactor_shm_t *shm = conn->shm.get();
+    if (shm->waiting)
+        return true;
+    struct iovec iov[MAX_IOV];
+    bool wrote = false;
+    while (!conn->out.empty())
+    {
+        int iovcnt = gatherOut(conn, iov, MAX_IOV);
+        ssize_t n = shmWrite(shm->ring, iov, iovcnt);
+        if (n < 0)
+        {
+            LOG_WARN("reactor -- la conexión %d dejó su anillo en un estado imposible", conn->id);
+            return false;
+        }
+        if (n == 0)
+        {
+            if (shmWaitSpace(shm->ring))
+            {
+                armSpace(loop, shm);
+                break;
+            }
+            continue; // el cliente leyó mientras tanto
+        }
+        consumeWritten(conn, n);
+        wrote = true;
+    }
+    if (wrote)
+        shmWakeReader(shm->ring);
+    checkRecovered(loop, conn);
+    return true;
+}
+
+// Envía el anuncio del anillo con sus descriptores (SCM_RIGHTS) y pasa la
+// conexión al anillo. Si el socket está lleno se reintenta cuando admita más.
+static bool flushAnnounce(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    reactor_shm_t *shm = conn->shm.get();
+    const std::vector<unsigned char> &bytes = shm->announce->bytes;
+    struct iovec iov = {(void *)bytes.data(), bytes.size()};
+    int fds[3] = {shm->ring.memFD, shm->ring.dataFD, shm->ring.spaceFD};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t n = sendmsg(conn->socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return false;
+        if (backend == REACTOR_BACKEND_URING)
+        {
+            // Sin EPOLLOUT: se reintenta en el siguiente ciclo (ver loopTimeout)
+            conn->dirty = true;
+            loop->dirty.push_back(conn->id);
+        }
+        else if (!conn->wantWrite)
+        {
+            conn->wantWrite = true;
+            updateEvents(loop, conn);
+        }
+        return true;
+    }
+    consumeWritten(conn, n);
+    if (conn->wantWrite)
+    {
+        conn->wantWrite = false;
+        updateEvents(loop, conn);
+    }
+    // Si salió en parte, el resto va por el socket como cualquier trama
+    return flushConn(loop, conn);
+}
+
+// Escribe todo lo que admita el socket con writev, juntando en una sola llamada
+// todas las tramas encoladas. Si la escritura es parcial se retoma desde
+// outOffset en la siguiente. Devuelve false si la conexión murió.
+static bool flushConn(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    if (conn->socket < 0)
+        return true; // desenganchada: las tramas esperan en la cola
+    if (conn->shm)
+    {
+        if (!conn->shm->announce)
+            return flushShm(loop, conn);
+        if (!conn->sending && conn->outOffset == 0 && !conn->out.empty() &&
+            conn->out.front() == conn->shm->announce)
+            return flushAnnounce(loop, conn);
+    }
+    if (backend == REACTOR_BACKEND_URING)
+        return submitSend(loop, conn);
+    struct iovec iov[MAX_IOV];
+    while (!conn->out.empty())
+    {
+        int iovcnt = gatherOut(conn, iov, MAX_IOV);
+        if (iovcnt == 0)
+            return flushConn(loop, conn); // le toca al anuncio del anillo
+
+        ssize_t n = writev(conn->socket, iov, iovcnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+
+        consumeWritten(conn, n);
+        if (conn->outOffset > 0)
+            break; // escritura parcial: el socket está lleno
+    }
+
+    checkRecovered(loop, conn);
+
+    bool pending = !conn->out.empty();
+    if (pending != conn->wantWrite)
+    {
+        conn->wantWrite = pending;
+        updateEvents(loop, conn);
+    }
+    return true;
+}
+
+static bool overLimits(reactor_conn_t *conn)
+{
+    return conn->outBytes > queueLimits.maxBytes || conn->out.size() > queueLimits.maxFrames;
+}
+
+// Corta la conexión sin destruirla: el bucle verá el cierre en el socket (o, si
+// ya estaba desenganchada, en la siguiente revisión de checkDetached)
+static void abortConn(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    orphanSend(loop, conn);
+    countDequeued(conn->out.size(), conn->outBytes);
+    conn->out.clear();
+    conn->outOffset = 0;
+    conn->outBytes = 0;
+    if (conn->socket >= 0)
+        shutdown(conn->socket, SHUT_RDWR);
+    else
+        conn->closing = true;
+}
+
+// Descarta tramas empezando por la más antigua. La primera no se puede tocar
+// si ya se ha escrito en parte, ni las de un envío en curso (io_uring). Si
+// onlyNonPriority, respeta privados y avisos.
+static void dropFrames(reactor_conn_t *conn, bool onlyNonPriority)
+{
+    // Ni las que van en un envío en curso ni la ya escrita en parte
+    size_t busy = std::max(conn->inflight, conn->outOffset > 0 ? (size_t)1 : (size_t)0);
+    auto it = conn->out.begin() + std::min(busy, conn->out.size());
+    while (it != conn->out.end() && overLimits(conn))
+    {
+        if ((onlyNonPriority && (*it)->priority) || (conn->shm && *it == conn->shm->announce))
+        {
+            ++it;
+            continue;
+        }
+        conn->outBytes -= (*it)->bytes.size();
+        countDequeued(1, (*it)->bytes.size());
+        it = conn->out.erase(it);
+        if (onlyNonPriority)
+            statDroppedNonPrivate++;
+        else
+            statDroppedOldest++;
+    }
+}
+
+// Aplica la política de consumidor lento a una cola que ha superado su límite
+static void applyQueuePolicy(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    // Se cuenta cada vez que la conexión pasa del límite, no cada trama que
+    // se le encola ni cada revisión de checkOverloaded mientras sigue por encima
+    if (!conn->overflowed)
+    {
+        conn->overflowed = true;
+        statOverflows++;
+    }
+    switch (queueLimits.policy)
+    {
+    case QUEUE_DROP_OLDEST:
+        dropFrames(conn, false);
+        break;
+    case QUEUE_DROP_NON_PRIVATE:
+        dropFrames(conn, true);
+        break;
+    case QUEUE_DISCONNECT:
+        break;
+    }
+
+    // Si solo quedan tramas que no se pueden descartar (o la política es
+    // DISCONNECT) se da un periodo de gracia antes de cortar la conexión
+    if (!overLimits(conn))
+        return;
+    if (conn->overSince < 0)
+    {
+        conn->overSince = nowMs();
+        loop->overloaded[conn->id] = conn;
+    }
+    else if (nowMs() - conn->overSince >= queueLimits.graceMs)
+    {
+        statSlowDisconnects++;
+        LOG_WARN("reactor -- conexión %d desconectada por consumidor lento (%zu bytes pendientes)",
+               conn->id, conn->outBytes);
+        loop->overloaded.erase(conn->id);
+        conn->closing = true; // un consumidor lento no puede reanudar la sesión
+        abortConn(loop, conn);
+    }
+}
+
+// Revisa las colas que siguen por encima del límite tras el periodo de gracia
+static void checkOverloaded(reactor_loop_t *loop)
+{
+    std::vector<reactor_conn_t *> pending;
+    for (auto &entry : loop->overloaded)
+        pending.push_back(entry.second);
+    for (reactor_conn_t *conn : pending)
+    {
+        if (overLimits(conn))
+            applyQueuePolicy(loop, conn);
+        else
+            loop->overloaded.erase(conn->id);
+    }
+}
+
+// No escribe: marca la conexión para vaciarla al final del ciclo del bucle, así
+// todas las tramas que le lleguen en el mismo ciclo salen en un único writev.
+// Nunca destruye la conexión de forma síncrona (se llama desde la lógica de sesión).
+static void queueFrame(reactor_loop_t *loop, reactor_conn_t *conn, const frame_ptr_t &frame)
+{
+    conn->out.push_back(frame);
+    conn->outBytes += frame->bytes.size();
+    metricsAdd(METRIC_QUEUE_FRAMES);
+    metricsAdd(METRIC_QUEUE_BYTES, frame->bytes.size());
+    metricsRecord(METRIC_HIST_QUEUE_BYTES, conn->outBytes);
+    if (!conn->wantWrite && !conn->dirty)
+    {
+        conn->dirty = true;
+        loop->dirty.push_back(conn->id);
+    }
+    if (overLimits(conn))
+        applyQueuePolicy(loop, conn);
+}
+
+// Vacía las conexiones que recibieron tramas durante el ciclo. Si el socket
+// falla se hace shutdown y el bucle verá el cierre.
+static void flushDirty(reactor_loop_t *loop)
+{
+    std::vector<int> dirty;
+    dirty.swap(loop->dirty);
+    for (int connID : dirty)
+    {
+        auto it = loop->conns.find(connID);
+        if (it == loop->conns.end())
+            continue;
+        reactor_conn_t *conn = it->second;
+        conn->dirty = false;
+        if (conn->wantWrite)
+            continue; // ya espera EPOLLOUT
+        if (!flushConn(loop, conn))
+        {
+            if (canDetach(conn))
+                detachConn(loop, conn);
+            else
+                abortConn(loop, conn);
+        }
+        else if (conn->closing && conn->out.empty())
+            destroyConn(loop, conn);
+    }
+}
+
+// Entrega a la lógica de sesión todas las tramas completas ya recibidas. Las
+// tramas son vistas sobre el buffer de recepción: no se copian.
+static bool parseFrames(reactor_conn_t *conn)
+{
+    msg_cursor_t frame;
+    while (!conn->closing && !conn->moving && !conn->paused && conn->reader.next(frame))
+        callbacks.onFrame(conn->id, frame);
+
+    if (conn->reader.bad)
+    {
+        LOG_WARN("reactor -- conexión %d envió una trama con longitud inválida", conn->id);
+        return false;
+    }
+    return true;
+}
+
+static void handleReadable(reactor_loop_t *loop, reactor_conn_t *conn)
+{
+    // Cada read() llena el buffer todo lo posible y puede traer muchas tramas.
+    // Se limita el número de lecturas por evento para no acaparar el bucle.
+    for (int reads = 0; reads < 8 && !conn->closing && !conn->moving && !conn->paused; reads++)
+    {
+        ssize_t n = conn->reader.fill(conn->socket);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+        {
+            // n == 0 (cierre del cliente) o error
+            closeOrDetach(loop, conn);
+            return;
+        }
+
+        if (!parseFrames(conn))
+        {
+            destroyConn(loop, conn);
+            return;
+        }
+        // read() devolvió menos de lo que cabía: el socket ya está vacío
+        if (conn->reader.tail < conn->reader.buf.size())
+            break;
+    }
+
+    if (conn->closing && conn->out.empty())
+        destroyConn(loop, conn);
+}
+
+static void addConn(reactor_loop_t *loop, int socket, int connID)
+{
+    // Las tramas ya se agrupan en cada writev: Nagle solo añadiría retardo (en
+    // un socket local la opción no existe y simplemente falla)
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    reactor_conn_t *conn = new reactor_conn_t();
+    conn->id = connID;
+    conn->socket = socket;
+    conn->outOffset = 0;
+    conn->outBytes = 0;
+    conn->overSince = -1;
+    conn->overflowed = false;
+    conn->wantWrite = false;
+    conn->dirty = false;
+    conn->closing = false;
+    conn->moving = false;
+    conn->paused = false;
+    conn->version = PROTOCOL_V1;
+    conn->compressed = false;
+    conn->resumable = false;
+    conn->sentOffset = 0;
+    conn->ringStart = 0;
+    conn->ringBytes = 0;
+    conn->detachedSince = -1;
+    conn->socketGen = 0;
+    conn->recvArmed = false;
+    conn->recvMultishot = true;
+    conn->sending = false;
+    conn->inflight = 0;
+    conn->drainBelow = 0;
+    loop->conns[connID] = conn;
+    metricsAdd(METRIC_CONNECTIONS_OPENED);
+    watchSocket(loop, conn);
+
+    if (callbacks.onOpen)
+        callbacks.onOpen(connID);
+}
+
+// Asigna id y bucle dueño a un socket recién aceptado
+static void dispatchAccepted(reactor_loop_t *loop, int newSocket)
+{
+    // En modo shards la conexión se queda en el bucle que la aceptó; si no,
+    // reparto round-robin. En ambos casos el id determina el bucle dueño.
+    int connID;
+    if (sharded)
+        connID = (int)(loop->nextSeq++ * loops.size() + loop->index);
+    else
+        connID = (int)acceptCounter.fetch_add(1);
+    reactor_loop_t *owner = loopOf(connID);
+    if (owner == loop)
+        addConn(loop, newSocket, connID);
+    else
+        post(owner, [owner, newSocket, connID]()
+             { addConn(owner, newSocket, connID); });
+}
+
+static void acceptAll(reactor_loop_t *loop, int listenFD)
+{
+    while (true)
+    {
+        int newSocket = accept4(listenFD, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newSocket < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("reactor -- accept: %s", strerror(errno));
+            return;
+        }
+        dispatchAccepted(loop, newSocket);
+    }
+}
+
+static void drainInbox(reactor_loop_t *loop)
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(loop->inbox_mutex);
+        tasks.swap(loop->inbox);
+    }
+    for (auto &task : tasks)
+        task();
+}
+
+static void runInbox(reactor_loop_t *loop)
+{
+    uint64_t value;
+    read(loop->wakeFD, &value, sizeof(value));
+    drainInbox(loop);
+}
+
+// Destruye las sesiones desenganchadas cuyo cliente no ha vuelto a tiempo
+static void checkDetached(reactor_loop_t *loop)
+{
+    long long now = nowMs();
+    std::vector<reactor_conn_t *> expired;
+    for (auto &entry : loop->detached)
+        if (entry.second->closing || now - entry.second->detachedSince >= resumeMs)
+            expired.push_back(entry.second);
+    for (reactor_conn_t *conn : expired)
+        destroyConn(loop, conn);
+}
+
+static const uint64_t LISTEN_TAG = (uint64_t)-1;
+static const uint64_t WAKE_TAG = (uint64_t)-2;
+static const uint64_t LOCAL_LISTEN_TAG = (uint64_t)-3;
+// spaceFD del anillo de una conexión: este bit y el id en los 32 bajos
+static const uint64_t SHM_SPACE_TAG = 1ull << 32;
+
+// Solo hace falta despertar periódicamente si hay colas en periodo de gracia,
+// sesiones desenganchadas que pueden caducar o envíos que reintentar
+static int loopTimeout(reactor_loop_t *loop)
+{
+    if (!loop->dirty.empty())
+        return 10; // anuncio de anillo pendiente con io_uring (flushAnnounce)
+    return !loop->overloaded.empty() ? 100 : !loop->detached.empty() ? 1000 : -1;
+}
+
+// ============================================================================
+// Bucle con io_uring
+// ============================================================================
+
+// Las aceptaciones del socket local llevan 1 en el campo de la conexión
+static void armAccept(reactor_loop_t *loop, bool local)
+{
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (sqe == nullptr)
+        return;
+    uringPrepAccept(sqe, local ? loop->localFD : loop->listenFD, loop->acceptMultishot);
+    sqe->user_data = uringTag(URING_OP_ACCEPT, local ? 1 : 0);
+}
+
+static void armWake(reactor_loop_t *loop)
+{
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (sqe == nullptr)
+        return;
+    uringPrepRead(sqe, loop->wakeFD, &loop->wakeValue, sizeof(loop->wakeValue));
+    sqe->user_data = uringTag(URING_OP_WAKE);
+}
+
+// Una aceptación multishot sigue viva mientras traiga IORING_CQE_F_MORE; si el
+// kernel no la admite (EINVAL) se pasa a pedir una por vez
+static void handleAccepted(reactor_loop_t *loop, int res, bool more, bool local)
+{
+    if (res >= 0)
+        dispatchAccepted(loop, res);
+    else if (res == -EINVAL && loop->acceptMultishot)
+        loop->acceptMultishot = false;
+    else
+    {
+        LOG_ERROR("reactor -- accept: %s", strerror(-res));
+        if (res == -EINVAL || res == -EBADF)
+            return;
+    }
+    if (!more)
+        armAccept(loop, local);
+}
+
+// Recepción multishot: cada terminación trae un buffer del grupo, que se copia
+// al lector de la conexión y se devuelve enseguida
+static void handleReceived(reactor_loop_t *loop, const struct io_uring_cqe &cqe)
+{
+    int connID = (int)(cqe.user_data >> 32);
+    unsigned gen = (cqe.user_data >> 3) & URING_GEN_MASK;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+    unsigned bufferID = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+    auto it = loop->conns.find(connID);
+    reactor_conn_t *conn = it == loop->conns.end() ? nullptr : it->second;
+    if (conn == nullptr || conn->socket < 0 || (conn->socketGen & URING_GEN_MASK) != gen)
+    {
+        // Terminación de un socket que ya no es de la conexión
+        if (hasBuffer)
+            uringRecycle(loop->ring, bufferID);
+        return;
+    }
+    if (hasBuffer)
+    {
+        if (cqe.res > 0 && !conn->closing)
+            conn->reader.append(uringBuffer(loop->ring, bufferID), cqe.res);
+        uringRecycle(loop->ring, bufferID);
+    }
+    if (!more)
+        conn->recvArmed = false;
+
+    if (cqe.res > 0 && !parseFrames(conn))
+    {
+        destroyConn(loop, conn);
+        return;
+    }
+    if (conn->moving)
+    {
+        // Lo recibido se queda en el lector; el socket cambia de dueño cuando
+        // termine la recepción cancelada
+        if (!conn->recvArmed && conn->afterRecv)
+        {
+            std::function<void()> next = std::move(conn->afterRecv);
+            next();
+        }
+        return;
+    }
+
+    if (!more && cqe.res == -ECANCELED)
+    {
+        // La canceló reactorPauseRead; si ya se reanudó, se vuelve a pedir
+        if (!conn->paused && !conn->closing)
+            armRecv(loop, conn);
+        return;
+    }
+    if (!more)
+    {
+        bool unsupported = cqe.res == -EINVAL && conn->recvMultishot;
+        if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && !unsupported))
+        {
+            // cerrado por el cliente o error
+            closeOrDetach(loop, conn);
+            return;
+        }
+        if (unsupported)
+            conn->recvMultishot = false;
+        if (!conn->paused)
+            armRecv(loop, conn);
+    }
+    if (conn->closing && conn->out.empty())
+        destroyConn(loop, conn);
+}
+
+static void handleSent(reactor_loop_t *loop, uring_send_t *send, int res)
+{
+    auto it = loop->conns.find(send->connID);
+    if (it == loop->conns.end() || it->second->send.get() != send)
+    {
+        delete send; // huérfano
+        return;
+    }
+    reactor_conn_t *conn = it->second;
+    conn->sending = false;
+    conn->inflight = 0;
+    send->frames.clear();
+    if (res < 0 && res != -EINTR && res != -EAGAIN)
+    {
+        closeOrDetach(loop, conn);
+        return;
+    }
+    if (res > 0)
+        consumeWritten(conn, res);
+    checkRecovered(loop, conn);
+    if (conn->closing && conn->out.empty())
+    {
+        destroyConn(loop, conn);
+        return;
+    }
+    // Lo que quedó sin escribir o llegó durante el envío
+    if (!flushConn(loop, conn))
+        abortConn(loop, conn);
+}
+
+// Hay hueco en el anillo de una conexión local (o se canceló la espera)
+static void handleSpace(reactor_loop_t *loop, reactor_shm_t *shm)
+{
+    auto it = loop->conns.find(shm->connID);
+    if (it == loop->conns.end() || it->second->shm.get() != shm)
+    {
+        delete shm; // huérfano
+        return;
+    }
+    reactor_conn_t *conn = it->second;
+    shm->waiting = false;
+    if (!flushConn(loop, conn))
+        abortConn(loop, conn);
+    else if (conn->closing && conn->out.empty())
+        destroyConn(loop, conn);
+}
+
+static void handleCompletion(reactor_loop_t *loop, const struct io_uring_cqe &cqe)
+{
+    switch (cqe.user_data & URING_OP_MASK)
+    {
+    case URING_OP_ACCEPT:
+        handleAccepted(loop, cqe.res, cqe.flags & IORING_CQE_F_MORE, (cqe.user_data >> 32) == 1);
+        break;
+    case URING_OP_RECV:
+        handleReceived(loop, cqe);
+        break;
+    case URING_OP_SEND:
+        handleSent(loop, (uring_send_t *)(cqe.user_data & ~URING_OP_MASK), cqe.res);
+        break;
+    case URING_OP_WAKE:
+        drainInbox(loop);
+        armWake(loop);
+        break;
+    case URING_OP_SPACE:
+        handleSpace(loop, (reactor_shm_t *)(cqe.user_data & ~URING_OP_MASK));
+        break;
+    default:
+        break; // cancelaciones
+    }
+}
+
+// Cada vuelta es una única llamada al sistema: envía las recepciones y envíos
+// preparados en la anterior y espera las terminaciones siguientes
+static void runUringLoop(reactor_loop_t *loop)
+{
+    armWake(loop);
+    if (loop->listenFD >= 0)
+        armAccept(loop, false);
+    if (loop->localFD >= 0)
+        armAccept(loop, true);
+
+    while (true)
+    {
+        if (!uringWait(loop->ring, loopTimeout(loop)))
+            break;
+        if (!loop->overloaded.empty())
+            checkOverloaded(loop);
+        if (!loop->detached.empty())
+            checkDetached(loop);
+
+        struct io_uring_cqe *next;
+        while ((next = uringPeek(loop->ring)) != nullptr)
+        {
+            struct io_uring_cqe cqe = *next;
+            uringSeen(loop->ring);
+            handleCompletion(loop, cqe);
+        }
+
+        flushDirty(loop);
+    }
+}
+
+// ============================================================================
+// Bucle con epoll
+// ============================================================================
+
+static void runLoop(reactor_loop_t *loop)
+{
+    currentLoop = loop;
+    if (loop->cpu >= 0)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(loop->cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+            LOG_WARN("reactor -- no se pudo fijar el bucle %d al núcleo %d", loop->index, loop->cpu);
+    }
+    if (backend == REACTOR_BACKEND_URING)
+    {
+        runUringLoop(loop);
+        return;
+    }
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true)
+    {
+        int n = epoll_wait(loop->epollFD, events, MAX_EVENTS, loopTimeout(loop));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("reactor -- epoll_wait: %s", strerror(errno));
+            break;
+        }
+        if (!loop->overloaded.empty())
+            checkOverloaded(loop);
+        if (!loop->detached.empty())
+            checkDetached(loop);
+
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t tag = events[i].data.u64;
+            if (tag == LISTEN_TAG || tag == LOCAL_LISTEN_TAG)
+            {
+                acceptAll(loop, tag == LISTEN_TAG ? loop->listenFD : loop->localFD);
+                continue;
+            }
+            if (tag == WAKE_TAG)
+            {
+                runInbox(loop);
+                continue;
+            }
+            if (tag & SHM_SPACE_TAG)
+            {
+                // Flanco: no se lee el eventfd (lo comparte el cliente)
+                auto it = loop->conns.find((int)(uint32_t)tag);
+                if (it != loop->conns.end() && it->second->shm)
+                    handleSpace(loop, it->second->shm.get());
+                continue;
+            }
+
+            auto it = loop->conns.find((int)tag);
+            if (it == loop->conns.end())
+                continue; // cerrada por un evento anterior del mismo lote
+            reactor_conn_t *conn = it->second;
+            if (conn->socket < 0)
+                continue; // desenganchada por un evento anterior del mismo lote
+
+            if (events[i].events & EPOLLOUT)
+            {
+                if (!flushConn(loop, conn))
+                {
+                    closeOrDetach(loop, conn);
+                    continue;
+                }
+                if (conn->closing && conn->out.empty())
+                {
+                    destroyConn(loop, conn);
+                    continue;
+                }
+            }
+            if (conn->closing)
+            {
+                // Solo espera a vaciar la cola; EPOLLHUP/EPOLLERR llegan siempre
+                if ((events[i].events & (EPOLLHUP | EPOLLERR)) || conn->out.empty())
+                    destroyConn(loop, conn);
+                continue;
+            }
+            if (conn->paused)
+            {
+                if (events[i].events & (EPOLLHUP | EPOLLERR))
+                    closeOrDetach(loop, conn);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                handleReadable(loop, conn);
+        }
+
+        // Una sola escritura por conexión y ciclo, con todo lo acumulado
+        flushDirty(loop);
+    }
+}
+
+// Un anillo por bucle; si alguno falla no se usa io_uring en ninguno
+static bool createRings()
+{
+    for (size_t i = 0; i < loops.size(); i++)
+    {
+        if (!uringInit(loops[i]->ring, URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE))
+        {
+            for (size_t j = 0; j < i; j++)
+                uringDestroy(loops[j]->ring);
+            return false;
+        }
+        loops[i]->acceptMultishot = true;
+    }
+    return true;
+}
+
+static bool createLoops(int numLoops)
+{
+    for (int i = 0; i < numLoops; i++)
+    {
+        reactor_loop_t *loop = new reactor_loop_t();
+        loop->index = i;
+        loop->listenFD = -1;
+        loop->localFD = -1;
+        loop->nextSeq = 0;
+        loop->cpu = -1;
+        loop->epollFD = -1;
+        loops.push_back(loop);
+    }
+    if (backend == REACTOR_BACKEND_URING && !createRings())
+    {
+        LOG_WARN("reactor -- io_uring no disponible: se usa epoll");
+        backend = REACTOR_BACKEND_EPOLL;
+    }
+
+    for (reactor_loop_t *loop : loops)
+    {
+        // Con io_uring el eventfd se lee desde el anillo, que ya espera por él
+        int wakeFlags = EFD_CLOEXEC | (backend == REACTOR_BACKEND_EPOLL ? EFD_NONBLOCK : 0);
+        loop->wakeFD = eventfd(0, wakeFlags);
+        if (backend == REACTOR_BACKEND_EPOLL)
+            loop->epollFD = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->wakeFD < 0 || (backend == REACTOR_BACKEND_EPOLL && loop->epollFD < 0))
+        {
+            LOG_ERROR("reactor -- no se pudo crear el bucle %d", loop->index);
+            return false;
+        }
+        if (backend == REACTOR_BACKEND_URING)
+            continue;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = WAKE_TAG;
+        epoll_ctl(loop->epollFD, EPOLL_CTL_ADD, loop->wakeFD, &ev);
+    }
+    return true;
+}
+
+static void addListener(reactor_loop_t *loop, int listenFD, bool local = false)
+{
+    if (local)
+        loop->localFD = listenFD;
+    else
+        loop->listenFD = listenFD;
+    setNonBlocking(listenFD);
+    if (backend == REACTOR_BACKEND_URING)
+        return; // la aceptación la arma el propio bucle al arrancar
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = local ? LOCAL_LISTEN_TAG : LISTEN_TAG;
+    epoll_ctl(loop->epollFD, EPOLL_CTL_ADD, listenFD, &ev);
+}
+
+static void startThreads()
+{
+    for (auto loop : loops)
+        loop->thread = new std::thread(runLoop, loop);
+}
+
+bool reactorStart(int listenFD, int numLoops, reactor_callbacks_t cb)
+{
+    if (numLoops < 1)
+        numLoops = 1;
+    callbacks = cb;
+    sharded = false;
+    if (!createLoops(numLoops))
+        return false;
+
+    // El bucle 0 acepta y reparte las conexiones
+    addListener(loops[0], listenFD);
+    if (localListenFD >= 0)
+        addListener(loops[0], localListenFD, true);
+    startThreads();
+    return true;
+}
+
+bool reactorStartSharded(const std::vector<int> &listenFDs, reactor_callbacks_t cb)
+{
+    if (listenFDs.empty())
+        return false;
+    callbacks = cb;
+    sharded = true;
+    if (!createLoops(listenFDs.size()))
+        return false;
+
+    int numCPUs = std::thread::hardware_concurrency();
+    for (size_t i = 0; i < loops.size(); i++)
+    {
+        addListener(loops[i], listenFDs[i]);
+        if (numCPUs > 0)
+            loops[i]->cpu = i % numCPUs;
+    }
+    // Las conexiones locales se quedan en el bucle 0, como las que acepta él
+    if (localListenFD >= 0)
+        addListener(loops[0], localListenFD, true);
+    startThreads();
+    return true;
+}
+
+void reactorPostLoop(int loopIndex, std::function<void()> task)
+{
+    reactor_loop_t *loop = loops[loopIndex];
+    if (currentLoop == loop)
+        task();
+    else
+        post(loop, std::move(task));
+}
+
+void reactorPost(int connID, std::function<void()> task)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    if (currentLoop == loop)
+        task();
+    else
+        post(loop, std::move(task));
+}
+
+frame_ptr_t makeFrame(const std::vector<unsigned char> &payload, bool priority, int type)
+{
+    int dataLen = payload.size();
+    std::shared_ptr<frame_t> frame = std::make_shared<frame_t>();
+    frame->priority = priority;
+    frame->type = type;
+    frame->sequenced = true;
+    frame->bytes.resize(sizeof(int) + dataLen);
+    memcpy(frame->bytes.data(), &dataLen, sizeof(int));
+    memcpy(frame->bytes.data() + sizeof(int), payload.data(), dataLen);
+    return frame;
+}
+
+frame_ptr_t adoptFrame(std::vector<unsigned char> &&bytes, bool priority, int type)
+{
+    std::shared_ptr<frame_t> frame = std::make_shared<frame_t>();
+    frame->priority = priority;
+    frame->type = type;
+    frame->sequenced = true;
+    frame->bytes = std::move(bytes);
+    return frame;
+}
+
+frame_ptr_t adoptControlFrame(std::vector<unsigned char> &&bytes)
+{
+    std::shared_ptr<frame_t> frame = std::make_shared<frame_t>();
+    frame->priority = true;
+    frame->type = -1;
+    frame->sequenced = false;
+    frame->bytes = std::move(bytes);
+    return frame;
+}
+
+void reactorSendFrame(int connID, const frame_ptr_t &frame)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    if (currentLoop == loop)
+    {
+        auto it = loop->conns.find(connID);
+        if (it != loop->conns.end() && !it->second->closing)
+            queueFrame(loop, it->second, frame);
+        return;
+    }
+
+    post(loop, [loop, connID, frame]()
+         {
+             auto it = loop->conns.find(connID);
+             if (it != loop->conns.end() && !it->second->closing)
+                 queueFrame(loop, it->second, frame); });
+}
+
+void reactorSendFrame(int connID, const frame_versions_t &frames)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    auto deliver = [loop, connID, frames]()
+    {
+        auto it = loop->conns.find(connID);
+        if (it == loop->conns.end() || it->second->closing)
+            return;
+        const frame_ptr_t &frame = frames.of(it->second->version, it->second->compressed);
+        if (frame)
+            queueFrame(loop, it->second, frame);
+    };
+    if (currentLoop == loop)
+        deliver();
+    else
+        post(loop, deliver);
+}
+
+void reactorSendEncoded(int connID, std::function<frame_ptr_t(int version, bool compressed)> encode)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    auto deliver = [loop, connID, encode = std::move(encode)]()
+    {
+        auto it = loop->conns.find(connID);
+        if (it == loop->conns.end() || it->second->closing)
+            return;
+        frame_ptr_t frame = encode(it->second->version, it->second->compressed);
+        if (frame)
+            queueFrame(loop, it->second, frame);
+    };
+    if (currentLoop == loop)
+        deliver();
+    else
+        post(loop, std::move(deliver));
+}
+
+void reactorSetVersion(int connID, int version, bool compressed)
+{
+    auto it = loopOf(connID)->conns.find(connID);
+    if (it == loopOf(connID)->conns.end())
+        return;
+    it->second->version = version;
+    it->second->compressed = compressed;
+    it->second->reader.version = version;
+}
+
+void reactorSend(int connID, const std::vector<unsigned char> &data, bool priority)
+{
+    reactorSendFrame(connID, makeFrame(data, priority));
+}
+
+void reactorSetBackend(reactor_backend_t selected)
+{
+    backend = selected;
+}
+
+reactor_backend_t reactorBackend()
+{
+    return backend;
+}
+
+void reactorSetQueueLimits(queue_limits_t limits)
+{
+    queueLimits = limits;
+}
+
+queue_stats_t reactorGetQueueStats()
+{
+    queue_stats_t stats;
+    stats.overflows = statOverflows;
+    stats.droppedOldest = statDroppedOldest;
+    stats.droppedNonPrivate = statDroppedNonPrivate;
+    stats.slowDisconnects = statSlowDisconnects;
+    return stats;
+}
+
+static void destroyIfDone(reactor_loop_t *loop, int connID)
+{
+    auto it = loop->conns.find(connID);
+    if (it != loop->conns.end() && it->second->out.empty())
+        destroyConn(loop, it->second);
+}
+
+bool reactorWaitDrain(int connID, size_t highBytes, size_t lowBytes, std::function<void()> onDrained)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    auto it = loop->conns.find(connID);
+    if (it == loop->conns.end() || it->second->outBytes <= highBytes)
+        return false;
+    it->second->drainBelow = lowBytes;
+    it->second->onDrained = std::move(onDrained);
+    return true;
+}
+
+void reactorPauseRead(int connID, bool paused)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    auto it = loop->conns.find(connID);
+    if (it == loop->conns.end() || it->second->paused == paused)
+        return;
+    reactor_conn_t *conn = it->second;
+    conn->paused = paused;
+    if (conn->socket >= 0 && !conn->closing)
+    {
+        if (backend == REACTOR_BACKEND_EPOLL)
+            updateEvents(loop, conn);
+        else if (paused && conn->recvArmed)
+            cancelOp(loop, uringTag(URING_OP_RECV, conn->id, conn->socketGen));
+        else if (!paused && !conn->recvArmed)
+            armRecv(loop, conn);
+    }
+    if (paused)
+        return;
+    // Las tramas que ya estaban en el lector se entregan desde el bucle, no
+    // desde la lógica de sesión que acaba de reanudar la lectura
+    post(loop, [loop, connID]()
+         {
+             auto it = loop->conns.find(connID);
+             if (it != loop->conns.end() && !parseFrames(it->second))
+                 destroyConn(loop, it->second); });
+}
+
+void reactorClose(int connID)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    auto markClosing = [loop, connID]()
+    {
+        auto it = loop->conns.find(connID);
+        if (it == loop->conns.end())
+            return;
+        it->second->closing = true;
+        if (backend == REACTOR_BACKEND_EPOLL && it->second->socket >= 0)
+            updateEvents(loop, it->second);
+        // la destrucción se difiere para no reentrar en la lógica de sesión
+        post(loop, [loop, connID]()
+             { destroyIfDone(loop, connID); });
+    };
+    if (currentLoop == loop)
+        markClosing();
+    else
+        post(loop, markClosing);
+}
+
+void reactorJoin()
+{
+    for (auto loop : loops)
+        loop->thread->join();
+}
+
+int reactorNumLoops()
+{
+    return loops.size();
+}
+
+int reactorLoopOf(int connID)
+{
+    return connID % loops.size();
+}
+
+void reactorSetResume(long long ms, size_t ringBytes)
+{
+    resumeMs = ms;
+    resumeRingBytes = ringBytes;
+}
+
+void reactorEnableResume(int connID)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    auto enable = [loop, connID]()
+    {
+        auto it = loop->conns.find(connID);
+        if (it != loop->conns.end())
+            it->second->resumable = true;
+    };
+    if (currentLoop == loop)
+        enable();
+    else
+        post(loop, enable);
+}
+
+/**
+ * @brief Rehace la cola de salida para un cliente que recibió received bytes:
+ * lo que ya tiene se queda en el anillo y el resto (del anillo y de la cola)
+ * se vuelve a enviar. Las tramas de control pendientes se descartan.
+ * @return false si received cae fuera de lo que se puede reconstruir
+ */
+static bool rewindConn(reactor_conn_t *conn, unsigned long long received)
+{
+    // Con io_uring un envío que quedó huérfano al caer el socket pudo llegar
+    // al cliente sin anotarse: basta con que received no pase de lo encolado
+    unsigned long long queued = conn->sentOffset;
+    for (const frame_ptr_t &frame : conn->out)
+        if (frame->sequenced)
+            queued += frame->bytes.size();
+    if (received < conn->ringStart || received > queued)
+        return false;
+
+    std::deque<frame_ptr_t> delivered;
+    std::deque<frame_ptr_t> pending;
+    unsigned long long pos = conn->ringStart;
+    auto place = [&](const frame_ptr_t &frame)
+    {
+        size_t size = frame->bytes.size();
+        if (pos + size <= received)
+            delivered.push_back(frame);
+        else if (pos >= received)
+            pending.push_back(frame);
+        else
+        {
+            // Recibió parte de un lote: solo queda el resto, que empieza en una trama
+            std::vector<unsigned char> rest(frame->bytes.begin() + (received - pos), frame->bytes.end());
+            pending.push_back(adoptFrame(std::move(rest), frame->priority));
+        }
+        pos += size;
+    };
+    for (const frame_ptr_t &frame : conn->ring)
+        place(frame);
+    for (const frame_ptr_t &frame : conn->out)
+        if (frame->sequenced)
+            place(frame);
+
+    size_t pendingBytes = 0;
+    for (const frame_ptr_t &frame : pending)
+        pendingBytes += frame->bytes.size();
+    metricsAdd(METRIC_QUEUE_FRAMES, (long long)pending.size() - (long long)conn->out.size());
+    metricsAdd(METRIC_QUEUE_BYTES, (long long)pendingBytes - (long long)conn->outBytes);
+
+    conn->ring.swap(delivered);
+    conn->ringBytes = received - conn->ringStart;
+    conn->sentOffset = received;
+    conn->out.swap(pending);
+    conn->outOffset = 0;
+    conn->outBytes = pendingBytes;
+    return true;
+}
+
+// Engancha el socket de un cliente que vuelve a su sesión (en el bucle dueño)
+static void attachConn(reactor_loop_t *loop, int connID, int socket, frame_reader_t &reader,
+                       unsigned long long received, const frame_ptr_t &hello)
+{
+    auto it = loop->conns.find(connID);
+    if (it == loop->conns.end() || !it->second->resumable || it->second->closing)
+    {
+        close(socket);
+        return;
+    }
+    reactor_conn_t *conn = it->second;
+    if (conn->socket >= 0)
+    {
+        // El bucle aún no había visto caer el socket anterior
+        unwatchSocket(loop, conn);
+        close(conn->socket);
+    }
+    loop->detached.erase(connID);
+    conn->socket = socket;
+    conn->detachedSince = -1;
+    conn->wantWrite = false;
+
+    if (!rewindConn(conn, received))
+    {
+        LOG_WARN("reactor -- no se puede reanudar la conexión %d desde %llu", connID, received);
+        destroyConn(loop, conn);
+        return;
+    }
+    conn->out.push_front(hello);
+    conn->outBytes += hello->bytes.size();
+    metricsAdd(METRIC_QUEUE_FRAMES);
+    metricsAdd(METRIC_QUEUE_BYTES, hello->bytes.size());
+    conn->reader = std::move(reader);
+    watchSocket(loop, conn);
+    if (!conn->dirty)
+    {
+        conn->dirty = true;
+        loop->dirty.push_back(connID);
+    }
+
+    // Tramas que el cliente ya hubiera enviado por el socket nuevo
+    if (!parseFrames(conn))
+        destroyConn(loop, conn);
+}
+
+// Quita la conexión de su bucle y pasa su socket (y lo que ya tenga leído) a
+// la sesión targetID
+static void handOffSocket(reactor_loop_t *from, reactor_conn_t *conn, int targetID,
+                          unsigned long long received, const frame_ptr_t &hello)
+{
+    unwatchSocket(from, conn);
+    countDequeued(conn->out.size(), conn->outBytes);
+    metricsAdd(METRIC_CONNECTIONS_CLOSED);
+    from->overloaded.erase(conn->id);
+    from->conns.erase(conn->id);
+    int socket = conn->socket;
+    std::shared_ptr<frame_reader_t> reader = std::make_shared<frame_reader_t>(std::move(conn->reader));
+    delete conn;
+
+    reactor_loop_t *to = loopOf(targetID);
+    auto attach = [to, targetID, socket, reader, received, hello]()
+    { attachConn(to, targetID, socket, *reader, received, hello); };
+    if (to == from)
+        attach();
+    else
+        post(to, attach);
+}
+
+void reactorResume(int connID, int targetID, unsigned long long received, const frame_ptr_t &hello)
+{
+    reactor_loop_t *from = loopOf(connID);
+    auto it = from->conns.find(connID);
+    if (it == from->conns.end())
+        return;
+    it->second->moving = true; // no entregar más tramas suyas
+
+    // Se difiere para no destruir la conexión dentro de su propio onFrame
+    post(from, [from, connID, targetID, received, hello]()
+         {
+        auto it = from->conns.find(connID);
+        if (it == from->conns.end())
+            return;
+        reactor_conn_t *conn = it->second;
+        if (!conn->recvArmed)
+        {
+            handOffSocket(from, conn, targetID, received, hello);
+            return;
+        }
+        // Con io_uring la recepción puede haber traído ya más tramas: se
+        // cancela y el socket cambia de dueño con su última terminación
+        conn->afterRecv = [from, conn, targetID, received, hello]()
+        { handOffSocket(from, conn, targetID, received, hello); };
+        cancelOp(from, uringTag(URING_OP_RECV, connID, conn->socketGen)); });
+}
+
+void reactorSetLocalListener(int listenFD)
+{
+    localListenFD = listenFD;
+}
+
+bool reactorEnableShm(int connID, size_t capacity, const frame_ptr_t &announce)
+{
+    reactor_loop_t *loop = loopOf(connID);
+    auto it = loop->conns.find(connID);
+    if (it == loop->conns.end())
+        return false;
+    reactor_conn_t *conn = it->second;
+    if (conn->shm || conn->resumable || conn->closing || conn->socket < 0)
+        return false;
+    int domain = 0;
+    socklen_t length = sizeof(domain);
+    if (getsockopt(conn->socket, SOL_SOCKET, SO_DOMAIN, &domain, &length) < 0 || domain != AF_UNIX)
+        return false;
+
+    std::unique_ptr<reactor_shm_t> shm(new reactor_shm_t());
+    shm->connID = connID;
+    shm->waiting = false;
+    shm->spaceValue = 0;
+    if (!shmCreate(shm->ring, capacity))
+        return false;
+    if (backend == REACTOR_BACKEND_EPOLL)
+    {
+        // Por flanco y sin leerlo: el cliente también tiene el eventfd y podría
+        // vaciarlo entre el aviso y una lectura bloqueante del bucle
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = SHM_SPACE_TAG | (uint32_t)connID;
+        epoll_ctl(loop->epollFD, EPOLL_CTL_ADD, shm->ring.spaceFD, &ev);
+    }
+    shm->announce = announce;
+    conn->shm = std::move(shm);
+    queueFrame(loop, conn, announce);
+    LOG_DEBUG("reactor -- conexión %d pasa a memoria compartida (%zu bytes)", connID, capacity);
+    return true;
+}
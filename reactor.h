@@ -0,0 +1,268 @@
+#ifndef _REACTOR_H_
+#define _REACTOR_H_
+
+#include "utils.h"
+#include "metrics.h"
+#include <vector>
+#include <functional>
+#include <memory>
+
+/**
+ * Reactor basado en epoll: un conjunto fijo de hilos (bucles de eventos) es
+ * dueño de todos los sockets. Cada conexión pertenece a un único bucle, que es
+ * el que lee, separa las tramas (en la versión acordada) y escribe lo pendiente.
+ *
+ * Las funciones de envío y cierre se pueden llamar desde cualquier hilo: si no
+ * es el bucle dueño de la conexión, la operación se encola en su buzón y se le
+ * despierta con un eventfd.
+ */
+
+/**
+ * Trama de salida ya serializada ([int tamaño][datos]). Es inmutable una vez
+ * creada, así que un broadcast se codifica una sola vez y todas las colas de
+ * salida comparten el mismo buffer por referencia.
+ */
+typedef struct frame_t
+{
+    std::vector<unsigned char> bytes;
+    bool priority; // privados y avisos: no se descartan con QUEUE_DROP_NON_PRIVATE
+    int type;      // tipo de mensaje para las métricas de salida (-1 si no se contabiliza)
+    bool sequenced; // cuenta en la secuencia de una sesión reanudable (false: trama de control)
+} frame_t;
+typedef std::shared_ptr<const frame_t> frame_ptr_t;
+
+/**
+ * La misma trama codificada en cada versión del protocolo y, si es grande,
+ * también comprimida (compress.h). Las funciones de envío eligen la de la
+ * versión de cada conexión (la comprimida si la acordó y existe); si falta, no
+ * se le envía.
+ */
+typedef struct frame_versions_t
+{
+    frame_ptr_t v1 = nullptr;
+    frame_ptr_t v2 = nullptr;
+    frame_ptr_t v1z = nullptr; // MSG_TYPE_COMPRESSED con v1 dentro (o nullptr)
+    frame_ptr_t v2z = nullptr;
+
+    const frame_ptr_t &of(int version, bool compressed = false) const
+    {
+        const frame_ptr_t &packed = version == PROTOCOL_V2 ? v2z : v1z;
+        if (compressed && packed)
+            return packed;
+        return version == PROTOCOL_V2 ? v2 : v1;
+    }
+} frame_versions_t;
+
+frame_ptr_t makeFrame(const std::vector<unsigned char> &payload, bool priority = false, int type = -1);
+
+/**
+ * @brief Convierte en trama compartida un buffer que ya incluye el prefijo de
+ * tamaño (p. ej. el de un frame_builder_t), sin copiarlo
+ */
+frame_ptr_t adoptFrame(std::vector<unsigned char> &&bytes, bool priority = false, int type = -1);
+
+/**
+ * @brief Trama de control de sesión: no se numera ni se guarda para reenviarla
+ */
+frame_ptr_t adoptControlFrame(std::vector<unsigned char> &&bytes);
+
+/**
+ * Límites de la cola de salida de cada conexión y qué hacer con un consumidor
+ * lento que los supera. Con cualquier política, si la cola sigue por encima del
+ * límite durante graceMs la conexión se corta.
+ */
+typedef enum queue_policy_t
+{
+    QUEUE_DROP_OLDEST,      // descartar las tramas más antiguas
+    QUEUE_DROP_NON_PRIVATE, // descartar primero las tramas públicas
+    QUEUE_DISCONNECT        // no descartar nada; desconectar tras graceMs
+} queue_policy_t;
+
+typedef struct queue_limits_t
+{
+    size_t maxBytes;
+    size_t maxFrames;
+    queue_policy_t policy;
+    long long graceMs;
+} queue_limits_t;
+
+// Veces que ha actuado cada política (acumulado de todas las conexiones)
+typedef struct queue_stats_t
+{
+    unsigned long long overflows;
+    unsigned long long droppedOldest;
+    unsigned long long droppedNonPrivate;
+    unsigned long long slowDisconnects;
+} queue_stats_t;
+
+/**
+ * Motor de E/S de los bucles. Con io_uring cada bucle tiene un anillo propio:
+ * las aceptaciones y las recepciones son multishot (una petición sirve para
+ * muchas conexiones o lecturas, con buffers que elige el kernel de un grupo
+ * registrado) y los envíos de todo un ciclo salen en la misma llamada al
+ * sistema que espera los siguientes eventos.
+ */
+typedef enum reactor_backend_t
+{
+    REACTOR_BACKEND_EPOLL,
+    REACTOR_BACKEND_URING
+} reactor_backend_t;
+
+/**
+ * @brief Elige el motor; llamar antes de reactorStart. Si el kernel no tiene
+ * io_uring (o le faltan funciones) se usa epoll.
+ */
+void reactorSetBackend(reactor_backend_t backend);
+
+/**
+ * @brief Motor en uso (tras reactorStart, el que quedó de verdad)
+ */
+reactor_backend_t reactorBackend();
+
+/**
+ * @brief Configura los límites de las colas; llamar antes de reactorStart
+ */
+void reactorSetQueueLimits(queue_limits_t limits);
+queue_stats_t reactorGetQueueStats();
+
+/**
+ * Reanudación de sesiones. En una conexión reanudable el bucle numera lo que
+ * escribe: la secuencia es el desplazamiento en bytes dentro del flujo de
+ * salida de la sesión, así que las tramas siguen siendo compartidas (no se
+ * recodifican por destinatario) y un lote de varias tramas avanza la secuencia
+ * de todas ellas. Las últimas tramas escritas se guardan en un anillo acotado.
+ *
+ * Si el socket se cae, la conexión queda desenganchada durante resumeMs: sigue
+ * en los índices y acumulando tramas en su cola. Un cliente que vuelve con otro
+ * socket indica cuántos bytes recibió y se le reenvía justo lo que le faltó.
+ */
+void reactorSetResume(long long resumeMs, size_t ringBytes);
+
+/**
+ * @brief Hace reanudable la conexión: lo que se escriba desde ahora se numera
+ */
+void reactorEnableResume(int connID);
+
+/**
+ * @brief Pasa el socket de connID a la conexión desenganchada targetID. Primero
+ * se envía hello y después lo que el cliente no recibió (a partir de received).
+ * connID desaparece sin llamar a onClose. Si no se puede reanudar, el socket se
+ * cierra (y targetID también, si la secuencia no cuadra).
+ * Se llama desde onFrame de connID.
+ */
+void reactorResume(int connID, int targetID, unsigned long long received, const frame_ptr_t &hello);
+
+typedef std::function<void(int connID)> reactorOpenCallback_t;
+typedef std::function<void(int connID, msg_cursor_t &frame)> reactorFrameCallback_t;
+typedef std::function<void(int connID)> reactorCloseCallback_t;
+
+typedef struct reactor_callbacks_t
+{
+    reactorOpenCallback_t onOpen;   // nueva conexión aceptada
+    reactorFrameCallback_t onFrame; // trama completa recibida (vista válida solo durante la llamada)
+    reactorCloseCallback_t onClose; // conexión cerrada (por el cliente o por el servidor)
+} reactor_callbacks_t;
+
+/**
+ * @brief Arranca los bucles de eventos y registra el socket de escucha
+ * @param listenFD Socket ya en estado listen()
+ * @param numLoops Número de hilos de eventos
+ * @param callbacks Funciones de la lógica de sesión (se ejecutan en el hilo dueño)
+ * @return false si no se pudo crear algún bucle
+ */
+bool reactorStart(int listenFD, int numLoops, reactor_callbacks_t callbacks);
+
+/**
+ * @brief Arranca un bucle por núcleo, cada uno con su propio socket de escucha
+ * (SO_REUSEPORT) y fijado a su CPU. El kernel reparte las conexiones entre los
+ * sockets y cada bucle se queda con las que acepta.
+ * @param listenFDs Un socket en listen() por shard, todos en el mismo puerto
+ */
+bool reactorStartSharded(const std::vector<int> &listenFDs, reactor_callbacks_t callbacks);
+
+/**
+ * @brief Encola una trama para la conexión (copia los datos, nunca bloquea)
+ */
+void reactorSend(int connID, const std::vector<unsigned char> &data, bool priority = false);
+
+/**
+ * @brief Encola una trama compartida sin copiarla; la escribe el bucle dueño
+ */
+void reactorSendFrame(int connID, const frame_ptr_t &frame);
+
+/**
+ * @brief Encola la trama de la versión (y compresión) de la conexión
+ */
+void reactorSendFrame(int connID, const frame_versions_t &frames);
+
+/**
+ * @brief Encola la trama que devuelva encode, llamada en el bucle dueño con la
+ * versión y la compresión de la conexión (nullptr: no se envía nada). Para
+ * tramas de un solo destinatario, que no merecen todas las variantes.
+ */
+void reactorSendEncoded(int connID, std::function<frame_ptr_t(int version, bool compressed)> encode);
+
+/**
+ * @brief Cambia la versión del protocolo de la conexión: las tramas que se
+ * lean a continuación y las que se elijan en frame_versions_t. Se llama desde
+ * onFrame de connID (al procesar el saludo).
+ * @param compressed Si acordó compresión (se le envían las tramas comprimidas)
+ */
+void reactorSetVersion(int connID, int version, bool compressed = false);
+
+/**
+ * @brief Si lo pendiente de enviar a la conexión supera highBytes, programa
+ * onDrained (en el bucle dueño) para cuando baje de lowBytes y devuelve true.
+ * Si no lo supera devuelve false y no hace nada. Si la conexión se cierra
+ * antes, onDrained no se llama. Solo desde el bucle dueño.
+ */
+bool reactorWaitDrain(int connID, size_t highBytes, size_t lowBytes, std::function<void()> onDrained);
+
+/**
+ * @brief Deja de leer el socket de la conexión (paused = true) o vuelve a
+ * leerlo. En pausa no se entregan más tramas: lo que el cliente envíe se queda
+ * en el socket y TCP le frena. Al reanudar, las tramas ya recibidas se entregan
+ * desde el bucle, no durante la llamada. Solo desde el bucle dueño.
+ */
+void reactorPauseRead(int connID, bool paused);
+
+/**
+ * @brief Escucha también en un socket local (AF_UNIX, ver initUnixListener);
+ * llamar antes de reactorStart. Acepta el bucle 0.
+ */
+void reactorSetLocalListener(int listenFD);
+
+/**
+ * @brief Pasa la salida de una conexión local a un anillo de memoria
+ * compartida (shmring.h). Se encola announce, que sale por el socket con los
+ * descriptores del anillo; todo lo encolado después va por el anillo. El
+ * cliente sigue escribiendo por el socket. Solo desde el bucle dueño.
+ * @return false si la conexión no es AF_UNIX, es reanudable, ya tiene anillo o
+ * no se pudo crear
+ */
+bool reactorEnableShm(int connID, size_t capacity, const frame_ptr_t &announce);
+
+/**
+ * @brief Cierra la conexión cuando se haya vaciado lo pendiente de enviar
+ */
+void reactorClose(int connID);
+
+/**
+ * @brief Ejecuta una tarea en el hilo dueño de la conexión
+ */
+void reactorPost(int connID, std::function<void()> task);
+
+/**
+ * @brief Ejecuta una tarea en el hilo de un bucle concreto (entrega entre shards)
+ */
+void reactorPostLoop(int loopIndex, std::function<void()> task);
+
+/**
+ * @brief Bloquea hasta que todos los bucles terminen
+ */
+void reactorJoin();
+
+int reactorNumLoops();
+int reactorLoopOf(int connID);
+
+#endif
@@ -1,4 +1,15 @@
 #include "utils.h"
+#include "reactor.h"
+#include "coro.h"
+#include "fanout.h"
+#include "metrics.h"
+#include "directory.h"
+#include "channels.h"
+#include "history.h"
+#include "protocol.h"
+#include "compress.h"
+#include "shmring.h"
+#include "federation.h"
 #include <iostream>
 #include <string>
 #include <thread>
@@ -8,255 +19,1224 @@
 #include <mutex>
 #include <map>     // Necesario para los mensajes privados
 #include <sstream> // Necesario para los mensajes privados
+#include <cstdlib>
+#include <random>
+#include <signal.h>
 
 using namespace std;
 
-// --- Estilos de Consola (Funcionalidad Extra) ---
-const string C_RESET = "\033[0m";
-const string C_RED = "\033[31m";
-const string C_GREEN = "\033[32m";
-const string C_YELLOW = "\033[33m";
-const string C_MAGENTA = "\033[35m";
-const string C_CYAN = "\033[36m";
+// Mensajes del historial que se reenvían al conectarse o al unirse a un canal
+size_t historyReplayCount = 20;
+// Máximo que se puede pedir de una vez con MSG_TYPE_HISTORY
+const int HISTORY_MAX_REQUEST = 1000;
 
-// --- Constantes del Protocolo ---
-const int MSG_TYPE_PUBLIC = 0;
-const int MSG_TYPE_PRIVATE = 1;
-const int MSG_TYPE_NOTIFICATION = 2; // Mensajes del servidor al cliente
+// Tiempo que se conserva una sesión reanudable sin socket (0: sin reanudación)
+long long resumeMs = 30000;
+// Bytes ya escritos que se guardan por sesión para reenviarlos al reanudar
+const size_t RESUME_RING_BYTES = 1024 * 1024;
 
-// Mutex para proteger el mapa de usuarios
+// Versión más alta del protocolo que acepta el servidor (--protocol)
+int maxProtocol = PROTOCOL_LATEST;
+
+// Tramas y lotes a partir de este tamaño se envían comprimidos a quien lo
+// acordó (--compress-min, 0: sin compresión)
+size_t compressMinBytes = COMPRESS_MIN_BYTES;
+// Conexiones con compresión por versión: si no hay ninguna, no se comprime
+atomic<int> compressingClients[PROTOCOL_LATEST + 1];
+
+// Federación con otros servidores (--federation-port, --peer, --node); sin
+// puerto de federación el nodo va por su cuenta
+int federationPort = 0;
+vector<string> federationPeers;
+string nodeName; // vacío: "nodo-<puerto>"
+
+// Mutex para proteger las sesiones del modo reactor (los nombres van en directory.h)
 mutex users_mutex;
 
+// Ids de remitente de v2 de los usuarios conectados (nunca se reutilizan)
+mutex senders_mutex;
+map<unsigned int, string> senderNames;
+unsigned int nextSenderID = 1;
+
+/**
+ * @brief Versión acordada a partir de la que propone el cliente en el saludo
+ */
+int negotiateVersion(const hello_msg_t &hello)
+{
+    if (hello.version <= 0)
+        return PROTOCOL_V1;
+    return max(PROTOCOL_V1, min(hello.version, maxProtocol));
+}
+
+/**
+ * @brief Compresión acordada a partir de las que admite el cliente (solo si
+ * también propuso versión: la respuesta va en MSG_TYPE_VERSION)
+ */
+int negotiateCompression(const hello_msg_t &hello)
+{
+    if (compressMinBytes == 0 || hello.version <= 0 || !(hello.compression & COMPRESSION_ZLIB))
+        return COMPRESSION_NONE;
+    return COMPRESSION_ZLIB;
+}
+
+/**
+ * @brief Cuenta (o descuenta) una conexión con compresión acordada
+ */
+void countCompressing(int version, bool compressed, int delta)
+{
+    if (compressed)
+        compressingClients[version] += delta;
+}
+
+/**
+ * @brief true si una trama de broadcast de este tamaño se debe comprimir: es
+ * grande y alguna conexión de esa versión recibe tramas comprimidas
+ */
+bool worthCompressing(int version, size_t size)
+{
+    return compressMinBytes > 0 && size >= compressMinBytes && compressingClients[version] > 0;
+}
+
+/**
+ * @brief Sustituye un lote de tramas (o una sola) por una trama comprimida si
+ * la conexión lo acordó y el lote supera el umbral
+ */
+void compressBatch(vector<unsigned char> &batch, int version, bool compressed)
+{
+    vector<unsigned char> packed;
+    if (compressed && compressMinBytes > 0 && batch.size() >= compressMinBytes &&
+        compressFrames(batch.data(), batch.size(), version, packed))
+        batch.swap(packed);
+}
+
+/**
+ * @brief Anuncio v2 de un remitente (nombre vacío: el id deja de usarse)
+ */
+vector<unsigned char> buildSenderFrame(unsigned int id, string_view name)
+{
+    return encodeFrame(user_msg_t{(int)id, name}, PROTOCOL_V2);
+}
+
+/**
+ * @brief Da un id de remitente al usuario. Llamar cuando ya recibe los
+ * broadcast: así cualquier alta posterior le llega como anuncio y las
+ * anteriores van en la tabla.
+ * @param table Tramas MSG_TYPE_USER de los usuarios que ya estaban (v2)
+ */
+unsigned int registerSender(const string &username, vector<unsigned char> &table)
+{
+    lock_guard<mutex> lock(senders_mutex);
+    for (auto const &sender : senderNames)
+    {
+        vector<unsigned char> frame = buildSenderFrame(sender.first, sender.second);
+        table.insert(table.end(), frame.begin(), frame.end());
+    }
+    unsigned int id = nextSenderID++;
+    senderNames[id] = username;
+    return id;
+}
+
+void unregisterSender(unsigned int id)
+{
+    lock_guard<mutex> lock(senders_mutex);
+    senderNames.erase(id);
+}
+
+/**
+ * @brief Concatena las tramas del historial que cumplen la consulta y, si hay
+ * alguna, una notificación que marca el final. Se envían en una sola escritura
+ * (comprimida entera si la conexión lo acordó).
+ * @param channel Canal, o vacío para los públicos y los privados de user
+ * @param privatesFrom Secuencia desde la que entran los privados de user (0:
+ * ninguno; ver history_query_t)
+ * @param version El historial guarda tramas v1; en otra versión se recodifican
+ */
+vector<unsigned char> buildHistoryReplay(const string &user, const string &channel, long long since, size_t limit,
+                                         unsigned long long privatesFrom, int version, bool compressed)
+{
+    vector<unsigned char> batch;
+    history_query_t query = {user, channel, since, limit, privatesFrom};
+    size_t count = historyReplay(query, batch);
+    if (count > 0 && version != PROTOCOL_V1)
+    {
+        vector<unsigned char> stored;
+        stored.swap(batch);
+        transcodeFrames(stored, version, batch);
+    }
+    if (count > 0)
+    {
+        frame_builder_t &builder = encodeMessage(threadFrameBuilder(),
+                                                 serverNotification("Fin del historial (" + to_string(count) + " mensajes)."),
+                                                 version);
+        batch.insert(batch.end(), builder.bytes.begin(), builder.bytes.end());
+    }
+    compressBatch(batch, version, compressed);
+    return batch;
+}
+
+/**
+ * @brief Respuesta a MSG_TYPE_HISTORY: el historial pedido o una notificación
+ * @param privatesFrom Primera secuencia del historial de esta sesión: los
+ * privados anteriores no se muestran (otro pudo conectarse con ese nombre)
+ */
+vector<unsigned char> handleHistoryRequest(const string &username, const history_request_t &request,
+                                           unsigned long long privatesFrom, int version, bool compressed)
+{
+    string notificationMessage;
+    if (request.limit <= 0)
+        notificationMessage = "Error: Petición de historial no válida.";
+    else if (!historyEnabled())
+        notificationMessage = "El historial está desactivado.";
+    else
+    {
+        vector<unsigned char> batch = buildHistoryReplay(username, "", request.since < 0 ? -1 : request.since,
+                                                         min(request.limit, HISTORY_MAX_REQUEST), privatesFrom, version,
+                                                         compressed);
+        if (!batch.empty())
+            return batch;
+        notificationMessage = "No hay mensajes en el historial.";
+    }
+    return encodeFrame(serverNotification(notificationMessage), version);
+}
+
+/**
+ * @brief Procesa JOIN (común a los dos modos de servidor)
+ * @param joined Canales de la sesión, para darla de baja al desconectar
+ * @return Texto de la notificación que se devuelve al remitente
+ */
+string joinChannel(int clientID, string_view name, vector<string> &joined)
+{
+    if (!channelNameValid(name))
+        return "Error: Nombre de canal no válido.";
+    string channel(name);
+    size_t members = channelJoin(channel, clientID);
+    if (members == 0)
+        return "Ya estás en " + channel + ".";
+    joined.push_back(channel);
+    return "Te has unido a " + channel + " (" + to_string(members) + " miembros).";
+}
+
+/**
+ * @brief Procesa LEAVE
+ */
+string leaveChannel(int clientID, string_view name, vector<string> &joined)
+{
+    if (!channelNameValid(name))
+        return "Error: Nombre de canal no válido.";
+    string channel(name);
+    if (!channelLeave(channel, clientID))
+        return "Error: No estás en " + channel + ".";
+    joined.erase(find(joined.begin(), joined.end(), channel));
+    return "Has salido de " + channel + ".";
+}
+
+/**
+ * @brief Procesa LIST
+ */
+string listChannels()
+{
+    vector<pair<string, size_t>> channels;
+    channelList(channels);
+    if (channels.empty())
+        return "No hay canales abiertos.";
+    string text = "Canales:";
+    for (auto const &channel : channels)
+        text += " " + channel.first + " (" + to_string(channel.second) + ")";
+    return text;
+}
+
+/**
+ * @brief Da de baja la conexión de todos sus canales
+ */
+void leaveAllChannels(int clientID, const vector<string> &joined)
+{
+    for (const string &channel : joined)
+        channelLeave(channel, clientID);
+}
+
 /**
  * @brief Función para atender la conexión de un cliente en un hilo separado
  * @param clientID ID del socket del cliente
- * @param usersMap Mapa compartido de (nombre, ID) de clientes conectados
  */
-void handleConnection(int clientID, map<string, int> &usersMap)
+void handleConnection(int clientID)
 {
-    vector<unsigned char> buffer;
+    msg_cursor_t cursor = makeCursor(nullptr, 0);
     string username;
-    string message;
+    vector<int> recipients; // se reutiliza en cada broadcast
+    vector<string> joined;  // canales a los que está suscrito
     bool keepRunning = true;
 
     // --- TAREA: Recibir nombre de usuario ---
-    recvMSG(clientID, buffer);
-
-    if (buffer.size() > 0)
+    // (la trama es una vista sobre el buffer de recepción de la conexión)
+    hello_msg_t hello;
+    if (!recvFrame(clientID, cursor) || !decodeHello(cursor, hello))
     {
-        int usernameLen = unpack<int>(buffer);
-        username.resize(usernameLen);
-        unpackv<char>(buffer, (char *)username.data(), usernameLen);
-        buffer.clear();
-    }
-    else
-    {
-        cout << C_RED << "Error: Cliente " << clientID << " se conectó sin enviar nombre." << C_RESET << endl;
+        LOG_WARN("Cliente %d se conectó sin enviar nombre.", clientID);
         closeConnection(clientID);
         return;
     }
+    username = hello.username;
+    unsigned long long historyFrom = historyNextSeq(); // sus privados, solo desde aquí
+
+    // Acordar la versión: la respuesta va en v1 y lo siguiente ya en la acordada
+    int version = negotiateVersion(hello);
+    int compression = negotiateCompression(hello);
+    bool compressed = compression != COMPRESSION_NONE;
+    if (hello.version > 0)
+        sendFrames(clientID, encodeFrame(version_msg_t{version, compression}));
+    setFrameVersion(clientID, version);
+    setFrameCompressed(clientID, compressed);
+    countCompressing(version, compressed, 1);
 
     // mostrar mensaje de conexión y añadir al mapa
-    cout << C_GREEN << "Usuario Conectado: " << username << " (ID: " << clientID << ")" << C_RESET << endl;
+    LOG_INFO("Usuario Conectado: %s (ID: %d)", username, clientID);
+    directorySet(username, clientID);
+    metricsAdd(METRIC_CONNECTIONS_OPENED);
+    metricsAdd(METRIC_USERS);
+
+    // Id de remitente: la tabla de los demás para él (v2) y su alta para los demás
+    vector<unsigned char> senders;
+    unsigned int senderID = registerSender(username, senders);
+    if (version == PROTOCOL_V2 && !senders.empty())
     {
-        lock_guard<mutex> lock(users_mutex);
-        usersMap[username] = clientID;
+        compressBatch(senders, version, compressed);
+        sendFrames(clientID, senders);
     }
 
-    // Bucle principal del hilo
-    do
+    // Ponerle al día con los últimos mensajes públicos (sus privados no: el
+    // nombre no demuestra que sea él)
+    vector<unsigned char> replay = buildHistoryReplay(username, "", -1, historyReplayCount, 0, version, compressed);
+    if (!replay.empty())
+        sendFrames(clientID, replay);
+
+    // Enviar una notificación del servidor al propio cliente
+    auto notify = [clientID, version](string_view text)
     {
-        // Recibir mensaje de texto del cliente
-        recvMSG(clientID, buffer);
-        if (buffer.size() == 0)
+        frame_builder_t &builder = encodeMessage(threadFrameBuilder(), serverNotification(text), version);
+        sendFrame(clientID, builder);
+        metricsCountOut(MSG_TYPE_NOTIFICATION, builder.bytes.size());
+    };
+
+    // Enviar a todos los ids de recipients excepto al remitente, sobre una
+    // copia de los ids (sin cerrojos mientras se escribe en los sockets). Cada
+    // uno recibe la trama de su versión (nullptr: esa versión no la recibe).
+    // Las grandes se comprimen una vez por versión, no por destinatario.
+    frame_builder_t builderV2;
+    vector<unsigned char> packedV1, packedV2;
+    auto sendToRecipients = [&](const frame_builder_t *v1, const frame_builder_t *v2, int type)
+    {
+        unsigned long long fanoutStart = metricsNowNs();
+        packedV1.clear();
+        packedV2.clear();
+        if (v1 != nullptr && worthCompressing(PROTOCOL_V1, v1->bytes.size()))
+            compressFrames(v1->bytes.data(), v1->bytes.size(), PROTOCOL_V1, packedV1);
+        if (v2 != nullptr && worthCompressing(PROTOCOL_V2, v2->bytes.size()))
+            compressFrames(v2->bytes.data(), v2->bytes.size(), PROTOCOL_V2, packedV2);
+        for (int memberID : recipients)
         {
-            cout << C_YELLOW << "Error: " << username << " cerró inesperadamente." << C_RESET << endl;
-            keepRunning = false; // Forzar salida del bucle
-            continue;            // Saltar al final del bucle para la limpieza
+            int memberVersion = frameVersion(memberID);
+            const frame_builder_t *frame = memberVersion == PROTOCOL_V2 ? v2 : v1;
+            if (memberID == clientID || frame == nullptr)
+                continue;
+            const vector<unsigned char> &packed = memberVersion == PROTOCOL_V2 ? packedV2 : packedV1;
+            if (!packed.empty() && frameCompressed(memberID))
+            {
+                sendFrames(memberID, packed);
+                metricsCountOut(type, packed.size());
+            }
+            else
+            {
+                sendFrame(memberID, *frame);
+                metricsCountOut(type, frame->bytes.size());
+            }
         }
+        metricsRecord(METRIC_HIST_FANOUT_NS, metricsNowNs() - fanoutStart);
+    };
 
-        // 1. Desempaquetar el tipo de mensaje
-        int messageType = unpack<int>(buffer);
+    // Anunciar su id a los clientes v2
+    builderV2.bytes = buildSenderFrame(senderID, username);
+    directoryMembers(recipients);
+    sendToRecipients(nullptr, &builderV2, -1);
 
-        switch (messageType)
-        {
+    // Una función por tipo de mensaje: el esquema (protocol.h) decodifica la
+    // trama y elige cuál llamar según su tipo
+    auto handlers = message_visitor_t{
         // --- Caso 0: Mensaje Público (Broadcast) ---
-        case MSG_TYPE_PUBLIC:
+        [&](const public_request_t &request)
         {
-            // Desempaquetar el mensaje
-            int messageLen = unpack<int>(buffer);
-            message.resize(messageLen);
-            unpackv<char>(buffer, (char *)message.data(), messageLen);
-
-            cout << "Mensaje recibido (Público): " << username << ": " << message << endl;
+            LOG_DEBUG("Mensaje recibido (Público): %s: %s", username, request.text);
 
             // Comprobar si es un mensaje de salida
-            if (message == "exit()")
+            if (request.text == "exit()")
             {
                 keepRunning = false; // Salir del bucle do-while
-                continue;            // Saltar al final del bucle para la limpieza
+                return;
             }
 
-            // Re-empaquetar para broadcast
-            buffer.clear();
-            pack<int>(buffer, MSG_TYPE_PUBLIC); // Tipo 0 = Público
+            // Re-empaquetar para broadcast (Tipo 0 = Público), una vez por versión
+            public_msg_t message = {{senderID, username}, request.text};
+            frame_builder_t &builder = encodeMessage(threadFrameBuilder(), message);
+            encodeMessage(builderV2, message, PROTOCOL_V2);
+            historyAppend(HISTORY_PUBLIC, "", "", builder.bytes);
+            directoryMembers(recipients);
+            sendToRecipients(&builder, &builderV2, MSG_TYPE_PUBLIC);
+        },
 
-            int usernameLen = username.length();
-            pack<int>(buffer, usernameLen);
-            packv<char>(buffer, (char *)username.c_str(), usernameLen);
+        // --- Caso 1: Mensaje Privado ---
+        [&](const private_request_t &request)
+        {
+            LOG_DEBUG("Mensaje recibido (Privado): %s para %s", username, request.recipient);
 
-            pack<int>(buffer, messageLen);
-            packv<char>(buffer, (char *)message.c_str(), messageLen);
+            // Buscar al destinatario en el directorio (solo lectura, sin esperar a los broadcast)
+            int recipientID = directoryFind(request.recipient);
 
-            // Enviar a todos excepto al remitente
-            lock_guard<mutex> lock(users_mutex);
-            for (auto const &userPair : usersMap)
+            // Si se encuentra, enviar mensaje privado y notificar el éxito
+            if (recipientID != -1)
             {
-                if (userPair.second != clientID)
-                {
-                    sendMSG(userPair.second, buffer);
-                }
+                private_msg_t message = {{senderID, username}, request.text};
+                frame_builder_t &builder = encodeMessage(threadFrameBuilder(), message);
+                historyAppend(HISTORY_PRIVATE, username, request.recipient, builder.bytes);
+                int recipientVersion = frameVersion(recipientID);
+                if (recipientVersion == PROTOCOL_V2)
+                    encodeMessage(builder, message, PROTOCOL_V2);
+                compressBatch(builder.bytes, recipientVersion, frameCompressed(recipientID));
+                sendFrame(recipientID, builder); // Enviar al destinatario
+                metricsCountOut(MSG_TYPE_PRIVATE, builder.bytes.size());
+                notify("Mensaje enviado a " + string(request.recipient));
             }
-            buffer.clear();
-            break;
+            // Si no se encuentra, notificar al remitente
+            else
+            {
+                notify("Error: Usuario '" + string(request.recipient) + "' no encontrado.");
+            }
+        },
+
+        // --- Casos 3-5: Unirse, salir y listar canales ---
+        [&](const join_request_t &request)
+        {
+            size_t joinedBefore = joined.size();
+            notify(joinChannel(clientID, request.channel, joined));
+
+            // Al unirse, los últimos mensajes del canal
+            if (joined.size() > joinedBefore)
+            {
+                vector<unsigned char> replay = buildHistoryReplay(username, joined.back(), -1, historyReplayCount, 0, version,
+                                                                  compressed);
+                if (!replay.empty())
+                    sendFrames(clientID, replay);
+            }
+        },
+        [&](const leave_request_t &request)
+        { notify(leaveChannel(clientID, request.channel, joined)); },
+        [&](const list_request_t &)
+        { notify(listChannels()); },
+
+        // --- Caso 6: Mensaje a un canal (solo a sus miembros) ---
+        [&](const channel_request_t &request)
+        {
+            if (!channelIsMember(request.channel, clientID))
+            {
+                notify("Error: No estás en " + string(request.channel) + ".");
+                return;
+            }
+
+            channel_msg_t message = {{senderID, username}, request.channel, request.text};
+            frame_builder_t &builder = encodeMessage(threadFrameBuilder(), message);
+            encodeMessage(builderV2, message, PROTOCOL_V2);
+            historyAppend(HISTORY_CHANNEL, request.channel, "", builder.bytes);
+            channelMembers(request.channel, recipients);
+            sendToRecipients(&builder, &builderV2, MSG_TYPE_CHANNEL);
+        },
+
+        // --- Caso 7: Petición de historial ---
+        [&](const history_request_t &request)
+        { sendFrames(clientID, handleHistoryRequest(username, request, historyFrom, version, compressed)); },
+
+        // El anillo lo escribe un bucle de eventos: no hay en este modo
+        [&](const shm_request_t &)
+        { notify("Error: la memoria compartida solo está disponible en modo reactor."); }};
+
+    // Bucle principal del hilo
+    do
+    {
+        // Recibir mensaje del cliente
+        if (!recvFrame(clientID, cursor))
+        {
+            LOG_WARN("%s cerró inesperadamente.", username);
+            keepRunning = false; // Forzar salida del bucle
+            continue;            // Saltar al final del bucle para la limpieza
         }
 
-        // --- Caso 1: Mensaje Privado ---
-        case MSG_TYPE_PRIVATE:
+        // Decodificar (cursor sobre el buffer, sin memmove) y atender según el tipo
+        metricsCountIn(peekMessageType(cursor), frameWireSize(cursor));
+        dispatchMessage<client_messages_t>(cursor, handlers);
+
+    } while (keepRunning);
+
+    // --- INICIO SOLUCIÓN "Lost Connection" ---
+    // Notificar al cliente que se está cerrando la conexión
+    notify("exit()"); // Enviar confirmación de "exit()"
+    // --- FIN SOLUCIÓN ---
+
+    // eliminar al cliente del directorio (si el nombre no lo ha tomado otro) y de sus canales
+    directoryRemove(username, clientID);
+    leaveAllChannels(clientID, joined);
+
+    // su id deja de usarse
+    unregisterSender(senderID);
+    builderV2.bytes = buildSenderFrame(senderID, "");
+    directoryMembers(recipients);
+    sendToRecipients(nullptr, &builderV2, -1);
+    countCompressing(version, compressed, -1);
+    metricsAdd(METRIC_USERS, -1);
+    metricsAdd(METRIC_CONNECTIONS_CLOSED);
+
+    LOG_INFO("Usuario Desconectado: %s", username);
+
+    // cerrar conexión con el cliente
+    closeConnection(clientID);
+}
+
+// ============================================================================
+// Modo reactor: la misma lógica de sesión, como corrutina por conexión (coro.h)
+// ============================================================================
+
+typedef struct session_t
+{
+    string username;
+    bool named;   // ya ha enviado el nombre de usuario
+    bool exiting; // ha pedido exit()
+    vector<string> channels; // canales suscritos
+    string token; // para reanudar la sesión (vacío si el cliente no lo admite)
+    int version;  // versión del protocolo acordada
+    bool compressed; // acordó compresión
+    unsigned int senderID; // id de remitente (v2)
+    unsigned long long historyFrom; // /history solo muestra sus privados desde esta secuencia
+} session_t;
+
+// Sesiones por conexión y token → conexión de las reanudables (protegido por users_mutex)
+map<int, session_t> sessions;
+map<string, int> resumeTokens;
+
+/**
+ * @brief Token aleatorio con el que el cliente puede reanudar su sesión
+ */
+string newResumeToken()
+{
+    static random_device device;
+    static const char HEX[] = "0123456789abcdef";
+    string token;
+    for (int i = 0; i < 4; i++)
+    {
+        unsigned int bits = device();
+        for (int j = 0; j < 8; j++, bits >>= 4)
+            token += HEX[bits & 0xf];
+    }
+    return token;
+}
+
+/**
+ * @brief Respuesta de control al saludo: MSG_TYPE_VERSION en v1 (si el cliente
+ * propuso versión) y MSG_TYPE_SESSION en la acordada (si hay token). Con la
+ * sesión, el cliente cuenta los bytes de las tramas que recibe a partir de seq.
+ */
+vector<unsigned char> buildHelloReply(const hello_msg_t &hello, int version, int compression, string_view token,
+                                      unsigned long long seq)
+{
+    vector<unsigned char> reply;
+    if (hello.version > 0)
+        reply = encodeFrame(version_msg_t{version, compression});
+    if (!token.empty())
+    {
+        vector<unsigned char> session = encodeFrame(session_msg_t{token, (long long)seq}, version);
+        reply.insert(reply.end(), session.begin(), session.end());
+    }
+    return reply;
+}
+
+/**
+ * @brief Variante comprimida de una trama compartida, si es grande y alguna
+ * conexión de esa versión la va a recibir (nullptr si no)
+ */
+frame_ptr_t compressedFrame(const frame_ptr_t &frame, int version)
+{
+    vector<unsigned char> packed;
+    if (!worthCompressing(version, frame->bytes.size()) ||
+        !compressFrames(frame->bytes.data(), frame->bytes.size(), version, packed))
+        return nullptr;
+    return adoptFrame(move(packed), frame->priority, frame->type);
+}
+
+/**
+ * @brief Codifica el mensaje en cada versión del protocolo, y comprimido si
+ * es grande (una trama compartida por variante, sea cual sea el número de
+ * destinatarios)
+ */
+template <typename M>
+frame_versions_t encodeVersions(const M &message, bool priority)
+{
+    frame_versions_t frames;
+    frames.v1 = adoptFrame(encodeFrame(message), priority, M::TYPE);
+    frames.v2 = adoptFrame(encodeFrame(message, PROTOCOL_V2), priority, M::TYPE);
+    frames.v1z = compressedFrame(frames.v1, PROTOCOL_V1);
+    frames.v2z = compressedFrame(frames.v2, PROTOCOL_V2);
+    return frames;
+}
+
+/**
+ * @brief Envía un privado a su único destinatario. La trama v1 (la que guarda
+ * el historial) ya está codificada; la de otra versión, y la comprimida, se
+ * preparan en el bucle del destinatario y solo si las acordó.
+ */
+void sendPrivate(int recipientID, const frame_ptr_t &v1, unsigned int senderID, string senderName, string text)
+{
+    reactorSendEncoded(recipientID, [v1, senderID, senderName = move(senderName), text = move(text)](int version, bool compressed)
+                       {
+        frame_ptr_t frame = v1;
+        if (version != PROTOCOL_V1)
+            frame = adoptFrame(encodeFrame(private_msg_t{user_ref_t{senderID, senderName}, text}, version), true,
+                               MSG_TYPE_PRIVATE);
+        frame_ptr_t packed = compressed ? compressedFrame(frame, version) : nullptr;
+        return packed ? packed : frame; });
+}
+
+/**
+ * @brief Crea la sesión de una conexión nueva (sin nombre todavía)
+ */
+session_t &openSession(int clientID)
+{
+    unique_lock<mutex> lock = metricsLock(users_mutex, METRIC_HIST_USERS_WAIT_NS);
+    session_t &session = sessions[clientID];
+    session.named = false;
+    session.exiting = false;
+    session.version = PROTOCOL_V1;
+    session.compressed = false;
+    session.senderID = 0;
+    session.historyFrom = 0;
+    return session;
+}
+
+void closeSession(int clientID)
+{
+    session_t session;
+    {
+        unique_lock<mutex> lock = metricsLock(users_mutex, METRIC_HIST_USERS_WAIT_NS);
+        auto it = sessions.find(clientID);
+        if (it == sessions.end())
+            return;
+        session = it->second;
+        sessions.erase(it);
+        if (!session.token.empty())
+            resumeTokens.erase(session.token);
+    }
+    fanoutLeave(clientID);
+    if (session.named)
+        directoryRemove(session.username, clientID);
+    leaveAllChannels(clientID, session.channels);
+
+    if (!session.named)
+        return;
+    federationUserOffline(session.username);
+    countCompressing(session.version, session.compressed, -1);
+    unregisterSender(session.senderID);
+    fanoutBroadcast(frame_versions_t{nullptr, adoptFrame(buildSenderFrame(session.senderID, ""), true)}, clientID);
+    metricsAdd(METRIC_USERS, -1);
+    if (!session.exiting)
+        LOG_WARN("%s cerró inesperadamente.", session.username);
+    LOG_INFO("Usuario Desconectado: %s", session.username);
+}
+
+typedef enum hello_result_t
+{
+    HELLO_INVALID, // no es un saludo: se cierra la conexión
+    HELLO_RESUMED, // el socket pasó a la sesión anterior
+    HELLO_ACCEPTED
+} hello_result_t;
+
+/**
+ * @brief Procesa el saludo: identifica la sesión o la reanuda
+ * @param replies Tramas de respuesta para este cliente
+ */
+hello_result_t acceptHello(int clientID, msg_cursor_t &cursor, session_t &session, vector<frame_ptr_t> &replies)
+{
+    // Saludo completo [usuario][token][recibido][versión] o solo el nombre. Un
+    // token vacío pide una sesión reanudable nueva.
+    hello_msg_t hello;
+    if (!decodeHello(cursor, hello))
+    {
+        LOG_WARN("Cliente %d se conectó sin enviar nombre.", clientID);
+        return HELLO_INVALID;
+    }
+    // Lo siguiente que envíe el cliente ya viene en la versión acordada
+    int version = negotiateVersion(hello);
+    int compression = negotiateCompression(hello);
+    bool compressed = compression != COMPRESSION_NONE;
+    reactorSetVersion(clientID, version, compressed);
+
+    // El cerrojo solo cubre sessions y resumeTokens: el historial, los
+    // anuncios y la federación se preparan después, sin frenar a los demás
+    // saludos y cierres
+    bool resumable = resumeMs > 0 && hello.received >= 0;
+    unsigned long long historyFrom = historyNextSeq();
+    {
+        unique_lock<mutex> lock = metricsLock(users_mutex, METRIC_HIST_USERS_WAIT_NS);
+        if (resumable && !hello.token.empty())
+        {
+            auto it = resumeTokens.find(string(hello.token));
+            if (it != resumeTokens.end() && sessions[it->second].username == hello.username &&
+                sessions[it->second].version == version && sessions[it->second].compressed == compressed)
+            {
+                // El socket nuevo pasa a la sesión anterior, que conserva nombre,
+                // canales y lo que se le encoló mientras no estaba
+                int previousID = it->second;
+                sessions.erase(clientID);
+                reactorResume(clientID, previousID, hello.received,
+                              adoptControlFrame(buildHelloReply(hello, version, compression, hello.token, hello.received)));
+                LOG_INFO("Usuario Reconectado: %s (ID: %d)", hello.username, previousID);
+                return HELLO_RESUMED;
+            }
+        }
+
+        session.username = hello.username;
+        session.named = true;
+        session.version = version;
+        session.compressed = compressed;
+        session.historyFrom = historyFrom;
+        if (resumable)
         {
-            // Desempaquetar destinatario
-            int recipientNameLen = unpack<int>(buffer);
-            string recipientName;
-            recipientName.resize(recipientNameLen);
-            unpackv<char>(buffer, (char *)recipientName.data(), recipientNameLen);
+            session.token = newResumeToken();
+            resumeTokens[session.token] = clientID;
+            reactorEnableResume(clientID);
+        }
+    }
 
-            // Desempaquetar mensaje
-            int messageLen = unpack<int>(buffer);
-            message.resize(messageLen);
-            unpackv<char>(buffer, (char *)message.data(), messageLen);
+    countCompressing(version, compressed, 1);
+    directorySet(session.username, clientID);
+    fanoutJoin(clientID);
+    federationUserOnline(session.username);
+    metricsAdd(METRIC_USERS);
+    LOG_INFO("Usuario Conectado: %s (ID: %d)", session.username, clientID);
+    vector<unsigned char> reply = buildHelloReply(hello, version, compression, session.token, 0);
+    if (!reply.empty())
+        replies.push_back(adoptControlFrame(move(reply)));
 
-            cout << C_MAGENTA << "Mensaje recibido (Privado): " << username << " para " << recipientName << C_RESET << endl;
+    // Id de remitente: ya recibe los broadcast, así que las altas siguientes le
+    // llegan como anuncio y las anteriores en la tabla
+    vector<unsigned char> senders;
+    session.senderID = registerSender(session.username, senders);
+    if (version == PROTOCOL_V2 && !senders.empty())
+    {
+        compressBatch(senders, version, compressed);
+        replies.push_back(adoptFrame(move(senders), true));
+    }
+    fanoutBroadcast(frame_versions_t{nullptr, adoptFrame(buildSenderFrame(session.senderID, session.username), true)},
+                    clientID);
 
-            int recipientID = -1;
-            string notificationMessage;
+    // Solo los públicos: el nombre no demuestra que sea él
+    vector<unsigned char> replay = buildHistoryReplay(session.username, "", -1, historyReplayCount, 0, version, compressed);
+    if (!replay.empty())
+        replies.push_back(adoptFrame(move(replay)));
+    return HELLO_ACCEPTED;
+}
 
-            // Buscar al destinatario en el mapa (protegido)
+/**
+ * @brief Atiende una petición de un cliente ya identificado; se ejecuta en el
+ * hilo de eventos dueño de la conexión y nunca bloquea en sockets ajenos
+ * @param replies Tramas de respuesta para este cliente
+ * @return false si el cliente pidió salir
+ */
+bool handleMessage(int clientID, session_t &session, msg_cursor_t &cursor, vector<frame_ptr_t> &replies)
+{
+    // Los campos de texto son vistas sobre la propia trama: no se copian.
+    // Solo este hilo modifica la sesión, así que se lee sin cerrojo.
+    frame_builder_t &builder = threadFrameBuilder();
+    const string &username = session.username;
+    int version = session.version;
+    bool compressed = session.compressed;
+    user_ref_t sender = {session.senderID, username};
+    bool keepOpen = true;
+
+    // Notificación del servidor solo para este cliente
+    auto notify = [&](string_view text)
+    {
+        encodeMessage(builder, serverNotification(text), version);
+        replies.push_back(adoptFrame(move(builder.bytes), true, MSG_TYPE_NOTIFICATION));
+    };
+
+    auto handlers = message_visitor_t{
+        [&](const public_request_t &request)
+        {
+            LOG_DEBUG("Mensaje recibido (Público): %s: %s", username, request.text);
+
+            if (request.text == "exit()")
             {
-                lock_guard<mutex> lock(users_mutex);
-                if (usersMap.count(recipientName))
                 {
-                    recipientID = usersMap[recipientName];
+                    unique_lock<mutex> lock = metricsLock(users_mutex, METRIC_HIST_USERS_WAIT_NS);
+                    session.exiting = true;
                 }
+                notify("exit()");
+                keepOpen = false;
+                return;
             }
 
-            // Si se encuentra, enviar mensaje privado
-            if (recipientID != -1)
-            {
-                // 1. Preparar buffer para el destinatario
-                buffer.clear();
-                pack<int>(buffer, MSG_TYPE_PRIVATE); // Tipo 1 = Privado
+            // Se codifica una vez por versión; todas las colas de salida comparten la trama
+            frame_versions_t frames = encodeVersions(public_msg_t{sender, request.text}, false);
+            historyAppend(HISTORY_PUBLIC, "", "", frames.v1->bytes);
+            fanoutBroadcast(frames, clientID);
+            // Una sola trama por nodo, no una por usuario remoto
+            federationForward(frames.v1);
+        },
 
-                int usernameLen = username.length();
-                pack<int>(buffer, usernameLen);
-                packv<char>(buffer, (char *)username.c_str(), usernameLen);
+        [&](const private_request_t &request)
+        {
+            LOG_DEBUG("Mensaje recibido (Privado): %s para %s", username, request.recipient);
 
-                pack<int>(buffer, messageLen);
-                packv<char>(buffer, (char *)message.c_str(), messageLen);
+            int recipientID = directoryFind(request.recipient);
+            if (recipientID == -1)
+            {
+                // Puede estar conectado a otro nodo de la federación
+                route_result_t routed = federationRoute(username, request.recipient, request.text);
+                if (routed == ROUTE_NOT_FOUND)
+                {
+                    notify("Error: Usuario '" + string(request.recipient) + "' no encontrado.");
+                    return;
+                }
+                if (routed == ROUTE_DROPPED)
+                {
+                    notify("Error: el servidor de " + string(request.recipient) + " está saturado. Mensaje no enviado.");
+                    return;
+                }
+                historyAppend(HISTORY_PRIVATE, username, request.recipient, encodeFrame(private_msg_t{sender, request.text}));
+                notify("Mensaje enviado a " + string(request.recipient));
+                return;
+            }
 
-                sendMSG(recipientID, buffer); // Enviar al destinatario
+            frame_ptr_t frame = adoptFrame(encodeFrame(private_msg_t{sender, request.text}), true, MSG_TYPE_PRIVATE);
+            historyAppend(HISTORY_PRIVATE, username, request.recipient, frame->bytes);
+            sendPrivate(recipientID, frame, session.senderID, username, string(request.text));
+            notify("Mensaje enviado a " + string(request.recipient));
+        },
 
-                // 2. Preparar notificación de éxito para el remitente
-                notificationMessage = "Mensaje enviado a " + recipientName;
+        [&](const join_request_t &request)
+        {
+            size_t joinedBefore = session.channels.size();
+            notify(joinChannel(clientID, request.channel, session.channels));
+
+            if (session.channels.size() > joinedBefore)
+            {
+                vector<unsigned char> replay = buildHistoryReplay(username, session.channels.back(), -1, historyReplayCount, 0, version,
+                                                                  compressed);
+                if (!replay.empty())
+                    replies.push_back(adoptFrame(move(replay)));
             }
-            // Si no se encuentra, notificar al remitente
-            else
+        },
+        [&](const leave_request_t &request)
+        { notify(leaveChannel(clientID, request.channel, session.channels)); },
+        [&](const list_request_t &)
+        { notify(listChannels()); },
+
+        [&](const channel_request_t &request)
+        {
+            if (!channelIsMember(request.channel, clientID))
             {
-                notificationMessage = "Error: Usuario '" + recipientName + "' no encontrado.";
+                notify("Error: No estás en " + string(request.channel) + ".");
+                return;
             }
 
-            // Enviar notificación de vuelta al remitente
-            buffer.clear();
-            pack<int>(buffer, MSG_TYPE_NOTIFICATION); // Tipo 2 = Notificación
-            string serverName = "Servidor";
-            int serverNameLen = serverName.length();
-            pack<int>(buffer, serverNameLen);
-            packv<char>(buffer, (char *)serverName.c_str(), serverNameLen);
+            // Una trama compartida, entregada solo a los miembros del canal
+            static thread_local vector<int> members;
+            channelMembers(request.channel, members);
+            frame_versions_t frames = encodeVersions(channel_msg_t{sender, request.channel, request.text}, false);
+            historyAppend(HISTORY_CHANNEL, request.channel, "", frames.v1->bytes);
+            fanoutSendTo(members, frames, clientID);
+            federationForward(frames.v1);
+        },
+
+        [&](const history_request_t &request)
+        { replies.push_back(adoptFrame(handleHistoryRequest(username, request, session.historyFrom, version, compressed))); },
 
-            int notificationLen = notificationMessage.length();
-            pack<int>(buffer, notificationLen);
-            packv<char>(buffer, (char *)notificationMessage.c_str(), notificationLen);
+        // Lo ya encolado sale por el socket antes del anuncio; lo demás, por el anillo
+        [&](const shm_request_t &request)
+        {
+            size_t capacity = shmRingSize(request.bytes);
+            frame_ptr_t announce = adoptFrame(encodeFrame(shm_msg_t{(int)capacity}, version), true, MSG_TYPE_SHM);
+            if (!reactorEnableShm(clientID, capacity, announce))
+                notify("Error: la memoria compartida solo está disponible en conexiones locales sin reanudación.");
+        }};
+
+    metricsCountIn(peekMessageType(cursor), frameWireSize(cursor));
+    dispatchMessage<client_messages_t>(cursor, handlers);
+    return keepOpen;
+}
+
+/**
+ * @brief Sesión de un cliente en modo reactor: saludo y después una petición
+ * tras otra, como en handleConnection, pero suspendida (sin hilo) mientras
+ * espera tramas o a que el cliente lea sus respuestas
+ */
+session_task_t reactorSession(coro_conn_t &conn)
+{
+    int clientID = conn.id;
+    session_t &session = openSession(clientID);
+    msg_cursor_t cursor;
+    vector<frame_ptr_t> replies;
 
-            sendMSG(clientID, buffer);
+    hello_result_t hello = HELLO_INVALID;
+    if (co_await recvFrame(conn, cursor))
+        hello = acceptHello(clientID, cursor, session, replies);
+    // La conexión reanudada sigue en la corrutina de la sesión anterior
+    if (hello == HELLO_RESUMED)
+        co_return;
 
-            buffer.clear();
+    bool keepOpen = hello == HELLO_ACCEPTED;
+    while (true)
+    {
+        for (const frame_ptr_t &reply : replies)
+            co_await sendFrame(conn, reply);
+        replies.clear();
+        if (!keepOpen || !co_await recvFrame(conn, cursor))
             break;
+        keepOpen = handleMessage(clientID, session, cursor, replies);
+    }
+    // Lo encolado se envía antes de cerrar el socket
+    reactorClose(clientID);
+    closeSession(clientID);
+}
+
+/**
+ * @brief Entrega a los clientes locales lo que llega de otros nodos. Se
+ * ejecuta en el hilo del enlace entrante y nunca se reenvía a otros nodos
+ * (la malla es completa). Los remitentes remotos no tienen id de v2: viajan
+ * con el nombre.
+ */
+federation_callbacks_t federationDelivery()
+{
+    federation_callbacks_t callbacks;
+    callbacks.onPublic = [](const public_msg_t &message)
+    {
+        frame_versions_t frames = encodeVersions(message, false);
+        historyAppend(HISTORY_PUBLIC, "", "", frames.v1->bytes);
+        fanoutBroadcast(frames, -1);
+    };
+    callbacks.onChannel = [](const channel_msg_t &message)
+    {
+        vector<int> members;
+        frame_versions_t frames = encodeVersions(message, false);
+        historyAppend(HISTORY_CHANNEL, message.channel, "", frames.v1->bytes);
+        if (channelMembers(message.channel, members))
+            fanoutSendTo(members, frames, -1);
+    };
+    callbacks.onRouted = [](const routed_msg_t &message)
+    {
+        int recipientID = directoryFind(message.recipient);
+        if (recipientID == -1)
+        {
+            LOG_WARN("federación -- privado de %s para %s, que ya no está conectado", message.sender, message.recipient);
+            return;
         }
-        } // fin del switch
+        frame_ptr_t frame = adoptFrame(encodeFrame(private_msg_t{user_ref_t{0, message.sender}, message.text}), true,
+                                       MSG_TYPE_PRIVATE);
+        historyAppend(HISTORY_PRIVATE, message.sender, message.recipient, frame->bytes);
+        sendPrivate(recipientID, frame, 0, string(message.sender), string(message.text));
+    };
+    return callbacks;
+}
 
-    } while (keepRunning);
+/**
+ * @brief Arranca el servidor en modo reactor (epoll)
+ * @param numLoops Número de hilos de eventos (o de shards)
+ * @param sharded Si es true, un socket SO_REUSEPORT y un núcleo por bucle
+ * @param unixPath Socket local para clientes de la misma máquina (vacío: sin él)
+ */
+int runReactorServer(int port, int numLoops, bool sharded, const string &unixPath)
+{
+    reactor_callbacks_t callbacks = coroCallbacks(reactorSession);
+    fanoutInit(numLoops);
 
-    // --- INICIO SOLUCIÓN "Lost Connection" ---
-    // Notificar al cliente que se está cerrando la conexión
-    buffer.clear();
-    pack<int>(buffer, MSG_TYPE_NOTIFICATION); // Tipo 2 = Notificación
-    string serverName = "Servidor";
-    int serverNameLen = serverName.length();
-    pack<int>(buffer, serverNameLen);
-    packv<char>(buffer, (char *)serverName.c_str(), serverNameLen);
-
-    string exitMessage = "exit()";
-    int exitMessageLen = exitMessage.length();
-    pack<int>(buffer, exitMessageLen);
-    packv<char>(buffer, (char *)exitMessage.c_str(), exitMessageLen);
-
-    sendMSG(clientID, buffer); // Enviar confirmación de "exit()"
-    // --- FIN SOLUCIÓN ---
+    vector<int> listenFDs;
+    for (int i = 0; i < (sharded ? numLoops : 1); i++)
+    {
+        int serverSocketFD = initListener(port, sharded);
+        if (serverSocketFD == -1)
+        {
+            LOG_ERROR("Error al iniciar el servidor.");
+            return -1;
+        }
+        listenFDs.push_back(serverSocketFD);
+    }
+    int localFD = -1;
+    if (!unixPath.empty())
+    {
+        localFD = initUnixListener(unixPath);
+        if (localFD == -1)
+            return -1;
+        reactorSetLocalListener(localFD);
+    }
 
-    // eliminar al cliente del mapa (protegido)
+    bool started = sharded ? reactorStartSharded(listenFDs, callbacks)
+                           : reactorStart(listenFDs[0], numLoops, callbacks);
+    if (!started)
     {
-        lock_guard<mutex> lock(users_mutex);
-        usersMap.erase(username);
+        LOG_ERROR("Error al iniciar el reactor.");
+        return -1;
     }
 
-    cout << C_YELLOW << "Usuario Desconectado: " << username << C_RESET << endl;
+    LOG_INFO("Servidor (%s, %d hilos, %s) iniciado en el puerto %d. Esperando conexiones...",
+             sharded ? "shards" : "reactor", numLoops,
+             reactorBackend() == REACTOR_BACKEND_URING ? "io_uring" : "epoll", port);
+    if (localFD >= 0)
+        LOG_INFO("Clientes locales en %s", unixPath.c_str());
 
-    // cerrar conexión con el cliente
-    closeConnection(clientID);
+    // Con los bucles ya en marcha: lo que llegue de otros nodos se puede entregar
+    if (federationPort > 0)
+    {
+        if (nodeName.empty())
+            nodeName = "nodo-" + to_string(port);
+        if (!federationStart(nodeName, federationPort, federationPeers, federationDelivery()))
+        {
+            LOG_ERROR("Error al iniciar la federación.");
+            return -1;
+        }
+        LOG_INFO("Nodo %s: enlaces de federación en el puerto %d, %zu pares", nodeName, federationPort,
+                 federationPeers.size());
+    }
+    reactorJoin();
+    for (int fd : listenFDs)
+        close(fd);
+    if (localFD >= 0)
+        close(localFD);
+    return 0;
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Modo clásico: un hilo por cliente atendiendo en handleConnection
+ */
+int runThreadedServer(int port, const string &unixPath)
 {
-    // Iniciar el server en el puerto 3000
-    auto serverSocketFD = initServer(3000);
+    auto serverSocketFD = initServer(port);
     if (serverSocketFD == -1)
     {
-        cout << C_RED << "Error al iniciar el servidor." << C_RESET << endl;
+        LOG_ERROR("Error al iniciar el servidor.");
         return -1;
     }
+    // Los clientes locales entran en la misma cola de espera
+    if (!unixPath.empty())
+    {
+        int localFD = initUnixListener(unixPath);
+        if (localFD == -1)
+            return -1;
+        new thread(waitForConnectionsAsync, localFD);
+        LOG_INFO("Clientes locales en %s", unixPath.c_str());
+    }
 
-    cout << C_GREEN << "Servidor iniciado en el puerto 3000. Esperando conexiones..." << C_RESET << endl;
-
-    // Cambiamos la lista de usuarios por un mapa [nombre -> clientID]
-    map<string, int> usersMap;
+    LOG_INFO("Servidor iniciado en el puerto %d. Esperando conexiones...", port);
 
     // bucle infinito
     while (1)
     {
-        // Esperar conexión de un cliente
-        while (!checkClient())
-        {
-            usleep(1000); // Espera 1ms
-        }
-
-        // Una vez conectado, conseguir su identificador
-        auto newClientID = getLastClientID();
+        // Esperar (sin sondeo) a que se conecte un cliente y conseguir su identificador
+        auto newClientID = waitForClient();
 
         // Crear hilo paralelo en el que se ejecuta "handleConnection"
-        // Se pasa el id y la referencia al mapa compartido
-        thread *clientThread = new thread(handleConnection, newClientID, ref(usersMap));
+        // Se pasa el id; los nombres se registran en el directorio compartido
+        thread *clientThread = new thread(handleConnection, newClientID);
         clientThread->detach();
     }
 
     close(serverSocketFD); // cerrar el servidor
     return 0;
-}
\ No newline at end of file
+}
+
+// Opciones de línea de comandos del servidor
+typedef struct server_options_t
+{
+    bool threaded;
+    bool sharded;
+    int port;
+    int numLoops;
+    reactor_backend_t backend;
+    queue_limits_t queueLimits;
+    int adminPort;      // 0: sin socket de administración
+    string historyDir;  // vacío: sin historial
+    string unixPath;    // vacío: sin socket local
+} server_options_t;
+
+void printUsage(const char *program)
+{
+    cout << "Uso: " << program << " [opciones]" << endl
+         << "  --port N               puerto de los clientes (3000)" << endl
+         << "  --threads              un hilo por cliente (modo clásico)" << endl
+         << "  --loops N              N hilos de eventos con un único aceptador" << endl
+         << "  --shards N             N sockets SO_REUSEPORT, un bucle por núcleo" << endl
+         << "  --io E                 motor de E/S de los bucles: epoll | uring (epoll)" << endl
+         << "  --queue-bytes N        límite de bytes pendientes por conexión" << endl
+         << "  --queue-msgs N         límite de mensajes pendientes por conexión" << endl
+         << "  --slow-policy P        drop-oldest | drop-public | disconnect" << endl
+         << "  --grace-ms N           margen antes de desconectar a un consumidor lento" << endl
+         << "  --admin-port N         métricas en texto en 127.0.0.1:N" << endl
+         << "  --unix PATH            acepta también clientes locales en el socket PATH" << endl
+         << "  --federation-port N    acepta enlaces de otros servidores en el puerto N" << endl
+         << "  --peer IP:PUERTO       enlaza con el puerto de federación de otro servidor (repetible)" << endl
+         << "  --node NOMBRE          nombre de este nodo en la federación (nodo-<puerto>)" << endl
+         << "  --history DIR          guarda el historial de mensajes en DIR" << endl
+         << "  --history-replay N     mensajes reenviados al conectarse o unirse a un canal (20)" << endl
+         << "  --resume-ms N          tiempo para reanudar una sesión caída (30000, 0 desactiva)" << endl
+         << "  --protocol N           versión más alta del protocolo que se acepta (" << PROTOCOL_LATEST << ")" << endl
+         << "  --compress-min N       comprime tramas y lotes desde N bytes (" << COMPRESS_MIN_BYTES << ", 0 desactiva)" << endl
+         << "  --log-level L          debug | info | warn | error (info)" << endl;
+}
+
+bool parseOptions(int argc, char **argv, server_options_t &options)
+{
+    options.threaded = false;
+    options.sharded = false;
+    options.port = 3000;
+    options.numLoops = thread::hardware_concurrency();
+    options.backend = REACTOR_BACKEND_EPOLL;
+    options.queueLimits = {4 * 1024 * 1024, 10000, QUEUE_DROP_NON_PRIVATE, 5000};
+    options.adminPort = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--threads")
+            options.threaded = true;
+        else if (arg == "--port" && hasValue)
+            options.port = atoi(argv[++i]);
+        else if (arg == "--loops" && hasValue)
+            options.numLoops = atoi(argv[++i]);
+        else if (arg == "--shards" && hasValue)
+        {
+            options.sharded = true;
+            options.numLoops = atoi(argv[++i]);
+        }
+        else if (arg == "--queue-bytes" && hasValue)
+            options.queueLimits.maxBytes = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--queue-msgs" && hasValue)
+            options.queueLimits.maxFrames = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--grace-ms" && hasValue)
+            options.queueLimits.graceMs = atoll(argv[++i]);
+        else if (arg == "--admin-port" && hasValue)
+            options.adminPort = atoi(argv[++i]);
+        else if (arg == "--unix" && hasValue)
+            options.unixPath = argv[++i];
+        else if (arg == "--federation-port" && hasValue)
+            federationPort = atoi(argv[++i]);
+        else if (arg == "--peer" && hasValue)
+            federationPeers.push_back(argv[++i]);
+        else if (arg == "--node" && hasValue)
+            nodeName = argv[++i];
+        else if (arg == "--history" && hasValue)
+            options.historyDir = argv[++i];
+        else if (arg == "--history-replay" && hasValue)
+            historyReplayCount = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--resume-ms" && hasValue)
+            resumeMs = atoll(argv[++i]);
+        else if (arg == "--protocol" && hasValue)
+            maxProtocol = max(PROTOCOL_V1, min(atoi(argv[++i]), PROTOCOL_LATEST));
+        else if (arg == "--compress-min" && hasValue)
+            compressMinBytes = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--log-level" && hasValue)
+        {
+            int level = logParseLevel(argv[++i]);
+            if (level < 0)
+                return false;
+            logSetLevel(level);
+        }
+        else if (arg == "--io" && hasValue)
+        {
+            string engine = argv[++i];
+            if (engine == "epoll")
+                options.backend = REACTOR_BACKEND_EPOLL;
+            else if (engine == "uring")
+                options.backend = REACTOR_BACKEND_URING;
+            else
+                return false;
+        }
+        else if (arg == "--slow-policy" && hasValue)
+        {
+            string policy = argv[++i];
+            if (policy == "drop-oldest")
+                options.queueLimits.policy = QUEUE_DROP_OLDEST;
+            else if (policy == "drop-public")
+                options.queueLimits.policy = QUEUE_DROP_NON_PRIVATE;
+            else if (policy == "disconnect")
+                options.queueLimits.policy = QUEUE_DISCONNECT;
+            else
+                return false;
+        }
+        else
+            return false;
+    }
+    if (options.numLoops < 1)
+        options.numLoops = 1;
+    // Los pares enlazan con nuestro puerto de federación: sin él no hay malla
+    if (options.port <= 0 || (!federationPeers.empty() && federationPort <= 0))
+        return false;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    server_options_t options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    // Escribir en un socket que el cliente ya cerró no debe tumbar el servidor:
+    // el error se recoge como EPIPE en la escritura
+    signal(SIGPIPE, SIG_IGN);
+
+    // Desde aquí los registros los escribe el hilo del registro; al salir se
+    // vacía lo pendiente
+    logStart();
+    atexit(logStop);
+
+    if (options.adminPort > 0)
+    {
+        metricsAddSource([](string &out)
+                         {
+            queue_stats_t stats = reactorGetQueueStats();
+            out += "chat_queue_overflows_total " + to_string(stats.overflows) + "\n";
+            out += "chat_queue_dropped_total{policy=\"drop-oldest\"} " + to_string(stats.droppedOldest) + "\n";
+            out += "chat_queue_dropped_total{policy=\"drop-public\"} " + to_string(stats.droppedNonPrivate) + "\n";
+            out += "chat_slow_disconnects_total " + to_string(stats.slowDisconnects) + "\n";
+            out += "chat_log_dropped_total " + to_string(logDropped()) + "\n";
+            msg_pool_stats_t pool = getMsgPoolStats();
+            out += "chat_msgpool_acquires_total " + to_string(pool.acquires) + "\n";
+            out += "chat_msgpool_hits_total " + to_string(pool.hits) + "\n";
+            out += "chat_msgpool_misses_total " + to_string(pool.misses) + "\n";
+            out += "chat_msgpool_oversize_total " + to_string(pool.oversize) + "\n";
+            out += "chat_msgpool_in_use " + to_string(pool.inUse) + "\n";
+            out += "chat_msgpool_in_use_high_water " + to_string(pool.inUseHighWater) + "\n";
+            out += "chat_msgpool_queue_high_water " + to_string(pool.queueHighWater) + "\n";
+            federation_stats_t federation = federationGetStats();
+            out += "chat_federation_links " + to_string(federation.links) + "\n";
+            out += "chat_federation_remote_users " + to_string(federation.remoteUsers) + "\n";
+            out += "chat_federation_forwarded_total " + to_string(federation.forwarded) + "\n";
+            out += "chat_federation_dropped_total " + to_string(federation.dropped) + "\n"; });
+        if (!metricsStartAdmin(options.adminPort))
+            return -1;
+    }
+
+    if (!options.historyDir.empty() && !historyOpen(options.historyDir))
+        return -1;
+
+    if (options.threaded)
+    {
+        if (federationPort > 0)
+        {
+            LOG_ERROR("La federación solo está disponible en modo reactor.");
+            return -1;
+        }
+        return runThreadedServer(options.port, options.unixPath);
+    }
+
+    reactorSetBackend(options.backend);
+    reactorSetQueueLimits(options.queueLimits);
+    reactorSetResume(resumeMs, RESUME_RING_BYTES);
+    return runReactorServer(options.port, options.numLoops, options.sharded, options.unixPath);
+}
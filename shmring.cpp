@@ -0,0 +1,323 @@
+#include "shmring.h"
+#include "logger.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+
+static size_t pageSize()
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void signalFD(int fd)
+{
+    uint64_t one = 1;
+    ssize_t n = write(fd, &one, sizeof(one));
+    (void)n;
+}
+
+static void resetRing(shm_ring_t &ring)
+{
+    ring.header = nullptr;
+    ring.data = nullptr;
+    ring.capacity = 0;
+    ring.mapSize = 0;
+    ring.position = 0;
+    ring.memFD = ring.dataFD = ring.spaceFD = -1;
+}
+
+size_t shmRingSize(long long requested)
+{
+    if (requested <= 0)
+        return SHM_DEFAULT_BYTES;
+    size_t capacity = SHM_MIN_BYTES;
+    while (capacity < (size_t)requested && capacity < SHM_MAX_BYTES)
+        capacity <<= 1;
+    return capacity;
+}
+
+bool shmCreate(shm_ring_t &ring, size_t capacity)
+{
+    resetRing(ring);
+    ring.capacity = capacity;
+    ring.mapSize = pageSize() + capacity;
+
+    ring.memFD = memfd_create("net-chat-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring.memFD < 0)
+    {
+        LOG_ERROR("shmCreate -- memfd_create: %s", strerror(errno));
+        return false;
+    }
+    // Sellado: el cliente no puede encogerlo (un acceso fuera daría SIGBUS al
+    // servidor) ni quitar los sellos
+    if (ftruncate(ring.memFD, ring.mapSize) < 0 ||
+        fcntl(ring.memFD, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+    {
+        LOG_ERROR("shmCreate -- no se pudo dimensionar el memfd: %s", strerror(errno));
+        shmDestroy(ring);
+        return false;
+    }
+    void *map = mmap(nullptr, ring.mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring.memFD, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("shmCreate -- mmap: %s", strerror(errno));
+        shmDestroy(ring);
+        return false;
+    }
+    ring.header = (shm_header_t *)map;
+    ring.data = (unsigned char *)map + pageSize();
+    ring.header->magic = SHM_MAGIC;
+    ring.header->capacity = (uint32_t)capacity;
+    ring.header->readerWaiting = 1; // el lector empieza dormido: la primera escritura le avisa
+
+    // El modo (bloqueante o no) lo comparte el cliente. dataFD no bloquea: el
+    // cliente no puede dejar al servidor esperando con el contador al máximo.
+    // spaceFD sí, porque io_uring no espera en un eventfd O_NONBLOCK (da
+    // EAGAIN); con epoll el bucle no lo lee nunca.
+    ring.dataFD = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ring.spaceFD = eventfd(0, EFD_CLOEXEC);
+    if (ring.dataFD < 0 || ring.spaceFD < 0)
+    {
+        LOG_ERROR("shmCreate -- eventfd: %s", strerror(errno));
+        shmDestroy(ring);
+        return false;
+    }
+    return true;
+}
+
+bool shmAttach(shm_ring_t &ring, int memFD, int dataFD, int spaceFD)
+{
+    resetRing(ring);
+    ring.memFD = memFD;
+    ring.dataFD = dataFD;
+    ring.spaceFD = spaceFD;
+
+    struct stat info;
+    if (fstat(memFD, &info) < 0 || (size_t)info.st_size <= pageSize())
+    {
+        LOG_ERROR("shmAttach -- memoria compartida no válida");
+        shmDestroy(ring);
+        return false;
+    }
+    size_t capacity = (size_t)info.st_size - pageSize();
+    if (capacity < SHM_MIN_BYTES || capacity > SHM_MAX_BYTES || (capacity & (capacity - 1)) != 0)
+    {
+        LOG_ERROR("shmAttach -- tamaño de anillo no válido: %zu", capacity);
+        shmDestroy(ring);
+        return false;
+    }
+    void *map = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memFD, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("shmAttach -- mmap: %s", strerror(errno));
+        shmDestroy(ring);
+        return false;
+    }
+    ring.header = (shm_header_t *)map;
+    ring.data = (unsigned char *)map + pageSize();
+    ring.mapSize = info.st_size;
+    ring.capacity = capacity;
+    if (ring.header->magic != SHM_MAGIC || ring.header->capacity != capacity)
+    {
+        LOG_ERROR("shmAttach -- cabecera de anillo no válida");
+        shmDestroy(ring);
+        return false;
+    }
+    ring.position = __atomic_load_n(&ring.header->head, __ATOMIC_ACQUIRE);
+
+    // Ya mapeado: el descriptor de la memoria no hace falta
+    close(ring.memFD);
+    ring.memFD = -1;
+    return true;
+}
+
+void shmDestroy(shm_ring_t &ring)
+{
+    if (ring.header)
+        munmap(ring.header, ring.mapSize);
+    if (ring.memFD >= 0)
+        close(ring.memFD);
+    if (ring.dataFD >= 0)
+        close(ring.dataFD);
+    if (ring.spaceFD >= 0)
+        close(ring.spaceFD);
+    resetRing(ring);
+}
+
+// ============================================================================
+// Escritor
+// ============================================================================
+
+ssize_t shmWrite(shm_ring_t &ring, const struct iovec *iov, int iovcnt)
+{
+    uint64_t head = __atomic_load_n(&ring.header->head, __ATOMIC_ACQUIRE);
+    uint64_t used = ring.position - head;
+    if (used > ring.capacity)
+        return -1;
+
+    size_t space = ring.capacity - used;
+    size_t mask = ring.capacity - 1;
+    size_t written = 0;
+    for (int i = 0; i < iovcnt && space > 0; i++)
+    {
+        const unsigned char *src = (const unsigned char *)iov[i].iov_base;
+        size_t len = std::min(iov[i].iov_len, space);
+        size_t offset = (ring.position + written) & mask;
+        size_t first = std::min(len, ring.capacity - offset);
+        memcpy(ring.data + offset, src, first);
+        memcpy(ring.data, src + first, len - first);
+        written += len;
+        space -= len;
+    }
+    if (written == 0)
+        return 0;
+
+    ring.position += written;
+    __atomic_store_n(&ring.header->tail, ring.position, __ATOMIC_RELEASE);
+    return written;
+}
+
+void shmWakeReader(shm_ring_t &ring)
+{
+    // Pareja de la barrera de shmWaitData: o el lector ve el tail nuevo o
+    // nosotros vemos que se fue a dormir
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&ring.header->readerWaiting, 0, __ATOMIC_SEQ_CST))
+        signalFD(ring.dataFD);
+}
+
+bool shmWaitSpace(shm_ring_t &ring)
+{
+    __atomic_store_n(&ring.header->writerWaiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t head = __atomic_load_n(&ring.header->head, __ATOMIC_ACQUIRE);
+    return ring.position - head >= ring.capacity;
+}
+
+void shmClose(shm_ring_t &ring)
+{
+    __atomic_store_n(&ring.header->closed, 1, __ATOMIC_RELEASE);
+    signalFD(ring.dataFD);
+}
+
+// ============================================================================
+// Lector
+// ============================================================================
+
+ssize_t shmRead(shm_ring_t &ring, frame_reader_t &reader)
+{
+    uint64_t tail = __atomic_load_n(&ring.header->tail, __ATOMIC_ACQUIRE);
+    uint64_t available = tail - ring.position;
+    if (available > ring.capacity)
+        return -1;
+    if (available == 0)
+        return 0;
+
+    size_t offset = ring.position & (ring.capacity - 1);
+    size_t first = std::min((size_t)available, ring.capacity - offset);
+    reader.append(ring.data + offset, first);
+    if (available > first)
+        reader.append(ring.data, available - first);
+
+    ring.position = tail;
+    __atomic_store_n(&ring.header->head, ring.position, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&ring.header->writerWaiting, 0, __ATOMIC_SEQ_CST))
+        signalFD(ring.spaceFD);
+    return available;
+}
+
+bool shmWaitData(shm_ring_t &ring)
+{
+    __atomic_store_n(&ring.header->readerWaiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return !shmFinished(ring) && __atomic_load_n(&ring.header->tail, __ATOMIC_ACQUIRE) == ring.position;
+}
+
+bool shmFinished(shm_ring_t &ring)
+{
+    return __atomic_load_n(&ring.header->closed, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&ring.header->tail, __ATOMIC_ACQUIRE) == ring.position;
+}
+
+ssize_t shmFill(shm_ring_t &ring, frame_reader_t &reader, int socket)
+{
+    while (true)
+    {
+        ssize_t n = shmRead(ring, reader);
+        if (n != 0)
+            return n;
+        if (shmFinished(ring))
+            return 0;
+        if (!shmWaitData(ring))
+            continue;
+
+        // Después del anuncio el servidor ya no escribe en el socket: si se
+        // puede leer es que se cerró sin pasar por shmClose
+        struct pollfd fds[2] = {{ring.dataFD, POLLIN, 0}, {socket, POLLIN | POLLRDHUP, 0}};
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (fds[1].revents)
+            return shmRead(ring, reader);
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t value;
+            ssize_t r = read(ring.dataFD, &value, sizeof(value));
+            (void)r;
+        }
+    }
+}
+
+ssize_t shmReceive(frame_reader_t &reader, int socket, shm_ring_t *&ring)
+{
+    size_t room = reader.reserve();
+    struct iovec iov = {reader.buf.data() + reader.tail, room};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(4 * sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    if (n > 0)
+        reader.tail += n;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int fds[4];
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+        if (count == 3 && ring == nullptr)
+        {
+            ring = new shm_ring_t();
+            if (shmAttach(*ring, fds[0], fds[1], fds[2]))
+                continue;
+            delete ring;
+            ring = nullptr;
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+                close(fds[i]);
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC)
+        LOG_WARN("shmReceive -- se descartaron descriptores recibidos");
+    return n;
+}
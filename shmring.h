@@ -0,0 +1,140 @@
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#include "utils.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**
+ * Transporte de memoria compartida para clientes en la misma máquina. Un
+ * anillo de bytes (memfd) con un único escritor (el bucle del servidor dueño
+ * de la conexión) y un único lector (el cliente) lleva las tramas del servidor
+ * al cliente con el mismo formato que el socket, así que el lector las separa
+ * con su frame_reader_t de siempre. Las peticiones del cliente siguen yendo
+ * por el socket local (AF_UNIX), que además avisa del cierre.
+ *
+ * Nadie espera dando vueltas: el lado que se va a dormir lo anuncia en la
+ * cabecera y el otro le despierta con un eventfd, como mucho una vez por
+ * espera (dataFD: hay bytes nuevos; spaceFD: hay hueco). Un ciclo del bucle
+ * que escribe muchas tramas cuesta a lo sumo una escritura en el eventfd.
+ *
+ * El servidor no se fía de lo que el cliente escriba en la memoria: lleva su
+ * propia posición, comprueba la del lector y sella el memfd para que no se
+ * pueda encoger bajo sus pies.
+ */
+
+const uint32_t SHM_MAGIC = 0x4e435348; // "NCSH"
+const size_t SHM_MIN_BYTES = 64 * 1024;
+const size_t SHM_DEFAULT_BYTES = 1024 * 1024;
+const size_t SHM_MAX_BYTES = 16 * 1024 * 1024;
+
+// Cabecera al principio del memfd; los datos empiezan en la página siguiente.
+// Posiciones absolutas (nunca se reinician): ocupado = tail - head.
+typedef struct shm_header_t
+{
+    uint32_t magic;
+    uint32_t capacity;
+    alignas(64) uint64_t tail; // lo escribe el escritor
+    uint32_t readerWaiting;    // el lector va a dormir (el escritor lo limpia al despertarle)
+    uint32_t closed;           // el escritor no va a escribir más
+    alignas(64) uint64_t head; // lo escribe el lector
+    uint32_t writerWaiting;    // el escritor espera hueco
+} shm_header_t;
+
+typedef struct shm_ring_t
+{
+    shm_header_t *header; // nullptr si no hay anillo
+    unsigned char *data;
+    size_t capacity; // potencia de 2
+    size_t mapSize;
+    uint64_t position; // tail propio (escritor) o head propio (lector)
+    int memFD;
+    int dataFD;  // eventfd escritor → lector
+    int spaceFD; // eventfd lector → escritor
+} shm_ring_t;
+
+/**
+ * @brief Capacidad que se usará para una petición (potencia de 2 entre
+ * SHM_MIN_BYTES y SHM_MAX_BYTES; SHM_DEFAULT_BYTES si no se pide nada)
+ */
+size_t shmRingSize(long long requested);
+
+/**
+ * @brief Crea el anillo (lado escritor): memfd sellado y los dos eventfd
+ */
+bool shmCreate(shm_ring_t &ring, size_t capacity);
+
+/**
+ * @brief Se une a un anillo recibido (lado lector); se queda con los descriptores
+ * @return false si no es un anillo válido (y los cierra)
+ */
+bool shmAttach(shm_ring_t &ring, int memFD, int dataFD, int spaceFD);
+
+void shmDestroy(shm_ring_t &ring);
+
+// ============================================================================
+// Escritor
+// ============================================================================
+
+/**
+ * @brief Copia al anillo todo lo que quepa de iov y lo publica
+ * @return Bytes copiados (0 si está lleno), -1 si el lector dejó la cabecera
+ * en un estado imposible
+ */
+ssize_t shmWrite(shm_ring_t &ring, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Despierta al lector si está esperando (llamar tras una tanda de shmWrite)
+ */
+void shmWakeReader(shm_ring_t &ring);
+
+/**
+ * @brief Anuncia que el escritor espera hueco
+ * @return true si hay que esperar a spaceFD; false si ya se liberó hueco
+ */
+bool shmWaitSpace(shm_ring_t &ring);
+
+/**
+ * @brief Marca el anillo como cerrado y despierta al lector
+ */
+void shmClose(shm_ring_t &ring);
+
+// ============================================================================
+// Lector
+// ============================================================================
+
+/**
+ * @brief Pasa al lector todo lo publicado y libera ese espacio (despierta al
+ * escritor si esperaba hueco)
+ * @return Bytes leídos (0 si no hay nada), -1 si el escritor publicó de más
+ */
+ssize_t shmRead(shm_ring_t &ring, frame_reader_t &reader);
+
+/**
+ * @brief Anuncia que el lector va a dormir en dataFD
+ * @return true si puede dormir; false si ya hay datos o el anillo se cerró
+ */
+bool shmWaitData(shm_ring_t &ring);
+
+/**
+ * @brief El escritor cerró y ya no queda nada por leer
+ */
+bool shmFinished(shm_ring_t &ring);
+
+/**
+ * @brief Lectura bloqueante para recvFrame: espera en dataFD y en el socket de
+ * control (cuyo cierre es el fin de la conexión)
+ * @return Bytes leídos, 0 si se cerró, -1 si error
+ */
+ssize_t shmFill(shm_ring_t &ring, frame_reader_t &reader, int socket);
+
+/**
+ * @brief Lee del socket local como frame_reader_t::fill pero con recvmsg: si
+ * con los bytes llegan los descriptores del anuncio (MSG_TYPE_SHM), se une al
+ * anillo y lo deja en ring. Los bytes siguientes al anuncio llegan por el anillo.
+ * @return Lo que devuelva recvmsg
+ */
+ssize_t shmReceive(frame_reader_t &reader, int socket, shm_ring_t *&ring);
+
+#endif
@@ -0,0 +1,291 @@
+#include "uring.h"
+#include "logger.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+
+static int sysSetup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg, size_t argSize)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int sysRegister(int fd, unsigned opcode, void *arg, unsigned count)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static bool mapRings(uring_t &ring, const struct io_uring_params &params)
+{
+    ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        ring.sqRingSize = ring.cqRingSize = std::max(ring.sqRingSize, ring.cqRingSize);
+
+    ring.sqRing = mmap(nullptr, ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sqRing == MAP_FAILED)
+        return false;
+    if (single)
+        ring.cqRing = ring.sqRing;
+    else
+    {
+        ring.cqRing = mmap(nullptr, ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cqRing == MAP_FAILED)
+            return false;
+    }
+    ring.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring.fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    ring.sqes = (struct io_uring_sqe *)sqes;
+
+    unsigned char *sq = (unsigned char *)ring.sqRing;
+    ring.sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring.sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sqEntries = params.sq_entries;
+    ring.sqLocalTail = *ring.sqTail;
+    // La entrada i del array siempre apunta a la sqe i: basta con mover la cola
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++)
+        array[i] = i;
+
+    unsigned char *cq = (unsigned char *)ring.cqRing;
+    ring.cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring.cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+static bool registerBuffers(uring_t &ring, unsigned count, unsigned size)
+{
+    ring.bufCount = count;
+    ring.bufSize = size;
+    ring.bufRingSize = count * sizeof(struct io_uring_buf);
+    void *bufRing = mmap(nullptr, ring.bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED)
+        return false;
+    ring.bufRing = (struct io_uring_buf_ring *)bufRing;
+    void *buffers = mmap(nullptr, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+        return false;
+    ring.buffers = (unsigned char *)buffers;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)ring.bufRing;
+    reg.ring_entries = count;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (sysRegister(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return false;
+
+    ring.bufTail = 0;
+    for (unsigned i = 0; i < count; i++)
+        uringRecycle(ring, i);
+    return true;
+}
+
+bool uringInit(uring_t &ring, unsigned entries, unsigned bufCount, unsigned bufSize)
+{
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+
+    // Cola de terminaciones holgada: cada recepción multishot genera una
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    ring.fd = sysSetup(entries, &params);
+    if (ring.fd < 0 && errno == EINVAL)
+    {
+        // COOP_TASKRUN es de 5.19; sin él funciona igual
+        params.flags = IORING_SETUP_CQSIZE;
+        ring.fd = sysSetup(entries, &params);
+    }
+    if (ring.fd < 0)
+    {
+        LOG_WARN("io_uring -- io_uring_setup: %s", strerror(errno));
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        LOG_WARN("io_uring -- el kernel no admite esperas con plazo (IORING_FEAT_EXT_ARG)");
+        uringDestroy(ring);
+        return false;
+    }
+    if (!mapRings(ring, params))
+    {
+        LOG_WARN("io_uring -- mmap: %s", strerror(errno));
+        uringDestroy(ring);
+        return false;
+    }
+    if (!registerBuffers(ring, bufCount, bufSize))
+    {
+        LOG_WARN("io_uring -- no se pudo registrar el anillo de buffers: %s", strerror(errno));
+        uringDestroy(ring);
+        return false;
+    }
+    return true;
+}
+
+void uringDestroy(uring_t &ring)
+{
+    if (ring.buffers)
+        munmap(ring.buffers, (size_t)ring.bufCount * ring.bufSize);
+    if (ring.bufRing)
+        munmap(ring.bufRing, ring.bufRingSize);
+    if (ring.sqes)
+        munmap(ring.sqes, ring.sqesSize);
+    if (ring.cqRing && ring.cqRing != ring.sqRing)
+        munmap(ring.cqRing, ring.cqRingSize);
+    if (ring.sqRing)
+        munmap(ring.sqRing, ring.sqRingSize);
+    if (ring.fd >= 0)
+        close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+// Publica las entradas preparadas; el kernel las ve en el siguiente enter
+static unsigned publish(uring_t &ring)
+{
+    unsigned tail = *ring.sqTail;
+    __atomic_store_n(ring.sqTail, ring.sqLocalTail, __ATOMIC_RELEASE);
+    return ring.sqLocalTail - tail;
+}
+
+struct io_uring_sqe *uringGetSqe(uring_t &ring)
+{
+    unsigned head = __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+    if (ring.sqLocalTail - head >= ring.sqEntries)
+    {
+        // Cola llena: enviar sin esperar terminaciones
+        unsigned pending = publish(ring);
+        while (sysEnter(ring.fd, pending, 0, 0, nullptr, 0) < 0 && errno == EINTR)
+            ;
+        head = __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+        if (ring.sqLocalTail - head >= ring.sqEntries)
+            return nullptr;
+    }
+    struct io_uring_sqe *sqe = &ring.sqes[ring.sqLocalTail & ring.sqMask];
+    ring.sqLocalTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+bool uringWait(uring_t &ring, long long timeoutMs)
+{
+    unsigned pending = publish(ring);
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeoutMs >= 0)
+    {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+        arg.ts = (uint64_t)&ts;
+    }
+
+    // Si ya hay terminaciones no hace falta esperar (pero sí enviar)
+    unsigned minComplete = uringPeek(ring) ? 0 : 1;
+    if (pending == 0 && minComplete == 0)
+        return true;
+    int ret = sysEnter(ring.fd, pending, minComplete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(arg));
+    if (ret < 0 && errno != EINTR && errno != ETIME)
+    {
+        LOG_ERROR("io_uring -- io_uring_enter: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+struct io_uring_cqe *uringPeek(uring_t &ring)
+{
+    unsigned head = *ring.cqHead;
+    if (head == __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE))
+        return nullptr;
+    return &ring.cqes[head & ring.cqMask];
+}
+
+void uringSeen(uring_t &ring)
+{
+    __atomic_store_n(ring.cqHead, *ring.cqHead + 1, __ATOMIC_RELEASE);
+}
+
+unsigned char *uringBuffer(uring_t &ring, unsigned bufferID)
+{
+    return ring.buffers + (size_t)bufferID * ring.bufSize;
+}
+
+void uringRecycle(uring_t &ring, unsigned bufferID)
+{
+    // No se usa bufRing->bufs: en C++ la estructura vacía que lo precede en la
+    // cabecera ocupa un byte y lo desplaza; el array empieza en el propio anillo
+    struct io_uring_buf *buf = (struct io_uring_buf *)ring.bufRing + (ring.bufTail & (ring.bufCount - 1));
+    buf->addr = (uint64_t)uringBuffer(ring, bufferID);
+    buf->len = ring.bufSize;
+    buf->bid = bufferID;
+    ring.bufTail++;
+    __atomic_store_n(&ring.bufRing->tail, ring.bufTail, __ATOMIC_RELEASE);
+}
+
+void uringPrepAccept(struct io_uring_sqe *sqe, int listenFD, bool multishot)
+{
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFD;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if (multishot)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+void uringPrepRecv(struct io_uring_sqe *sqe, int socket, bool multishot)
+{
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    if (multishot)
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+}
+
+void uringPrepSendmsg(struct io_uring_sqe *sqe, int socket, const struct msghdr *msg)
+{
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void uringPrepRead(struct io_uring_sqe *sqe, int fd, void *buf, unsigned size)
+{
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = size;
+    sqe->off = (uint64_t)-1; // posición actual (eventfd no admite otra)
+}
+
+void uringPrepCancel(struct io_uring_sqe *sqe, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = userData;
+}
@@ -0,0 +1,100 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * Envoltorio mínimo de io_uring con las llamadas al sistema directamente (sin
+ * liburing). Un anillo es de un solo hilo: solo su bucle prepara entradas y
+ * recoge terminaciones. Las entradas preparadas no llegan al kernel hasta
+ * uringWait, que las envía y espera terminaciones en una sola llamada.
+ *
+ * Cada anillo registra además un grupo de buffers (provided buffer ring) del
+ * que el kernel toma uno en cada recepción: las lecturas multishot no
+ * necesitan un buffer por conexión y el bucle los devuelve tras copiarlos.
+ */
+
+typedef struct uring_t
+{
+    int fd;
+
+    // Cola de envío (SQ)
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+    unsigned sqLocalTail; // entradas preparadas (las publica uringWait)
+
+    // Cola de terminaciones (CQ)
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+
+    // Buffers de recepción del grupo URING_BUFFER_GROUP
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    unsigned char *buffers;
+    unsigned bufCount;
+    unsigned bufSize;
+    unsigned short bufTail;
+} uring_t;
+
+const unsigned short URING_BUFFER_GROUP = 0;
+
+/**
+ * @brief Crea el anillo y registra bufCount buffers de bufSize bytes
+ * @return false si el kernel no tiene io_uring o le faltan las funciones que
+ * se usan (argumentos extendidos, anillos de buffers)
+ */
+bool uringInit(uring_t &ring, unsigned entries, unsigned bufCount, unsigned bufSize);
+
+void uringDestroy(uring_t &ring);
+
+/**
+ * @brief Siguiente entrada libre, ya a cero. Si la cola está llena, envía antes
+ * lo preparado.
+ */
+struct io_uring_sqe *uringGetSqe(uring_t &ring);
+
+/**
+ * @brief Envía lo preparado y espera al menos una terminación
+ * @param timeoutMs Espera máxima (-1: sin límite)
+ * @return false si io_uring_enter falló por algo distinto de EINTR o del plazo
+ */
+bool uringWait(uring_t &ring, long long timeoutMs);
+
+/**
+ * @brief Siguiente terminación pendiente (nullptr si no hay); liberarla con
+ * uringSeen antes de pedir otra
+ */
+struct io_uring_cqe *uringPeek(uring_t &ring);
+void uringSeen(uring_t &ring);
+
+/**
+ * @brief Datos del buffer que el kernel eligió para una recepción
+ */
+unsigned char *uringBuffer(uring_t &ring, unsigned bufferID);
+
+/**
+ * @brief Devuelve un buffer al grupo para que el kernel lo vuelva a usar
+ */
+void uringRecycle(uring_t &ring, unsigned bufferID);
+
+void uringPrepAccept(struct io_uring_sqe *sqe, int listenFD, bool multishot);
+void uringPrepRecv(struct io_uring_sqe *sqe, int socket, bool multishot);
+void uringPrepSendmsg(struct io_uring_sqe *sqe, int socket, const struct msghdr *msg);
+void uringPrepRead(struct io_uring_sqe *sqe, int fd, void *buf, unsigned size);
+void uringPrepCancel(struct io_uring_sqe *sqe, uint64_t userData);
+
+#endif
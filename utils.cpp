@@ -1,43 +1,181 @@
 #include "utils.h"
-#include <map>
+#include "shmring.h"
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <deque>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <algorithm>
 
-std::map<unsigned int, connection_t> clientList;
-unsigned int contador = 0;
 bool salir = false;
 std::thread *waitForConnectionsThread;
-int lastClientSize = 0;
-std::list<unsigned int> waitingClients;
-std::mutex contador_mutex;
 
-int initServer(int port)
+// Clientes aceptados pendientes de atender (cola FIFO protegida)
+std::deque<int> waitingClients;
+std::mutex waiting_mutex;
+std::condition_variable waiting_cv;
+
+/** registro de conexiones **/
+
+// El array de slots se reserva por segmentos que nunca se liberan, así un
+// puntero a slot sigue siendo válido aunque el registro crezca.
+const int CONN_MAX_SLOTS = 1 << CONN_SLOT_BITS;
+const int CONN_SEGMENT_SIZE = 1024;
+const int CONN_NUM_SEGMENTS = CONN_MAX_SLOTS / CONN_SEGMENT_SIZE;
+
+static std::atomic<conn_slot_t *> slotSegments[CONN_NUM_SEGMENTS];
+static std::mutex registry_mutex; // solo altas y bajas (camino frío)
+static std::vector<int> freeSlots;
+static int nextSlot = 0;
+static std::atomic<int> numConnections(0);
+
+static conn_slot_t *slotAt(int index)
+{
+    conn_slot_t *segment = slotSegments[index / CONN_SEGMENT_SIZE].load(std::memory_order_acquire);
+    if (segment == nullptr)
+        return nullptr;
+    return &segment[index % CONN_SEGMENT_SIZE];
+}
+
+conn_slot_t *pinConnection(int clientID)
+{
+    if (clientID < 0)
+        return nullptr;
+    conn_slot_t *slot = slotAt(clientID & (CONN_MAX_SLOTS - 1));
+    if (slot == nullptr)
+        return nullptr;
+
+    // Primero se fija y después se comprueba el id: closeConnection hace lo
+    // contrario (invalida el id y espera a los lectores), así nunca se cruzan
+    slot->pins.fetch_add(1);
+    if (slot->id.load() != clientID)
+    {
+        slot->pins.fetch_sub(1);
+        return nullptr;
+    }
+    return slot;
+}
+
+void unpinConnection(conn_slot_t *slot)
+{
+    slot->pins.fetch_sub(1, std::memory_order_release);
+}
+
+int reserveConnectionID()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    int index;
+    if (!freeSlots.empty())
+    {
+        index = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else
+    {
+        if (nextSlot == CONN_MAX_SLOTS)
+            return -1;
+        index = nextSlot++;
+        std::atomic<conn_slot_t *> &segment = slotSegments[index / CONN_SEGMENT_SIZE];
+        if (segment.load() == nullptr)
+        {
+            conn_slot_t *slots = new conn_slot_t[CONN_SEGMENT_SIZE];
+            for (int i = 0; i < CONN_SEGMENT_SIZE; i++)
+            {
+                slots[i].id = -1;
+                slots[i].pins = 0;
+                slots[i].generation = 0;
+            }
+            segment.store(slots, std::memory_order_release);
+        }
+    }
+
+    conn_slot_t *slot = slotAt(index);
+    slot->generation = (slot->generation + 1) & CONN_GENERATION_MASK;
+    numConnections++;
+    return (slot->generation << CONN_SLOT_BITS) | index;
+}
+
+void publishConnection(int clientID, const connection_t &connection)
+{
+    conn_slot_t *slot = slotAt(clientID & (CONN_MAX_SLOTS - 1));
+    slot->conn = connection;
+    slot->id.store(clientID, std::memory_order_release);
+}
+
+int initListener(int port, bool reusePort)
 {
     int sock_fd;
     sock_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (sock_fd < 0)
     {
-        printf("Error creating socket\n");
+        LOG_ERROR("initListener -- error creating socket: %s", strerror(errno));
+        return -1;
     }
     struct sockaddr_in serv_addr;
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
     serv_addr.sin_port = htons(port);
 
+    // Son opciones distintas: hay que activarlas por separado
     int option = 1;
-    setsockopt(sock_fd, SOL_SOCKET,
-               (SO_REUSEPORT | SO_REUSEADDR),
-               &option, sizeof(option));
+    setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    if (reusePort &&
+        setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &option, sizeof(option)) < 0)
+    {
+        LOG_ERROR("initListener -- SO_REUSEPORT no disponible");
+        close(sock_fd);
+        return -1;
+    }
 
     if (bind(sock_fd, (struct sockaddr *)&serv_addr,
              sizeof(serv_addr)) < 0)
-        printf("ERROR on binding");
-    listen(sock_fd, 5);
+    {
+        LOG_ERROR("initListener -- error on binding: %s", strerror(errno));
+        close(sock_fd);
+        return -1;
+    }
+    listen(sock_fd, SOMAXCONN);
+    return sock_fd;
+}
+
+int initServer(int port)
+{
+    int sock_fd = initListener(port, false);
+    if (sock_fd < 0)
+        return -1;
 
     waitForConnectionsThread = new std::thread(waitForConnectionsAsync, sock_fd);
     return sock_fd;
 }
 
+// Da de alta en el registro el socket ya conectado de un cliente
+static connection_t registerClient(int sock_out, bool local)
+{
+    connection_t connection;
+    unsigned int localID = -1;
+
+    connection.id = localID;
+    connection.socket = sock_out;
+    connection.alive = true;
+    connection.compressed = false;
+    connection.local = local;
+    connection.serverId = reserveConnectionID();
+    if ((int)connection.serverId < 0)
+    {
+        LOG_ERROR("initClient -- too many connections");
+        close(sock_out);
+        connection.socket = -1;
+        connection.alive = false;
+        return connection;
+    }
+    connection.queue = new msg_queue_t();
+    connection.reader = new frame_reader_t(4096); // crece si llega una trama mayor
+    publishConnection(connection.serverId, connection);
+    return connection;
+}
+
 connection_t initClient(std::string host, int port)
 {
     int sock_out = 0;
@@ -45,7 +183,7 @@ connection_t initClient(std::string host, int port)
     connection_t connection;
     if ((sock_out = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
-        printf("\n Socket creation error \n");
+        LOG_ERROR("initClient -- socket creation error: %s", strerror(errno));
         connection.socket = -1;
         connection.alive = false;
         return connection;
@@ -57,7 +195,7 @@ connection_t initClient(std::string host, int port)
     // Convert IPv4 and IPv6 addresses from text to binary form
     if (inet_pton(AF_INET, host.c_str(), &serv_addr.sin_addr) <= 0)
     {
-        printf("\nInvalid address/ Address not supported \n");
+        LOG_ERROR("initClient -- invalid address / address not supported: %s", host);
         connection.socket = -1;
         connection.alive = false;
         return connection;
@@ -65,23 +203,77 @@ connection_t initClient(std::string host, int port)
 
     if (connect(sock_out, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
     {
-        printf("\nConnection Failed \n");
+        LOG_ERROR("initClient -- connection failed: %s", strerror(errno));
+        close(sock_out);
         connection.socket = -1;
         connection.alive = false;
         return connection;
     }
 
-    unsigned int localID = -1;
+    int noDelay = 1;
+    setsockopt(sock_out, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return registerClient(sock_out, false);
+}
 
-    connection.id = localID;
-    connection.socket = sock_out;
-    connection.buffer = new std::list<msg_t *>();
-    contador_mutex.lock();
-    connection.serverId = contador;
-    clientList[contador] = connection;
-    contador++;
-    contador_mutex.unlock();
-    return connection;
+int initUnixListener(const std::string &path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        LOG_ERROR("initUnixListener -- ruta no válida: %s", path.c_str());
+        return -1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock_fd < 0)
+    {
+        LOG_ERROR("initUnixListener -- error creating socket: %s", strerror(errno));
+        return -1;
+    }
+    // Un servidor anterior que no llegó a borrarlo deja el fichero ocupado
+    unlink(path.c_str());
+    if (bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        LOG_ERROR("initUnixListener -- error on binding %s: %s", path.c_str(), strerror(errno));
+        close(sock_fd);
+        return -1;
+    }
+    listen(sock_fd, SOMAXCONN);
+    return sock_fd;
+}
+
+connection_t initUnixClient(const std::string &path)
+{
+    connection_t connection;
+    connection.socket = -1;
+    connection.alive = false;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        LOG_ERROR("initUnixClient -- ruta no válida: %s", path.c_str());
+        return connection;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int sock_out = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock_out < 0)
+    {
+        LOG_ERROR("initUnixClient -- socket creation error: %s", strerror(errno));
+        return connection;
+    }
+    if (connect(sock_out, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        LOG_ERROR("initUnixClient -- connection failed: %s", strerror(errno));
+        close(sock_out);
+        return connection;
+    }
+    return registerClient(sock_out, true);
 }
 
 void waitForConnectionsAsync(int server_fd)
@@ -99,83 +291,349 @@ int waitForConnections(int sock_fd)
     int newsock_fd = accept(sock_fd,
                             (struct sockaddr *)&cli_addr,
                             &clilen);
-    connection_t client;
-    contador_mutex.lock();
-    client.id = contador;
-    contador++;
-    contador_mutex.unlock();
+    if (newsock_fd < 0)
+        return newsock_fd;
+
+    int clientID = reserveConnectionID();
+    if (clientID < 0)
+    {
+        LOG_ERROR("waitForConnections -- too many connections");
+        close(newsock_fd);
+        return -1;
+    }
 
+    connection_t client;
+    client.id = clientID;
+    client.serverId = clientID;
     client.alive = true;
+    client.compressed = false;
     client.socket = newsock_fd;
-    client.buffer = new std::list<msg_t *>();
-    clientList[client.id] = client;
+    client.queue = new msg_queue_t();
+    client.reader = new frame_reader_t();
+    publishConnection(clientID, client);
 
-    waitingClients.push_back(client.id);
+    {
+        std::lock_guard<std::mutex> lock(waiting_mutex);
+        waitingClients.push_back(clientID);
+    }
+    waiting_cv.notify_one();
 
     return newsock_fd;
 }
 
+void setFrameVersion(int clientID, int version)
+{
+    connection_ref_t connection(clientID);
+    if (connection)
+        connection->reader->version = version;
+}
+
+int frameVersion(int clientID)
+{
+    connection_ref_t connection(clientID);
+    return connection ? connection->reader->version : PROTOCOL_V1;
+}
+
+void setFrameCompressed(int clientID, bool compressed)
+{
+    connection_ref_t connection(clientID);
+    if (connection)
+        connection->compressed = compressed;
+}
+
+bool frameCompressed(int clientID)
+{
+    connection_ref_t connection(clientID);
+    return connection && connection->compressed;
+}
+
 void closeConnection(int clientID)
 {
-    connection_t connection = clientList[clientID];
+    conn_slot_t *slot = pinConnection(clientID);
+    if (slot == nullptr)
+        return;
+    unpinConnection(slot);
+
+    // Solo uno de los que cierren a la vez gana el slot
+    int expected = clientID;
+    if (!slot->id.compare_exchange_strong(expected, -1))
+        return;
+
+    // Despertar a quien esté bloqueado en read/write y esperar a los lectores
+    connection_t &connection = slot->conn;
+    shutdown(connection.socket, SHUT_RDWR);
+    while (slot->pins.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+
     close(connection.socket);
     connection.alive = false;
 
-    if (checkPendingMessages(clientID))
+    if (connection.queue->size() > 0)
+    {
+        LOG_WARN("closeConnection -- unread messages from %d", connection.id);
+        while (msg_t *msg = connection.queue->pop())
+            releaseMSG(msg);
+    }
+    delete connection.queue;
+    delete connection.reader;
+    if (connection.shm)
+    {
+        shmDestroy(*connection.shm);
+        delete connection.shm;
+        connection.shm = nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    freeSlots.push_back(clientID & (CONN_MAX_SLOTS - 1));
+    numConnections--;
+}
+
+frame_reader_t::frame_reader_t(size_t capacity)
+    : buf(capacity), head(0), tail(0), bad(false), version(PROTOCOL_V1)
+{
+}
+
+bool frame_reader_t::pending(size_t &prefix, size_t &length)
+{
+    if (tail - head < sizeof(int))
+        return false;
+
+    if (version == PROTOCOL_V2)
+    {
+        // [u24 tamaño][u8 tipo]: la vista empieza en el tipo
+        uint32_t header = 0;
+        memcpy(&header, buf.data() + head, sizeof(header));
+        prefix = 3;
+        length = (ntohl(header) >> 8) + 1;
+        return true;
+    }
+
+    int frameLen = 0;
+    memcpy(&frameLen, buf.data() + head, sizeof(int));
+    if (frameLen < 0 || frameLen > MAX_FRAME_SIZE)
+    {
+        bad = true;
+        return false;
+    }
+    prefix = sizeof(int);
+    length = frameLen;
+    return true;
+}
+
+size_t frame_reader_t::reserve()
+{
+    if (head == tail)
+        head = tail = 0;
+
+    // Espacio que necesita la trama pendiente (si ya se conoce su tamaño)
+    size_t needed = sizeof(int);
+    size_t prefix, length;
+    if (pending(prefix, length))
+        needed = std::max(needed, prefix + length);
+
+    // Solo se mueve la trama parcial, y solo cuando no queda sitio al final
+    if (buf.size() - head < needed || tail == buf.size())
+    {
+        memmove(buf.data(), buf.data() + head, tail - head);
+        tail -= head;
+        head = 0;
+    }
+    if (buf.size() < needed)
+        buf.resize(needed);
+    return buf.size() - tail;
+}
+
+ssize_t frame_reader_t::fill(int socket)
+{
+    size_t room = reserve();
+    ssize_t n = read(socket, buf.data() + tail, room);
+    if (n > 0)
+        tail += n;
+    return n;
+}
+
+void frame_reader_t::append(const unsigned char *data, size_t size)
+{
+    if (head == tail)
+        head = tail = 0;
+    if (buf.size() - tail < size)
+    {
+        memmove(buf.data(), buf.data() + head, tail - head);
+        tail -= head;
+        head = 0;
+        if (buf.size() - tail < size)
+            buf.resize(tail + size);
+    }
+    memcpy(buf.data() + tail, data, size);
+    tail += size;
+}
+
+bool frame_reader_t::next(msg_cursor_t &frame)
+{
+    size_t prefix, length;
+    if (!pending(prefix, length) || tail - head - prefix < length)
+        return false;
+
+    frame = makeCursor(buf.data() + head + prefix, length);
+    frame.version = version;
+    head += prefix + length;
+    return true;
+}
+
+bool recvFrame(int clientID, msg_cursor_t &frame)
+{
+    connection_ref_t connection(clientID);
+    if (!connection)
+        return false;
+    frame_reader_t *reader = connection->reader;
+
+    while (!reader->next(frame))
     {
-        printf("ERROR: unread messages from %d\n", connection.id);
-        for (std::list<msg_t *>::iterator t = connection.buffer->begin();
-             t != connection.buffer->end(); t++)
+        if (reader->bad)
         {
-            msg_t *msg = *t;
-            delete[] msg->data;
-            delete[] msg;
+            LOG_WARN("recvMSG -- line : %d invalid frame length", __LINE__);
+            return false;
+        }
+        ssize_t n;
+        if (connection->shm)
+            n = shmFill(*connection->shm, *reader, connection->socket);
+        else if (connection->local)
+            n = shmReceive(*reader, connection->socket, connection->shm);
+        else
+            n = reader->fill(connection->socket);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            LOG_WARN("recvMSG -- line : %d lost connection", __LINE__);
+            return false;
         }
-        delete connection.buffer;
     }
-    clientList.erase(clientID);
+    LOG_DEBUG("DatosLeidos : %zu", frame.size);
+    return true;
 }
 
-/** funciones asíncronas **/
+bool writeAll(int socket, struct iovec *iov, int iovcnt)
+{
+    // Reintenta tras escrituras parciales avanzando sobre los iovec ya enviados
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(socket, iov, iovcnt);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
 
-void recvMSGAsync(connection_t connection)
+void sendFrame(int clientID, const frame_builder_t &builder)
 {
+    sendFrames(clientID, builder.bytes);
+}
 
-    while (connection.alive)
+void sendFrames(int clientID, const std::vector<unsigned char> &frames)
+{
+    connection_ref_t connection(clientID);
+    if (!connection)
+        return;
+    int socket = connection->socket;
+    struct iovec iov;
+    iov.iov_base = (void *)frames.data();
+    iov.iov_len = frames.size();
+    std::lock_guard<std::mutex> lock(connection.slot->writeMutex);
+    if (!writeAll(socket, &iov, 1))
+        LOG_ERROR("sendFrames -- line : %d %s", __LINE__, strerror(errno));
+}
+
+/** funciones asíncronas **/
+
+void recvMSGAsync(int clientID)
+{
+    msg_cursor_t frame;
+    while (recvFrame(clientID, frame))
     {
-        msg_t *msg = new msg_t[1];
-        std::vector<unsigned char> data;
-        recvMSG<unsigned char>(connection.socket, data);
-        msg->data = new unsigned char[data.size()];
-        memcpy(msg->data, data.data(), data.size());
-        msg->size = data.size();
-        connection.buffer->push_back(msg);
+        connection_ref_t connection(clientID);
+        if (!connection)
+            return;
+
+        // Única copia: del buffer de lectura al mensaje del pool
+        msg_t *msg = acquireMSG(frame.size);
+        memcpy(msg->data, frame.data, frame.size);
+        msg->size = frame.size;
+
+        // Cola llena: esperar al consumidor (o a que se cierre la conexión)
+        while (!connection->queue->push(msg))
+        {
+            if (connection.slot->id.load() != clientID)
+            {
+                releaseMSG(msg);
+                return;
+            }
+            std::this_thread::yield();
+        }
     }
 }
 
 bool checkPendingMessages(int clientID)
 {
-    return clientList[clientID].buffer->size() > 0;
+    connection_ref_t connection(clientID);
+    return connection && connection->queue->size() > 0;
+}
+
+msg_t *takeMSG(int clientID)
+{
+    connection_ref_t connection(clientID);
+    if (!connection)
+        return nullptr;
+    return connection->queue->pop();
 }
 
 bool checkClient()
 {
+    std::lock_guard<std::mutex> lock(waiting_mutex);
     return waitingClients.size() > 0;
 }
 
 int getNumClients()
 {
-    return clientList.size();
+    return numConnections.load();
 }
 
 int getClientID(int numClient)
 {
-    return clientList[numClient].id;
+    connection_ref_t connection(numClient);
+    return connection ? (int)connection->id : -1;
 }
 
 int getLastClientID()
 {
-    int id = waitingClients.back();
-    waitingClients.pop_back();
+    std::lock_guard<std::mutex> lock(waiting_mutex);
+    if (waitingClients.empty())
+        return -1;
+    int id = waitingClients.front();
+    waitingClients.pop_front();
+    return id;
+}
+
+int waitForClient()
+{
+    std::unique_lock<std::mutex> lock(waiting_mutex);
+    waiting_cv.wait(lock, []
+                    { return !waitingClients.empty(); });
+    int id = waitingClients.front();
+    waitingClients.pop_front();
     return id;
 }
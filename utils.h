@@ -4,48 +4,315 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
 #include <netinet/in.h>
 #include <unistd.h>
 #include <string.h>
+#include <string>
+#include <string_view>
 #include <iostream>
 #include <list>
 #include <map>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
-#define DEBUG
+#include "msgpool.h"
+#include "logger.h"
 
-#ifdef DEBUG
+/**
+ * Versiones del formato de trama. v1: [int tamaño][int tipo][campos] en el
+ * orden de bytes de la máquina. v2: cabecera fija [u24 tamaño][u8 tipo] en
+ * orden de red y enteros y longitudes como varint. La versión de cada conexión
+ * se acuerda en el saludo (protocol.h); el saludo siempre va en v1.
+ */
+const int PROTOCOL_V1 = 1;
+const int PROTOCOL_V2 = 2;
+const int PROTOCOL_LATEST = PROTOCOL_V2;
 
-#define DEBUG_MSG(...) printf(__VA_ARGS__);
-#endif
+/**
+ * Cursor de lectura sobre un mensaje recibido. Avanza sobre el buffer sin
+ * moverlo ni redimensionarlo, así que decodificar un mensaje es una única pasada
+ * lineal. Si algún campo se sale del buffer (longitud corrupta) el cursor queda
+ * marcado con ok = false y las lecturas siguientes devuelven valores vacíos.
+ */
+typedef struct msg_cursor_t
+{
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    bool ok;
+    int version; // formato de la trama (PROTOCOL_V*)
+} msg_cursor_t;
+
+inline msg_cursor_t makeCursor(const unsigned char *data, size_t size)
+{
+    msg_cursor_t cursor;
+    cursor.data = data;
+    cursor.size = size;
+    cursor.pos = 0;
+    cursor.ok = true;
+    cursor.version = PROTOCOL_V1;
+    return cursor;
+}
 
-typedef struct msg_t
+inline msg_cursor_t makeCursor(const std::vector<unsigned char> &packet)
 {
-    int size;
-    unsigned char *data;
-} msg_t;
+    return makeCursor(packet.data(), packet.size());
+}
+
+inline bool cursorHas(msg_cursor_t &cursor, size_t bytes)
+{
+    if (cursor.ok && cursor.size - cursor.pos >= bytes)
+        return true;
+    cursor.ok = false;
+    return false;
+}
+
+template <typename T>
+inline T unpack(msg_cursor_t &cursor)
+{
+    T data = T();
+    if (cursorHas(cursor, sizeof(T)))
+    {
+        memcpy(&data, cursor.data + cursor.pos, sizeof(T));
+        cursor.pos += sizeof(T);
+    }
+    return data;
+}
+
+template <typename T>
+inline void unpackv(msg_cursor_t &cursor, T *data, int dataSize)
+{
+    // Un tamaño negativo es una trama mal formada, no un campo vacío
+    if (dataSize < 0)
+    {
+        cursor.ok = false;
+        return;
+    }
+    size_t bytes = (size_t)dataSize * sizeof(T);
+    if (cursorHas(cursor, bytes))
+    {
+        memcpy(data, cursor.data + cursor.pos, bytes);
+        cursor.pos += bytes;
+    }
+}
+
+/**
+ * @brief Lee una cadena [int tamaño][chars] como vista sobre el propio buffer
+ * (sin copia). La vista es válida mientras lo sea el buffer del cursor.
+ */
+inline std::string_view unpackView(msg_cursor_t &cursor)
+{
+    int len = unpack<int>(cursor);
+    if (len < 0)
+        cursor.ok = false; // mal formada, no una cadena vacía
+    if (!cursor.ok || !cursorHas(cursor, len))
+        return std::string_view();
+    std::string_view view((const char *)cursor.data + cursor.pos, len);
+    cursor.pos += len;
+    return view;
+}
+
+/**
+ * @brief Entero sin signo en base 128 (7 bits por byte, el bit alto indica que
+ * sigue otro byte)
+ */
+inline unsigned long long unpackVarint(msg_cursor_t &cursor)
+{
+    unsigned long long value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (!cursorHas(cursor, 1))
+            return 0;
+        unsigned char byte = cursor.data[cursor.pos++];
+        value |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    cursor.ok = false; // más de 10 bytes: corrupto
+    return 0;
+}
+
+/**
+ * @brief Cadena [varint tamaño][chars] como vista sobre el buffer (v2)
+ */
+inline std::string_view unpackVarintView(msg_cursor_t &cursor)
+{
+    unsigned long long len = unpackVarint(cursor);
+    if (!cursor.ok || !cursorHas(cursor, len))
+        return std::string_view();
+    std::string_view view((const char *)cursor.data + cursor.pos, len);
+    cursor.pos += len;
+    return view;
+}
+
+// Enteros con signo en varint: zigzag (0, -1, 1, -2...) para que los
+// negativos pequeños también ocupen un byte
+inline unsigned long long zigzagEncode(long long value)
+{
+    return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+inline long long zigzagDecode(unsigned long long value)
+{
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+inline size_t varintSize(unsigned long long value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Tamaño máximo aceptado para una trama (protege de longitudes corruptas)
+const int MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+/**
+ * Buffer de recepción por conexión. Lee del socket en bloques grandes, extrae
+ * todas las tramas [int tamaño][datos] completas que haya y conserva la trama
+ * parcial para la siguiente lectura, así varias tramas cuestan un solo read().
+ * Las tramas que devuelve next() apuntan al propio buffer y son válidas hasta
+ * la siguiente llamada a fill().
+ */
+typedef struct frame_reader_t
+{
+    std::vector<unsigned char> buf;
+    size_t head; // inicio de los datos sin consumir
+    size_t tail; // fin de los datos leídos
+    bool bad;    // se recibió una longitud fuera de rango
+    int version; // formato de las tramas que se reciben (cambia tras el saludo)
+
+    frame_reader_t(size_t capacity = 64 * 1024);
+
+    /**
+     * @brief Hace un read() sobre el espacio libre (compactando o creciendo si
+     * la trama pendiente no cabe)
+     * @return Lo que devuelva read(): bytes leídos, 0 si se cerró, -1 si error
+     */
+    ssize_t fill(int socket);
+
+    /**
+     * @brief Deja sitio tras tail para la trama pendiente (compactando o
+     * creciendo) sin leer nada; para quien lee el socket por su cuenta
+     * @return Bytes libres a partir de tail
+     */
+    size_t reserve();
+
+    /**
+     * @brief Añade bytes ya recibidos por otra vía (p. ej. un buffer de
+     * io_uring), compactando o creciendo si no caben
+     */
+    void append(const unsigned char *data, size_t size);
+
+    /**
+     * @brief Extrae la siguiente trama completa, si la hay
+     */
+    bool next(msg_cursor_t &frame);
+
+    size_t buffered() const { return tail - head; }
+
+    /**
+     * @brief Cabecera de la trama pendiente: bytes de prefijo antes de la vista
+     * y tamaño de la vista (en v2 la vista incluye el byte del tipo)
+     * @return false si aún no ha llegado la cabecera o su longitud no es válida
+     */
+    bool pending(size_t &prefix, size_t &length);
+} frame_reader_t;
+
+/**
+ * @brief Bytes que ocupó en el socket la trama de un cursor (prefijo incluido)
+ */
+inline size_t frameWireSize(const msg_cursor_t &frame)
+{
+    return (frame.version == PROTOCOL_V2 ? 3 : sizeof(int)) + frame.size;
+}
+
+/**
+ * @brief Separa la siguiente trama de un lote de tramas terminadas y
+ * concatenadas en la versión del cursor (p. ej. un lote descomprimido). La
+ * vista es la misma que daría frame_reader_t::next.
+ * @return false al llegar al final o si una cabecera no cuadra con el lote
+ */
+inline bool nextFrame(msg_cursor_t &batch, msg_cursor_t &frame)
+{
+    if (batch.pos == batch.size || !cursorHas(batch, sizeof(uint32_t)))
+        return false;
+    size_t prefix = sizeof(int);
+    size_t length;
+    if (batch.version == PROTOCOL_V2)
+    {
+        uint32_t header;
+        memcpy(&header, batch.data + batch.pos, sizeof(header));
+        prefix = 3;
+        length = (ntohl(header) >> 8) + 1;
+    }
+    else
+    {
+        int len;
+        memcpy(&len, batch.data + batch.pos, sizeof(len));
+        if (len < 0)
+        {
+            batch.ok = false;
+            return false;
+        }
+        length = len;
+    }
+    if (!cursorHas(batch, prefix + length))
+        return false;
+    frame = makeCursor(batch.data + batch.pos + prefix, length);
+    frame.version = batch.version;
+    batch.pos += prefix + length;
+    return true;
+}
+
+struct shm_ring_t;
 
 typedef struct connection_t
 {
     unsigned int id;
     unsigned int serverId;
     int socket;
-    std::list<msg_t *> *buffer;
+    msg_queue_t *queue; // mensajes recibidos por recvMSGAsync pendientes de getMSG
+    frame_reader_t *reader;
     bool alive;
+    bool compressed; // acordó recibir tramas comprimidas (compress.h)
+    bool local = false;          // socket AF_UNIX: puede recibir el anillo de shmring.h
+    shm_ring_t *shm = nullptr;   // anillo por el que llegan las tramas (o nullptr)
 } connection_t;
 
+int initListener(int port, bool reusePort);
 int initServer(int port);
 bool checkClient();
 connection_t initClient(std::string host, int port);
 
+/**
+ * @brief Socket de escucha local (AF_UNIX) en path; borra antes un socket
+ * abandonado en la misma ruta
+ * @return El socket en listen() o -1
+ */
+int initUnixListener(const std::string &path);
+
+/**
+ * @brief Conecta con el servidor por su socket local. Mismo protocolo que por
+ * TCP; además puede pedir el transporte de memoria compartida (shmring.h).
+ */
+connection_t initUnixClient(const std::string &path);
+
 template <typename t>
 void sendMSG(int clientID, std::vector<t> &data);
 template <typename t>
 void recvMSG(int clientID, std::vector<t> &data);
+bool recvFrame(int clientID, msg_cursor_t &frame);
+bool writeAll(int socket, struct iovec *iov, int iovcnt);
 
 int waitForConnections(int sock_fd);
 void closeConnection(int clientID);
@@ -53,45 +320,113 @@ template <typename t>
 void getMSG(int clientID, std::vector<t> &data);
 
 bool checkPendingMessages(int clientID);
-void recvMSGAsync(connection_t connection);
+
+/**
+ * @brief Saca el siguiente mensaje recibido sin copiarlo; devolverlo con releaseMSG
+ * @return El mensaje o nullptr si no hay ninguno pendiente
+ */
+msg_t *takeMSG(int clientID);
+
+/**
+ * @brief Bucle de recepción en segundo plano: cada trama se copia una sola vez
+ * desde el buffer de lectura a un mensaje del pool y se encola para getMSG/takeMSG
+ */
+void recvMSGAsync(int clientID);
 void waitForConnectionsAsync(int server_fd);
 
 int getNumClients();
 int getClientID(int numClient);
 int getLastClientID();
+int waitForClient();
 
-extern std::map<unsigned int, connection_t> clientList;
+/**
+ * Registro de conexiones. Sustituye al antiguo std::map global: las conexiones
+ * viven en un array denso de slots y el identificador lleva el índice del slot
+ * y una generación, así un id de una conexión ya cerrada nunca apunta a la que
+ * reutiliza su slot. Buscar una conexión no toma ningún cerrojo: se "fija" el
+ * slot con un contador atómico y closeConnection espera a que no quede ningún
+ * lector antes de liberar sus recursos.
+ */
+const int CONN_SLOT_BITS = 18;                           // 262144 conexiones simultáneas
+const int CONN_GENERATION_MASK = (1 << (31 - CONN_SLOT_BITS)) - 1; // ids siempre positivos
 
-template <typename t>
-void recvMSG(int clientID, std::vector<t> &data)
+typedef struct conn_slot_t
 {
+    std::atomic<int> id;   // id publicado (-1 si el slot está libre o cerrándose)
+    std::atomic<int> pins; // lectores que están usando la conexión
+    unsigned int generation;
+    // Un writev bloqueante puede quedarse a medias y writeAll envía el resto
+    // después: sin este cerrojo las tramas de dos hilos se intercalarían
+    std::mutex writeMutex;
+    connection_t conn;
+} conn_slot_t;
 
-    connection_t connection = clientList[clientID];
+conn_slot_t *pinConnection(int clientID);
+void unpinConnection(conn_slot_t *slot);
 
-    int socket = connection.socket;
+/**
+ * Referencia a una conexión registrada; mantiene el slot fijado mientras vive.
+ * Se evalúa a false si el id no corresponde a ninguna conexión abierta.
+ */
+typedef struct connection_ref_t
+{
+    conn_slot_t *slot;
 
-    int bufferSize = 0;
-    int readData = read(socket, &bufferSize, sizeof(int));
-    DEBUG_MSG("DatosLeidos : %d\n", bufferSize);
-    if (readData == 0)
+    explicit connection_ref_t(int clientID) : slot(pinConnection(clientID)) {}
+    connection_ref_t(const connection_ref_t &) = delete;
+    connection_ref_t &operator=(const connection_ref_t &) = delete;
+    ~connection_ref_t()
     {
-        printf("ERROR: recvMSG -- line : %d lost connection\n", __LINE__);
+        if (slot)
+            unpinConnection(slot);
     }
 
-    int numElements = bufferSize / sizeof(t);
-    data.resize(numElements);
-    int remaining = bufferSize;
-    int idxIn = 0;
-    while (remaining > 0)
-    {
-        int bufferSizeBlock = read(socket, &(data.data()[bufferSize - remaining]), remaining);
-        remaining -= bufferSizeBlock;
-    }
+    explicit operator bool() const { return slot != nullptr; }
+    connection_t *operator->() const { return &slot->conn; }
+} connection_ref_t;
+
+/**
+ * @brief Cambia el formato de las tramas que se leen de la conexión (tras
+ * acordar la versión en el saludo)
+ */
+void setFrameVersion(int clientID, int version);
+
+/**
+ * @brief Versión acordada con la conexión (PROTOCOL_V1 si no existe)
+ */
+int frameVersion(int clientID);
+
+/**
+ * @brief Anota si la conexión acordó compresión en el saludo, para elegir qué
+ * trama enviarle (false si no existe)
+ */
+void setFrameCompressed(int clientID, bool compressed);
+bool frameCompressed(int clientID);
 
-    if (remaining != 0)
+/**
+ * @brief Reserva un id (slot + generación) para una conexión nueva
+ * @return El id o -1 si el registro está lleno
+ */
+int reserveConnectionID();
+
+/**
+ * @brief Publica la conexión en el slot reservado; desde ese momento es visible
+ */
+void publishConnection(int clientID, const connection_t &connection);
+
+template <typename t>
+void recvMSG(int clientID, std::vector<t> &data)
+{
+    msg_cursor_t frame;
+    if (!recvFrame(clientID, frame))
     {
-        printf("ERROR: recvMSG -- line : %d error data not matching: %d read, %d espected\n", __LINE__, remaining, bufferSize);
+        data.resize(0);
+        return;
     }
+
+    int numElements = frame.size / sizeof(t);
+    data.resize(numElements);
+    memcpy(data.data(), frame.data, frame.size);
 }
 
 template <typename t>
@@ -99,32 +434,37 @@ void sendMSG(int clientID, std::vector<t> &data)
 {
 
     int dataLen = data.size() * sizeof(t);
-    connection_t connection = clientList[clientID];
+    connection_ref_t connection(clientID);
+    if (!connection)
+        return;
 
-    int socket = connection.socket;
+    int socket = connection->socket;
 
-    // enviar tamaño buffer
-    write(socket, &dataLen, sizeof(int));
-    // enviar buffer
-    write(socket, data.data(), dataLen);
+    // enviar tamaño y buffer juntos en una sola llamada (writev)
+    struct iovec iov[2];
+    iov[0].iov_base = &dataLen;
+    iov[0].iov_len = sizeof(int);
+    iov[1].iov_base = data.data();
+    iov[1].iov_len = dataLen;
+    std::lock_guard<std::mutex> lock(connection.slot->writeMutex);
+    if (!writeAll(socket, iov, 2))
+        LOG_ERROR("sendMSG -- line : %d %s", __LINE__, strerror(errno));
 }
 
 template <typename t>
 void getMSG(int clientID, std::vector<t> &data)
 {
-    if (!checkPendingMessages(clientID))
+    msg_t *msg = takeMSG(clientID);
+    if (msg == nullptr)
     {
         data.resize(0);
     }
     else
     {
-        msg_t *msg = clientList[clientID].buffer->front();
-        clientList[clientID].buffer->pop_front();
         int numElem = msg->size / sizeof(t);
         data.resize(numElem);
-        memcpy(data.data(), msg->data, msg->size);
-        delete[] msg->data;
-        delete[] msg;
+        memcpy(data.data(), msg->data, numElem * sizeof(t));
+        releaseMSG(msg);
     }
 }
 
@@ -141,16 +481,23 @@ inline void pack(std::vector<unsigned char> &packet, T data)
 template <typename T>
 inline void packv(std::vector<unsigned char> &packet, T *data, int dataSize)
 {
-    for (int i = 0; i < dataSize; i++)
-        pack(packet, data[i]);
+    // un único resize y una copia en bloque en lugar de un pack por elemento
+    int size = packet.size();
+    packet.resize(size + dataSize * sizeof(T));
+    memcpy(packet.data() + size, data, dataSize * sizeof(T));
 }
 
 template <typename T>
 inline T unpack(std::vector<unsigned char> &packet)
 {
-    T data;
+    T data = T();
     long int dataSize = sizeof(T);
     int packetSize = packet.size();
+    if (packetSize < dataSize) // mensaje truncado: no leer fuera del vector
+    {
+        packet.clear();
+        return data;
+    }
     memcpy(&data, packet.data(), dataSize);
     memcpy(packet.data(), packet.data() + dataSize, packetSize - dataSize);
     packet.resize(packetSize - dataSize);
@@ -162,9 +509,119 @@ inline void unpackv(std::vector<unsigned char> &packet, T *data, int dataSize)
 {
     dataSize *= sizeof(T);
     int packetSize = packet.size();
+    if (dataSize < 0 || packetSize < dataSize)
+    {
+        packet.clear();
+        return;
+    }
     memcpy(data, packet.data(), dataSize);
     memcpy(packet.data(), packet.data() + dataSize, packetSize - dataSize);
     packet.resize(packetSize - dataSize);
 }
 
+/**
+ * Constructor de tramas completas [int tamaño][datos]. Reserva de una vez el
+ * tamaño exacto, añade escalares y cadenas con un memcpy cada uno y escribe el
+ * prefijo de tamaño en su sitio al terminar, así la trama se envía de una sola
+ * vez. Reutilizando el mismo builder (threadFrameBuilder) el buffer conserva su
+ * capacidad y en régimen estacionario no se reserva memoria.
+ */
+typedef struct frame_builder_t
+{
+    std::vector<unsigned char> bytes;
+
+    /**
+     * @brief Empieza una trama nueva
+     * @param payloadSize Tamaño exacto (o estimado) de los datos, sin el prefijo
+     */
+    void begin(size_t payloadSize)
+    {
+        bytes.clear();
+        bytes.reserve(sizeof(int) + payloadSize);
+        bytes.resize(sizeof(int));
+    }
+
+    template <typename T>
+    void put(T data)
+    {
+        append(&data, sizeof(T));
+    }
+
+    // Cadena con prefijo de longitud: [int tamaño][chars]
+    void putString(std::string_view text)
+    {
+        put<int>(text.length());
+        append(text.data(), text.length());
+    }
+
+    void putVarint(unsigned long long value)
+    {
+        unsigned char buffer[10];
+        size_t size = 0;
+        while (value >= 0x80)
+        {
+            buffer[size++] = (unsigned char)(value | 0x80);
+            value >>= 7;
+        }
+        buffer[size++] = (unsigned char)value;
+        append(buffer, size);
+    }
+
+    // Cadena v2: [varint tamaño][chars]
+    void putVarintString(std::string_view text)
+    {
+        putVarint(text.length());
+        append(text.data(), text.length());
+    }
+
+    void append(const void *data, size_t size)
+    {
+        size_t pos = bytes.size();
+        bytes.resize(pos + size);
+        memcpy(bytes.data() + pos, data, size);
+    }
+
+    // Escribe el tamaño de los datos en el prefijo reservado por begin()
+    void finish()
+    {
+        int payloadLen = bytes.size() - sizeof(int);
+        memcpy(bytes.data(), &payloadLen, sizeof(int));
+    }
+
+    // Cabecera v2 en el mismo hueco: [u24 tamaño][u8 tipo] en orden de red
+    void finishV2(unsigned char type)
+    {
+        uint32_t header = htonl((uint32_t)(bytes.size() - sizeof(int)) << 8 | type);
+        memcpy(bytes.data(), &header, sizeof(header));
+    }
+
+    const unsigned char *payload() const { return bytes.data() + sizeof(int); }
+    size_t payloadSize() const { return bytes.size() - sizeof(int); }
+} frame_builder_t;
+
+// Tamaño que ocupa una cadena con su prefijo de longitud
+inline size_t stringFieldSize(std::string_view text)
+{
+    return sizeof(int) + text.length();
+}
+
+/**
+ * @brief Builder propio del hilo que llama, para reutilizar su buffer
+ */
+inline frame_builder_t &threadFrameBuilder()
+{
+    static thread_local frame_builder_t builder;
+    return builder;
+}
+
+/**
+ * @brief Envía una trama ya terminada (prefijo + datos) en una sola escritura
+ */
+void sendFrame(int clientID, const frame_builder_t &builder);
+
+/**
+ * @brief Envía varias tramas terminadas y concatenadas en una sola escritura
+ */
+void sendFrames(int clientID, const std::vector<unsigned char> &frames);
+
 #endif